@@ -57,10 +57,15 @@ extern "C" {
 #define IDSA_F_UPLOAD     0x0010	/* enable client side code */
 #define IDSA_F_TIMEOUT    0x0020	/* do not block indefinitely if server has gone bad */
 #define IDSA_F_NOBACKOFF  0x0040	/* always retry */
+#define IDSA_F_NOWAIT     0x0080	/* do not wait for verdicts, collect them later */
+#define IDSA_F_THREADS    0x0100	/* connection shared by several threads */
+#define IDSA_F_RING       0x0200	/* talk through shared memory if idsad can */
+#define IDSA_F_PACKED     0x0400	/* use the packed wire format if idsad can */
 
   IDSA_CONNECTION *idsa_open(char *name, char *credential, int flags);
   int idsa_close(IDSA_CONNECTION * c);
   int idsa_reset(IDSA_CONNECTION * c);
+  int idsa_flush(IDSA_CONNECTION * c);	/* wait for outstanding replies */
 
 /* event setup ************************************************************* */
 
@@ -125,7 +130,10 @@ extern "C" {
 #define IDSA_L_OK         IDSA_L_ALLOW
 #define IDSA_L_FORWARD    0x02	/* event forwarded to main logger (unused) */
 
+#define IDSA_MAX_BATCH      64	/* most events idsa_log_batch sends at once */
+
   int idsa_log(IDSA_CONNECTION * c, IDSA_EVENT * e);
+  int idsa_log_batch(IDSA_CONNECTION * c, IDSA_EVENT ** e, int count, int *v);
 
 /* get at error */
   int idsa_error(IDSA_CONNECTION * c);
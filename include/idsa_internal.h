@@ -22,6 +22,9 @@ extern "C" {
 #define IDSA_S_OFFSET (3*sizeof(unsigned int))
 #define IDSA_M_UNITS  (IDSA_M_MESSAGE-IDSA_S_OFFSET)
 #define IDSA_M_RISKS         3	/* number of risk types */
+#define IDSA_EVENT_HASH     64	/* buckets of unit lookup by name, power of two */
+#define IDSA_PRESET_UNITS   32	/* leading units of a template kept encoded, bits in e_dirty */
+#define IDSA_EVENT_RAW     256	/* bits of e_raw, more units do not fit */
 /* define the structures mentioned in idsa.h ****************************** */ struct idsa_unit {
     char u_name[IDSA_M_NAME];
     unsigned int u_type;
@@ -33,6 +36,13 @@ extern "C" {
     unsigned int e_size;	/* size to be written */
     unsigned int e_count;	/* count of units */
     char e_ptr[IDSA_M_UNITS];
+    unsigned char e_hash[IDSA_EVENT_HASH];	/* 1 + number of latest unit with name in bucket, not sent */
+    unsigned char e_chain[IDSA_EVENT_RAW];	/* 1 + number of the unit before each in its bucket, not sent */
+    unsigned int e_origin;	/* p_origin of the template copied, zero if none, not sent */
+    unsigned int e_dirty;	/* units set since, one bit each, not sent */
+    unsigned int e_slack;	/* units may not fill their slot, so only the index tells where the next starts, not sent */
+    unsigned char e_raw[IDSA_EVENT_RAW / 8];	/* units still holding their value as text, one bit each, not sent */
+    unsigned int e_fault;	/* one of them did not scan, the event is no good, not sent */
   };
 
 /* manipulation of units  ************************************************* */
@@ -42,6 +52,8 @@ extern "C" {
 
   unsigned int idsa_unit_type(IDSA_UNIT * u);
   int idsa_unit_size(IDSA_UNIT * u);
+  int idsa_unit_payload(IDSA_UNIT * u);
+  int idsa_type_payload(unsigned int t, int l);
 
   IDSA_UNIT *idsa_unit_new(char *n, unsigned int t, char *s);
   IDSA_UNIT *idsa_unit_dup(IDSA_UNIT * u);
@@ -77,6 +89,11 @@ extern "C" {
 
   int idsa_descape_unix(unsigned char *buffer, int len);
 
+  int idsa_scan_unix(unsigned char *buffer, int len);
+  int idsa_scan_xml(unsigned char *buffer, int len);
+  int idsa_scan_descape(unsigned char *buffer, int len);
+  int idsa_scan_field(unsigned char *buffer, int len);
+
 /* type related information *********************************************** */
 
   struct idsa_type_details;
@@ -108,6 +125,7 @@ extern "C" {
 
   IDSA_UNIT *idsa_event_unitbyname(IDSA_EVENT * e, char *n);
   IDSA_UNIT *idsa_event_unitbynumber(IDSA_EVENT * e, int n);
+  unsigned int idsa_event_unittype(IDSA_EVENT * e, int n);
 
   IDSA_UNIT *idsa_event_setbynumber(IDSA_EVENT * e, int n, void *p);
   IDSA_UNIT *idsa_event_scanbynumber(IDSA_EVENT * e, int n, char *s);
@@ -115,6 +133,8 @@ extern "C" {
   IDSA_UNIT *idsa_event_unitappend(IDSA_EVENT * e, IDSA_UNIT * u);
   IDSA_UNIT *idsa_event_setappend(IDSA_EVENT * e, char *n, unsigned int t, void *p);
   IDSA_UNIT *idsa_event_scanappend(IDSA_EVENT * e, char *n, unsigned int t, char *s);
+  IDSA_UNIT *idsa_event_rawappend(IDSA_EVENT * e, char *n, unsigned int t, char *p, int l);
+  IDSA_UNIT *idsa_event_lazyappend(IDSA_EVENT * e, char *n, unsigned int t, char *s, int l);
   IDSA_UNIT *idsa_event_append(IDSA_EVENT * e, unsigned int t);
 
 #include <stdio.h>
@@ -128,7 +148,7 @@ extern "C" {
 
 #define IDSA_M_REQUEST          12	/* request required + 1 */
 #define IDSA_M_REPLY             1	/* reply required + 1 */
-#define IDSA_M_RESERVED         28	/* number of reserved fields +1 */
+#define IDSA_M_RESERVED         31	/* number of reserved fields +1 */
 #define IDSA_M_UNKNOWN        1000	/* > max(REPLY,REQUEST,RESERVED) */
 
 #define IDSA_Q_PID               0	/* "pid" */
@@ -161,6 +181,9 @@ extern "C" {
 #define IDSA_O_SLEEP            25	/* "sleep" */
 #define IDSA_O_STOP             26	/* "stop" */
 #define IDSA_O_ENV              27	/* "env" */
+#define IDSA_O_CACHE            28	/* "seconds the verdict may be reused" */
+#define IDSA_O_CACHEKEY         29	/* "fields which have to match for reuse" */
+#define IDSA_O_GENERATION       30	/* "rules the verdict was made by" */
 
   unsigned int idsa_resolve_code(char *n);
   char *idsa_resolve_name(unsigned int c);
@@ -206,8 +229,65 @@ extern "C" {
 
 /* raw io ***************************************************************** */
 
+#define IDSA_WIRE_TEXT       0	/* name:type="value" */
+#define IDSA_WIRE_PACKED     1	/* version of the packed format, see wire.c */
+#define IDSA_PACK_REQUEST '\001'	/* tags of packed messages */
+#define IDSA_PACK_REPLY   '\002'
+#define IDSA_PACK_HEAD       3	/* tag and length of IDSA_M_MESSAGE at most */
+
   int idsa_event_tobuffer(IDSA_EVENT * e, char *s, int l);
   int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l);
+  int idsa_event_lazybuffer(IDSA_EVENT * e, char *s, int l);
+  int idsa_event_topacked(IDSA_EVENT * e, char *s, int l);
+  int idsa_event_frompacked(IDSA_EVENT * e, char *s, int l);
+  int idsa_wire_frame(char *s, int l);
+
+  struct idsa_preset {		/* template with its units already encoded */
+    unsigned int p_origin;	/* e_origin of events copied from the template */
+    int p_wire;			/* IDSA_WIRE_* of p_text */
+    unsigned int p_count;	/* leading units encoded */
+    int p_start[IDSA_PRESET_UNITS];	/* unit i is p_text from p_start to p_end */
+    int p_end[IDSA_PRESET_UNITS];
+    char p_text[IDSA_M_MESSAGE];
+  };
+  typedef struct idsa_preset IDSA_PRESET;
+
+  void idsa_preset_init(IDSA_PRESET * p, IDSA_EVENT * e, unsigned int origin, int wire);
+  int idsa_preset_tobuffer(IDSA_PRESET * p, IDSA_EVENT * e, char *s, int l);
+
+/* options a client may ask for when connecting *************************** */
+
+#define IDSA_HELLO       "%hello"	/* followed by the options wanted */
+#define IDSA_HELLO_RING  "ring"	/* shared memory transport */
+#define IDSA_HELLO_WIRE  "wire="	/* followed by IDSA_WIRE_* */
+#define IDSA_HELLO_SIZE  IDSA_M_MESSAGE	/* padded with blanks, newline last */
+
+/* shared memory transport, see ring.c ************************************ */
+
+#define IDSA_RING_SIZE  (16 * IDSA_M_MESSAGE)	/* each direction, power of two */
+
+  struct idsa_ring_half {	/* one direction, a single producer and consumer */
+    volatile unsigned int h_head;	/* bytes ever produced, only producer writes */
+    volatile unsigned int h_tail;	/* bytes ever consumed, only consumer writes */
+    volatile int h_waiting;	/* consumer sleeps until notified */
+    volatile int h_full;	/* producer sleeps until notified */
+    char h_data[IDSA_RING_SIZE];
+  };
+  typedef struct idsa_ring_half IDSA_RING_HALF;
+
+  struct idsa_ring {
+    IDSA_RING_HALF r_request;	/* client to idsad */
+    IDSA_RING_HALF r_reply;	/* idsad to client */
+    volatile int r_generation;	/* of the rules in force, only idsad writes */
+  };
+  typedef struct idsa_ring IDSA_RING;
+
+  void idsa_ring_init(IDSA_RING * r);
+  int idsa_ring_put(IDSA_RING_HALF * h, char *s, int l);
+  int idsa_ring_get(IDSA_RING_HALF * h, char *s, int l);
+  int idsa_ring_used(IDSA_RING_HALF * h);
+  int idsa_ring_sleep(IDSA_RING_HALF * h, int producer);
+  int idsa_ring_wake(IDSA_RING_HALF * h, int producer);
 
 /* assorted output formats ************************************************ */
 
@@ -318,32 +398,74 @@ extern "C" {
     struct idsa_rule_node *n_true, *n_false;	/* which branch we should follow */
     struct idsa_rule_body *n_body;	/* what should be done */
     int n_count;		/* reference count */
+    int n_index;		/* position in c_steps, -1 until compiled */
+    int n_mark;			/* scratch for idsa_chain_optimize, else -1 */
   };
   typedef struct idsa_rule_node IDSA_RULE_NODE;
 
+  struct idsa_rule_step {	/* node as evaluated, see idsa_chain_compile */
+    struct idsa_rule_test s_test;	/* copy of the test, t_module NULL if none */
+    int s_true, s_false;	/* index of next step, -1 to stop */
+    struct idsa_rule_action *s_array;	/* copies of actions, in c_steps block */
+    int s_have;			/* number of actions */
+    char s_deny;
+    char s_drop;
+  };
+  typedef struct idsa_rule_step IDSA_RULE_STEP;
+
   struct idsa_rule_local {
     int l_result;
 
+    int l_clocks;		/* which of the times below are valid */
+    time_t l_time;		/* wall clock */
+    time_t l_clock;		/* monotonic clock, for expiries */
+
+    int l_flags;		/* IDSA_LOCAL_F_*, see idsa_local_suspend */
+    int l_pending;		/* test of l_step started but not completed */
+    int l_waitfd;		/* what the pending test waits for, -1 if nothing */
+    int l_waitmask;		/* IDSA_WAIT_* */
+    int l_waitms;		/* how long it is prepared to wait */
+
     IDSA_EVENT *l_request;
     IDSA_EVENT *l_reply;
 
-    IDSA_RULE_NODE *l_node;
+    int l_step;			/* where evaluation continues, -1 if done */
   };
   typedef struct idsa_rule_local IDSA_RULE_LOCAL;
 
+#define IDSA_LOCAL_F_SUSPEND 0x0001	/* caller can resume pending evaluations */
+#define IDSA_LOCAL_F_EXPIRED 0x0002	/* caller gave up waiting for pending test */
+
+#define IDSA_WAIT_READ  0x01
+#define IDSA_WAIT_WRITE 0x02
+
+  /* s is the state given to idsa_chain_serialize, l a module lock or NULL for the chain */
+  typedef void (*IDSA_CHAIN_LOCK) (void *s, void *l);
+
+  struct idsa_rule_chain;
+  /* s is the state given to idsa_chain_defer, returns zero if it took a over */
+  typedef int (*IDSA_CHAIN_DEFER) (void *s, struct idsa_rule_chain * c, IDSA_RULE_LOCAL * l, IDSA_RULE_ACTION * a);
+
   struct idsa_rule_chain {
-    IDSA_RULE_NODE *c_nodes;
+    IDSA_RULE_NODE *c_nodes;	/* graph built by parser, NULL once compiled */
+    IDSA_RULE_STEP *c_steps;	/* compiled graph, root first */
     IDSA_RULE_TEST *c_tests;
     IDSA_RULE_ACTION *c_actions;
 
     struct idsa_module *c_modules;	/* dynamic modules */
 
     int c_nodecount;		/* number of nodes in flight */
+    int c_stepcount;		/* number of compiled nodes */
     int c_testcount;		/* number of tests */
     int c_actioncount;		/* number of actions */
     int c_modulecount;		/* number of modules loaded */
     int c_rulecount;		/* number of rules */
 
+    int c_parsednodes;		/* size of graph as parsed, */
+    int c_parsedtests;		/* nodes and the tests they carry */
+    int c_optimalnodes;		/* same after idsa_chain_optimize */
+    int c_optimaltests;
+
     int c_flags;
 
     int c_error;
@@ -351,6 +473,13 @@ extern "C" {
     IDSA_EVENT *c_event;
 
     char *c_chain;		/* chain name */
+
+    IDSA_CHAIN_LOCK c_lock;	/* NULL unless evaluated by several threads */
+    IDSA_CHAIN_LOCK c_unlock;
+    void *c_lockstate;
+
+    IDSA_CHAIN_DEFER c_defer;	/* NULL if all actions are run inline */
+    void *c_deferstate;
   };
   typedef struct idsa_rule_chain IDSA_RULE_CHAIN;
 
@@ -358,25 +487,43 @@ extern "C" {
 #define IDSA_CHAIN_AGAIN 1
 #define IDSA_CHAIN_DROP  2
 
+/* flags for idsa_parse_*, so that the rule compiler can be checked */
+#define IDSA_CHAIN_F_GRAPH 0x0001	/* keep the parsed graph, not run by idsa_chain_run */
+#define IDSA_CHAIN_F_ASIS  0x0002	/* compile without idsa_chain_optimize */
+
 /* module interface *********************************************************/
 
-#define IDSA_MODULE_INTERFACE_VERSION 0
+#define IDSA_MODULE_INTERFACE_VERSION 1
+
+/* test_do and action_do may be called concurrently, otherwise they are serialized */
+#define IDSA_MODULE_F_CONCURRENT 0x0001
+/* action_do neither changes the reply nor anything tests look at, so may run later */
+#define IDSA_MODULE_F_DEFER      0x0002
+/* test_do only looks at the request and has no effects, so its outcome may be reused */
+#define IDSA_MODULE_F_PURE       0x0004
+/* test_do gives the same outcome for any request, and may be called with l and q NULL */
+#define IDSA_MODULE_F_CONSTANT   0x0008
+
+/* test_do returns this to suspend the evaluation, see idsa_local_wait */
+#define IDSA_MODULE_PENDING (-1)
 
   typedef void *(*IDSA_MODULE_GLOBAL_START) (IDSA_RULE_CHAIN * c);
   typedef int (*IDSA_MODULE_GLOBAL_BEFORE) (IDSA_RULE_CHAIN * c, void *g, IDSA_EVENT * q);
   typedef int (*IDSA_MODULE_GLOBAL_AFTER) (IDSA_RULE_CHAIN * c, void *g, IDSA_EVENT * q, IDSA_EVENT * p);
   typedef void (*IDSA_MODULE_GLOBAL_STOP) (IDSA_RULE_CHAIN * c, void *g);
+  /* g is state of module in new chain c, h that of the same module in an older chain */
+  typedef void (*IDSA_MODULE_GLOBAL_CARRY) (IDSA_RULE_CHAIN * c, void *g, void *h);
 
 
   typedef void *(*IDSA_MODULE_TEST_START) (IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g);
   typedef int (*IDSA_MODULE_TEST_CACHE) (IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, void *t);
-  typedef int (*IDSA_MODULE_TEST_DO) (IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q);	/* return true, false and maybe stall ? */
+  typedef int (*IDSA_MODULE_TEST_DO) (IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q);	/* return true, false and maybe stall ? */
   typedef void (*IDSA_MODULE_TEST_STOP) (IDSA_RULE_CHAIN * c, void *g, void *t);
 
 
   typedef void *(*IDSA_MODULE_ACTION_START) (IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g);
   typedef int (*IDSA_MODULE_ACTION_CACHE) (IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, void *a);
-  typedef int (*IDSA_MODULE_ACTION_DO) (IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p);
+  typedef int (*IDSA_MODULE_ACTION_DO) (IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p);
   /* return mask of deny, drop */
   typedef void (*IDSA_MODULE_ACTION_STOP) (IDSA_RULE_CHAIN * c, void *g, void *a);
 
@@ -403,6 +550,11 @@ extern "C" {
     IDSA_MODULE_ACTION_CACHE action_cache;
     IDSA_MODULE_ACTION_DO action_do;
     IDSA_MODULE_ACTION_STOP action_stop;
+
+    int m_flags;		/* IDSA_MODULE_F_* */
+    void *m_lock;		/* belongs to whoever called idsa_chain_serialize */
+
+    IDSA_MODULE_GLOBAL_CARRY global_carry;	/* NULL if nothing worth keeping */
   };
   typedef struct idsa_module IDSA_MODULE;
 
@@ -410,13 +562,14 @@ extern "C" {
   int idsa_module_before_global(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l);
   int idsa_module_after_global(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l);
   void idsa_module_stop_global(IDSA_RULE_CHAIN * c);
+  int idsa_module_carry_global(IDSA_RULE_CHAIN * c, IDSA_RULE_CHAIN * o);
 
   IDSA_RULE_TEST *idsa_module_start_test(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, char *n);
-  int idsa_module_do_test(IDSA_RULE_CHAIN * c, IDSA_RULE_TEST * t, IDSA_EVENT * q);
+  int idsa_module_do_test(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_RULE_TEST * t, IDSA_EVENT * q);
   void idsa_module_stop_test(IDSA_RULE_CHAIN * c, IDSA_RULE_TEST * t);
 
   IDSA_RULE_ACTION *idsa_module_start_action(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, char *n);
-  int idsa_module_do_action(IDSA_RULE_CHAIN * c, IDSA_RULE_ACTION * a, IDSA_EVENT * q, IDSA_EVENT * p);
+  int idsa_module_do_action(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_RULE_ACTION * a, IDSA_EVENT * q, IDSA_EVENT * p);
   void idsa_module_stop_action(IDSA_RULE_CHAIN * c, IDSA_RULE_ACTION * a);
 
 /* dyamic module loader *************************************************** */
@@ -455,6 +608,7 @@ extern "C" {
 
   char *idsa_chain_getname(IDSA_RULE_CHAIN * c);
   void idsa_chain_setname(IDSA_RULE_CHAIN * c, char *name);
+  void idsa_chain_setevent(IDSA_RULE_CHAIN * c, IDSA_EVENT * e);
 
   IDSA_RULE_ACTION *idsa_action_new(IDSA_RULE_CHAIN * c);
   int idsa_action_free(IDSA_RULE_CHAIN * c, IDSA_RULE_ACTION * a);
@@ -481,10 +635,27 @@ extern "C" {
   int idsa_local_init(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_EVENT * q, IDSA_EVENT * p);
   int idsa_local_quit(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l);	/* to unlock */
 
+  void idsa_local_settime(IDSA_RULE_LOCAL * l, time_t wall, time_t mono);	/* caller knows the time */
+  time_t idsa_local_time(IDSA_RULE_LOCAL * l);	/* same instant throughout one evaluation */
+  time_t idsa_local_clock(IDSA_RULE_LOCAL * l);	/* monotonic variant, for expiries */
+  time_t idsa_monotonic();
+
+  void idsa_local_suspend(IDSA_RULE_LOCAL * l);	/* caller will resume IDSA_CHAIN_AGAIN */
+  void idsa_local_expire(IDSA_RULE_LOCAL * l);	/* resumed because wait timed out */
+  int idsa_local_cansuspend(IDSA_RULE_LOCAL * l);
+  int idsa_local_expired(IDSA_RULE_LOCAL * l);
+  int idsa_local_wait(IDSA_RULE_LOCAL * l, int fd, int mask, int ms);
+
   IDSA_RULE_CHAIN *idsa_chain_start(IDSA_EVENT * e, int flags);
+  int idsa_chain_optimize(IDSA_RULE_CHAIN * c);
+  int idsa_chain_compile(IDSA_RULE_CHAIN * c);
   int idsa_chain_run(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l);
   int idsa_chain_stop(IDSA_RULE_CHAIN * c);
 
+  void idsa_chain_serialize(IDSA_RULE_CHAIN * c, IDSA_CHAIN_LOCK lock, IDSA_CHAIN_LOCK unlock, void *s);
+  void idsa_chain_defer(IDSA_RULE_CHAIN * c, IDSA_CHAIN_DEFER d, void *s);
+  int idsa_chain_carry(IDSA_RULE_CHAIN * c, IDSA_RULE_CHAIN * o);
+
   int idsa_chain_failure(IDSA_RULE_CHAIN * c);	/* is there a serious error */
   int idsa_chain_notice(IDSA_RULE_CHAIN * c);	/* a message is available */
   int idsa_chain_reset(IDSA_RULE_CHAIN * c);	/* reset the message flag */
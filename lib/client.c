@@ -15,8 +15,13 @@
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
@@ -33,15 +38,78 @@ static char *idsa_chn_auto = "auto";
 static char *idsa_chn_pre = "pre";
 static char *idsa_chn_fail = "fail";
 
-#define IDSA_MAX_BACKOFF     255
+#define IDSA_MIN_BACKOFF     125	/* ms until the first reconnect */
+#define IDSA_MAX_BACKOFF   32000	/* ms between reconnects, at most */
 #define IDSA_DEFAULT_TIMEOUT 300
+#define IDSA_HELLO_TIMEOUT     2	/* s to answer a hello sent in the background */
+#define IDSA_PENDING_CONNECT   1	/* c_pending: connect not yet through */
+#define IDSA_PENDING_HELLO     2	/* c_pending: hello sent, no answer yet */
+#define IDSA_SEND_WIRE         2	/* idsa_client_send: encode again for c_wire */
+#define IDSA_MAX_INFLIGHT     64	/* replies outstanding with IDSA_F_NOWAIT */
+#define IDSA_M_BATCH (4 * IDSA_M_MESSAGE)	/* requests written at once */
+
+#define IDSA_CACHE_SLOTS      32	/* verdicts remembered, see IDSA_O_CACHE */
+#define IDSA_CACHE_WAYS        2	/* slots a key may occupy */
+#define IDSA_CACHE_DEFAULT "service name scheme uid"
+
+#define IDSA_POOL_SLOTS       16	/* spare events kept for idsa_event */
+
+/* slots of the pool change hands with a single atomic instruction */
+#ifdef __GNUC__
+#define idsa_pool_take(p)    __sync_lock_test_and_set((p), NULL)
+#define idsa_pool_give(p, e) __sync_bool_compare_and_swap((p), NULL, (e))
+#else
+#define IDSA_POOL_UNSAFE	/* IDSA_F_THREADS not available */
+#define idsa_pool_take(p)    idsa_pool_swap((p), NULL)
+#define idsa_pool_give(p, e) ((*(p) == NULL) && (idsa_pool_swap((p), (e)) == NULL))
+static IDSA_EVENT *idsa_pool_swap(IDSA_EVENT ** p, IDSA_EVENT * e)
+{
+  IDSA_EVENT *old;
+
+  old = *p;
+  *p = e;
+
+  return old;
+}
+#endif
+
+/* copies of different templates, even of other connections, must not mix */
+static unsigned int idsa_client_origin = 0;
+#ifdef __GNUC__
+#define idsa_origin_next()   __sync_add_and_fetch(&idsa_client_origin, 1)
+#else
+#define idsa_origin_next()   (++idsa_client_origin)
+#endif
+
+struct idsa_verdict {		/* a reply idsad allowed us to reuse */
+  time_t v_until;		/* zero if slot unused */
+  unsigned int v_hash;
+  int v_length;
+  int v_result;
+  char v_reason[IDSA_M_STRING];
+  char v_key[IDSA_M_LONG];	/* values of the c_cachekey fields */
+};
+
+struct idsa_slot {		/* per thread state with IDSA_F_THREADS */
+  struct idsa_slot *s_next;
+  IDSA_CONNECTION *s_connection;
+  IDSA_EVENT *s_spare;		/* recycled by this thread only */
+  int s_done;			/* reply has been delivered */
+  int s_result;			/* its verdict, -1 if it never came */
+  int s_hint;
+  char s_reason[IDSA_M_STRING];
+};
 
 struct idsa_connection {
   int c_fd;			/* fd to idsad */
   int c_result;
 
   int c_error;
-  int c_backoff;
+  int c_backoff;		/* ms between reconnects, zero while connected */
+  unsigned long c_retry;	/* idsa_client_now of the next reconnect */
+  unsigned int c_seed;		/* jitter, differs between processes */
+  int c_pending;		/* c_fd is still connecting, IDSA_PENDING_* */
+  time_t c_hello;		/* idsa_monotonic by which the hello is answered */
   int c_fresh;			/* new error to be reported */
   int c_timeout;		/* longest time to stay in call if no IDSA_F_UPLOAD */
 
@@ -51,7 +119,8 @@ struct idsa_connection {
   char c_credential[IDSA_M_STRING];	/* unused */
 
   IDSA_EVENT *c_template;	/* template for other events */
-  IDSA_EVENT *c_cache;		/* simple cache for malloc */
+  IDSA_PRESET c_preset;		/* c_template encoded, changes with it */
+  IDSA_EVENT *c_pool[IDSA_POOL_SLOTS];	/* spare events, saves malloc */
   IDSA_EVENT *c_reply;		/* read reply */
   IDSA_EVENT *c_internal;	/* event for internal errors/messages */
 
@@ -61,6 +130,32 @@ struct idsa_connection {
   IDSA_RULE_CHAIN *c_chain;	/* table of rules */
   IDSA_RULE_LOCAL *c_local;	/* arguments sent to rule interpreter */
 
+  int c_inflight;		/* requests sent but not yet answered */
+  int c_head;			/* c_waiting entry of the oldest of them */
+  int c_roff;			/* start of the first reply not yet taken */
+  int c_rscan;			/* no text reply ends between c_roff and here */
+  int c_rlen;			/* bytes in c_rbuf */
+  char c_rbuf[IDSA_M_MESSAGE];	/* replies as received, complete or not */
+
+  IDSA_RING *c_ring;		/* shared with idsad if IDSA_F_RING, else NULL */
+  int c_noring;			/* idsad does not do rings, do not ask again */
+  int c_nohello;		/* idsad does not take a hello at all */
+  int c_wire;			/* IDSA_WIRE_* agreed with idsad */
+
+  /* only used with IDSA_F_THREADS */
+  pthread_mutex_t c_lock;	/* everything but c_pool and c_template */
+  pthread_rwlock_t c_tlock;	/* c_template and c_preset */
+  pthread_cond_t c_ready;	/* slot done or c_reader released */
+  pthread_key_t c_key;		/* struct idsa_slot of calling thread */
+  struct idsa_slot *c_slots;	/* all of them */
+  struct idsa_slot *c_waiting[IDSA_MAX_INFLIGHT];	/* in order of request */
+  int c_reader;			/* a thread is receiving into c_rbuf */
+
+  struct idsa_verdict *c_verdicts;	/* allocated once a reply is cacheable */
+  int c_generation;		/* of the rules which made c_verdicts */
+  int c_hint;			/* lifetime granted by the last reply */
+  char c_cachekey[IDSA_M_STRING];	/* names of fields forming the key */
+
 #ifdef WANTS_PROF
   clock_t c_libtime;
   clock_t c_systime;
@@ -69,10 +164,30 @@ struct idsa_connection {
 #endif
 };
 
-static int idsa_client_connect(IDSA_CONNECTION * c);
-static int idsa_client_write(IDSA_CONNECTION * c, IDSA_EVENT * e);
+static int idsa_client_connect(IDSA_CONNECTION * c, int block);
+static int idsa_client_ready(IDSA_CONNECTION * c, int block);
+static int idsa_client_retry(IDSA_CONNECTION * c);
+static void idsa_client_backoff(IDSA_CONNECTION * c);
+static unsigned long idsa_client_now();
+static int idsa_client_write(IDSA_CONNECTION * c, char *buffer, int should_write);
 static int idsa_client_read(IDSA_CONNECTION * c, IDSA_EVENT * e);
+static char *idsa_client_frame(IDSA_CONNECTION * c, int *length);
+static int idsa_client_room(IDSA_CONNECTION * c);
+static int idsa_client_send(IDSA_CONNECTION * c, char *buffer, int length);
 static int idsa_client_io(IDSA_CONNECTION * c, IDSA_EVENT * q, IDSA_EVENT * p);
+static int idsa_client_reap(IDSA_CONNECTION * c, int keep, int *verdicts, struct idsa_slot *until);
+static void idsa_client_abandon(IDSA_CONNECTION * c);
+static time_t idsa_client_deadline(IDSA_CONNECTION * c);
+static int idsa_client_wait(IDSA_CONNECTION * c, int events, time_t deadline);
+
+static int idsa_client_hello(IDSA_CONNECTION * c, int block);
+static int idsa_client_answer(IDSA_CONNECTION * c, int block);
+static void idsa_client_agree(IDSA_CONNECTION * c, int wire);
+static int idsa_client_wanted(IDSA_CONNECTION * c);
+static int idsa_client_give(IDSA_CONNECTION * c, char *buffer, int length);
+static int idsa_client_take(IDSA_CONNECTION * c, char *buffer, int length, time_t deadline, int block);
+static int idsa_client_doorbell(IDSA_CONNECTION * c, time_t deadline);
+static int idsa_client_ring_notify(IDSA_CONNECTION * c);
 
 static int idsa_putenv(IDSA_UNIT * u);
 
@@ -81,6 +196,17 @@ static int idsa_client_rule(IDSA_CONNECTION * c, IDSA_EVENT * e);
 static int idsa_client_install(IDSA_CONNECTION * c, IDSA_UNIT * u, int number, int file);
 static int idsa_client_reply(IDSA_CONNECTION * c);
 
+static int idsa_cache_lookup(IDSA_CONNECTION * c, IDSA_EVENT * e, time_t now);
+static void idsa_cache_store(IDSA_CONNECTION * c, IDSA_EVENT * e, int result, time_t now);
+static void idsa_cache_flush(IDSA_CONNECTION * c);
+
+static struct idsa_slot *idsa_client_slot(IDSA_CONNECTION * c);
+static void idsa_slot_release(void *p);
+static void idsa_client_template(IDSA_CONNECTION * c, IDSA_EVENT * e);
+static void idsa_client_preset(IDSA_CONNECTION * c);
+static int idsa_client_encode(IDSA_CONNECTION * c, IDSA_EVENT * e, char *s, int l);
+static void idsa_pool_flush(IDSA_CONNECTION * c);
+
 #ifdef FALLBACK
 static int idsa_client_standalone(IDSA_CONNECTION * c);
 #endif
@@ -94,20 +220,6 @@ static void idsa_client_handle_error(IDSA_CONNECTION * c);
 static void idsa_client_error_system(IDSA_CONNECTION * c, int err, char *s, ...);
 */
 
-static volatile int idsa_alarm_set = 0;
-
-/****************************************************************************/
-/* Does       : notices if an alarm has happened                            */
-/* Parameters :                                                             */
-/* Returns    :                                                             */
-/* Errors     :                                                             */
-/* Notes      : only gets involved if IDSA_F_TIMEOUT is used                */
-
-static void idsa_alarm_handle(int s)
-{
-  idsa_alarm_set = 1;
-}
-
 /****************************************************************************/
 /* Does       : set up the entire thing                                     */
 /* Parameters : service - your name, credential - NULL for the time being   */
@@ -117,6 +229,7 @@ static void idsa_alarm_handle(int s)
 IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
 {
   IDSA_CONNECTION *c;
+  int i;
 #ifndef MSG_NOSIGNAL
   struct sigaction sag;
 #endif
@@ -125,6 +238,12 @@ IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
     return NULL;
   }
 
+#ifdef IDSA_POOL_UNSAFE
+  if (flags & IDSA_F_THREADS) {
+    return NULL;
+  }
+#endif
+
   c = malloc(sizeof(IDSA_CONNECTION));
   if (c == NULL) {
     return c;
@@ -134,7 +253,11 @@ IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
   c->c_result = 0;
 
   c->c_error = 0;
-  c->c_backoff = 1;
+  c->c_backoff = 0;
+  c->c_retry = 0;
+  c->c_seed = getpid() ^ time(NULL) ^ (unsigned long) c;
+  c->c_pending = 0;
+  c->c_hello = 0;
   c->c_fresh = 0;
   c->c_timeout = IDSA_DEFAULT_TIMEOUT;
 
@@ -151,8 +274,10 @@ IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
     c->c_credential[0] = '\0';
   }
 
-  /* allocate 4 events */
-  c->c_cache = idsa_event_new(0);
+  /* allocate 3 events, more as needed */
+  for (i = 0; i < IDSA_POOL_SLOTS; i++) {
+    c->c_pool[i] = NULL;
+  }
   c->c_template = idsa_event_new(0);
   c->c_reply = idsa_event_new(0);
   c->c_internal = idsa_event_new(0);
@@ -163,6 +288,28 @@ IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
   c->c_chain = NULL;
   c->c_local = NULL;
 
+  c->c_inflight = 0;
+  c->c_head = 0;
+  c->c_roff = 0;
+  c->c_rscan = 0;
+  c->c_rlen = 0;
+
+  c->c_ring = NULL;
+  c->c_noring = 0;
+  c->c_nohello = 0;
+  c->c_wire = IDSA_WIRE_TEXT;
+
+  c->c_slots = NULL;
+  c->c_reader = 0;
+  for (i = 0; i < IDSA_MAX_INFLIGHT; i++) {
+    c->c_waiting[i] = NULL;
+  }
+
+  c->c_verdicts = NULL;
+  c->c_generation = 0;
+  c->c_hint = 0;
+  strcpy(c->c_cachekey, IDSA_CACHE_DEFAULT);
+
 #ifdef WANTS_PROF
   c->c_systime = 0;
   c->c_libtime = 0;
@@ -170,8 +317,18 @@ IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
   c->c_profnum = 0;
 #endif
 
-  if ((c->c_cache == NULL) || (c->c_template == NULL)
-      || (c->c_reply == NULL) || (c->c_internal == NULL)) {
+  if (flags & IDSA_F_THREADS) {
+    if (pthread_key_create(&(c->c_key), &idsa_slot_release)) {
+      c->c_flags &= ~IDSA_F_THREADS;	/* nothing to undo in close */
+      idsa_close(c);
+      return NULL;
+    }
+    pthread_mutex_init(&(c->c_lock), NULL);
+    pthread_rwlock_init(&(c->c_tlock), NULL);
+    pthread_cond_init(&(c->c_ready), NULL);
+  }
+
+  if ((c->c_template == NULL) || (c->c_reply == NULL) || (c->c_internal == NULL)) {
     idsa_close(c);
     return NULL;
   }
@@ -189,13 +346,14 @@ IDSA_CONNECTION *idsa_open(char *service, char *credential, int flags)
 
   /* fill in the defaults for an event request */
   idsa_request_init(c->c_template, c->c_service, c->c_service, c->c_service);
+  idsa_client_preset(c);
 
 #ifdef FALLBACK
-  if (idsa_client_connect(c)) {
+  if (idsa_client_connect(c, 1)) {
     idsa_client_standalone(c);
   }
 #else
-  idsa_client_connect(c);	/* start talking to other side */
+  idsa_client_connect(c, 1);	/* start talking to other side */
 #endif
 
   return c;
@@ -222,9 +380,12 @@ int idsa_reset(IDSA_CONNECTION * c)
     c->c_chain = NULL;
   }
 
-  idsa_request_init(c->c_template, c->c_service, c->c_service, c->c_service);
+  idsa_template(c, NULL);
+
+  /* parent and child should not retry in step */
+  c->c_seed ^= getpid();
 
-  result = idsa_client_connect(c);
+  result = idsa_client_connect(c, 1);
 
 #ifdef FALLBACK
   if (result) {
@@ -235,20 +396,70 @@ int idsa_reset(IDSA_CONNECTION * c)
   return result;
 }
 
+/****************************************************************************/
+/* Does       : Waits for the replies to all requests sent so far. Only of  */
+/*              use with IDSA_F_NOWAIT, where idsa_log does not wait        */
+/* Returns    : zero on success, nonzero if replies were lost               */
+/* Notes      : Deliberately not done by idsa_reset, after a fork the       */
+/*              replies belong to the parent                                */
+
+int idsa_flush(IDSA_CONNECTION * c)
+{
+  int result;
+
+  if (c == NULL) {
+    return 0;
+  }
+
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_mutex_lock(&(c->c_lock));
+  }
+
+  result = 0;
+  if ((c->c_inflight > 0) && (c->c_fd != (-1))) {
+    if (c->c_error || idsa_client_reap(c, 0, NULL, NULL)) {
+      c->c_error = 1;
+      result = 1;
+    }
+  }
+
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_mutex_unlock(&(c->c_lock));
+  }
+
+  return result;
+}
+
 /****************************************************************************/
 /* Does       : Deallocate resources associated with connection (close file */
 /*              descriptor and release memory)                              */
 
 int idsa_close(IDSA_CONNECTION * c)
 {
+  struct idsa_slot *slot;
   int result = 0;
 
   if (c != NULL) {
-    /* zap last event */
-    if (c->c_cache != NULL) {
-      idsa_event_free(c->c_cache);
-      c->c_cache = NULL;
+    /* so that idsad has seen everything before we hang up */
+    idsa_flush(c);
+
+    if (c->c_flags & IDSA_F_THREADS) {	/* no other thread may be in here */
+      pthread_key_delete(c->c_key);
+      while (c->c_slots) {
+	slot = c->c_slots;
+	c->c_slots = slot->s_next;
+	if (slot->s_spare) {
+	  idsa_event_free(slot->s_spare);
+	}
+	free(slot);
+      }
+      pthread_cond_destroy(&(c->c_ready));
+      pthread_rwlock_destroy(&(c->c_tlock));
+      pthread_mutex_destroy(&(c->c_lock));
     }
+
+    /* zap spare events */
+    idsa_pool_flush(c);
     if (c->c_template != NULL) {
       idsa_event_free(c->c_template);
       c->c_template = NULL;
@@ -262,6 +473,10 @@ int idsa_close(IDSA_CONNECTION * c)
       c->c_internal = NULL;
     }
     /* zap connection */
+    if (c->c_ring) {
+      munmap(c->c_ring, sizeof(IDSA_RING));
+      c->c_ring = NULL;
+    }
     if (c->c_fd != (-1)) {
       result = close(c->c_fd);
       c->c_fd = (-1);
@@ -277,6 +492,11 @@ int idsa_close(IDSA_CONNECTION * c)
     }
     c->c_filter = IDSA_CHN_SERVER;
 
+    if (c->c_verdicts) {
+      free(c->c_verdicts);
+      c->c_verdicts = NULL;
+    }
+
     free(c);
   }
   return result;
@@ -412,19 +632,35 @@ int idsa_set(IDSA_CONNECTION * c, char *n, char *s, int f, unsigned cr, unsigned
 IDSA_EVENT *idsa_event(IDSA_CONNECTION * c)
 {
   IDSA_EVENT *result;
+  struct idsa_slot *s;
+  int i;
 
-  if (c) {
-    if (c->c_cache == NULL) {
-      result = idsa_event_new(0);
-    } else {
-      result = c->c_cache;
-      c->c_cache = NULL;
+  if (c == NULL) {
+    return NULL;
+  }
+
+  result = NULL;
+
+  if (c->c_flags & IDSA_F_THREADS) {	/* own spare first, nobody else touches it */
+    s = idsa_client_slot(c);
+    if (s && s->s_spare) {
+      result = s->s_spare;
+      s->s_spare = NULL;
     }
-    if (result) {
-      idsa_event_copy(result, c->c_template);
+  }
+
+  for (i = 0; (result == NULL) && (i < IDSA_POOL_SLOTS); i++) {
+    if (c->c_pool[i]) {		/* look before doing the locked operation */
+      result = idsa_pool_take(&(c->c_pool[i]));
     }
-  } else {
-    result = NULL;
+  }
+
+  if (result == NULL) {
+    result = idsa_event_new(0);
+  }
+
+  if (result) {
+    idsa_client_template(c, result);
   }
 
   return result;
@@ -438,14 +674,23 @@ IDSA_EVENT *idsa_event(IDSA_CONNECTION * c)
 void idsa_template(IDSA_CONNECTION * c, IDSA_EVENT * e)
 {
   if (c) {
+    if (c->c_flags & IDSA_F_THREADS) {
+      pthread_rwlock_wrlock(&(c->c_tlock));
+    }
+
     if (e) {
       idsa_event_copy(c->c_template, e);
     } else {
       /* idsa_request */
       idsa_request_init(c->c_template, c->c_service, c->c_service, c->c_service);
     }
+    idsa_client_preset(c);
+
+    if (c->c_flags & IDSA_F_THREADS) {
+      pthread_rwlock_unlock(&(c->c_tlock));
+    }
 
-    if (!(c->c_flags & IDSA_F_KEEP)) {
+    if (e && !(c->c_flags & IDSA_F_KEEP)) {
       idsa_free(c, e);
     }
   }
@@ -456,15 +701,29 @@ void idsa_template(IDSA_CONNECTION * c, IDSA_EVENT * e)
 
 void idsa_free(IDSA_CONNECTION * c, IDSA_EVENT * e)
 {
+  struct idsa_slot *s;
+  int i;
+
+  if (e == NULL) {
+    return;
+  }
+
   if (c) {
-    if (c->c_cache == NULL) {
-      c->c_cache = e;
-    } else {
-      idsa_event_free(e);
+    if (c->c_flags & IDSA_F_THREADS) {
+      s = idsa_client_slot(c);
+      if (s && (s->s_spare == NULL)) {
+	s->s_spare = e;
+	return;
+      }
+    }
+    for (i = 0; i < IDSA_POOL_SLOTS; i++) {
+      if ((c->c_pool[i] == NULL) && idsa_pool_give(&(c->c_pool[i]), e)) {
+	return;
+      }
     }
-  } else {
-    idsa_event_free(e);
   }
+
+  idsa_event_free(e);
 }
 
 /* modify required fields ************************************************** */
@@ -678,6 +937,16 @@ int idsa_error(IDSA_CONNECTION * c)
 
 char *idsa_reason(IDSA_CONNECTION * c)
 {
+  struct idsa_slot *s;
+
+  if (c->c_flags & IDSA_F_THREADS) {	/* of the last idsa_log in this thread */
+    s = idsa_client_slot(c);
+    if ((s == NULL) || (s->s_reason[0] == '\0')) {
+      return NULL;
+    }
+    return s->s_reason;
+  }
+
   if (c->c_reason[0] == '\0') {
     return NULL;
   }
@@ -691,7 +960,9 @@ char *idsa_reason(IDSA_CONNECTION * c)
 
 int idsa_log(IDSA_CONNECTION * c, IDSA_EVENT * e)
 {
-  int result;
+  int result, cached;
+  time_t now;
+  struct idsa_slot *s;
 
   if (c == NULL) {
     /* the user deserves a core dump, but... */
@@ -705,7 +976,18 @@ int idsa_log(IDSA_CONNECTION * c, IDSA_EVENT * e)
     return result;
   }
 
-  idsa_time(e, time(NULL));
+  now = time(NULL);
+  idsa_time(e, now);
+
+  s = NULL;
+  if (c->c_flags & IDSA_F_THREADS) {
+    s = idsa_client_slot(c);
+    if (s == NULL) {
+      idsa_client_reclaim(c, e);
+      return result;
+    }
+    pthread_mutex_lock(&(c->c_lock));
+  }
 
   if (c->c_filter & IDSA_CHN_AUTO) {	/* operate autonomously - don't bother with server */
     idsa_chain_setname(c->c_chain, idsa_chn_auto);
@@ -716,8 +998,19 @@ int idsa_log(IDSA_CONNECTION * c, IDSA_EVENT * e)
       result = idsa_client_rule(c, e);
     }
     if ((!(c->c_filter & IDSA_CHN_PRE)) || (result == IDSA_L_DENY)) {	/* prefilter not active */
-      if (idsa_client_io(c, e, c->c_reply) == 0) {	/* remote side was ok */
-	result = idsa_client_reply(c);
+      cached = idsa_cache_lookup(c, e, now);
+      if (cached >= 0) {	/* asked before, and allowed to remember */
+	result = cached;
+      } else if (idsa_client_io(c, e, c->c_reply) == 0) {	/* remote side was ok */
+	if (c->c_flags & IDSA_F_NOWAIT) {	/* sent, verdict comes later */
+	  result = IDSA_L_ALLOW;
+	} else {
+	  /* with threads the receiving thread has already done the reply */
+	  result = (c->c_flags & IDSA_F_THREADS) ? c->c_result : idsa_client_reply(c);
+	  if (c->c_hint > 0) {
+	    idsa_cache_store(c, e, result, now);
+	  }
+	}
       } else {			/* remote side didn't work */
 	if (c->c_filter & IDSA_CHN_FAIL) {	/* try error handler */
 	  idsa_chain_setname(c->c_chain, idsa_chn_fail);
@@ -727,11 +1020,144 @@ int idsa_log(IDSA_CONNECTION * c, IDSA_EVENT * e)
     }
   }
 
+  if (s) {
+    strcpy(s->s_reason, c->c_reason);
+    pthread_mutex_unlock(&(c->c_lock));
+  }
+
   idsa_client_reclaim(c, e);
 
   return result;
 }
 
+/****************************************************************************/
+/* Does       : logs count events, writing as many requests as fit into     */
+/*              IDSA_M_BATCH with one system call and reading the replies   */
+/*              back in bulk. Deletes the events unless F_KEEP set          */
+/* Parameters : e - array of count events, v - if not NULL receives the     */
+/*              verdict for each event                                      */
+/* Returns    : L_OK if all events were allowed, L_DENY otherwise           */
+/* Notes      : If client side rules are active or IDSA_F_THREADS is set,    */
+/*              events are handed to idsa_log one at a time                 */
+
+int idsa_log_batch(IDSA_CONNECTION * c, IDSA_EVENT ** e, int count, int *v)
+{
+  char buffer[IDSA_M_BATCH];
+  int sent[IDSA_MAX_BATCH], got[IDSA_MAX_BATCH];
+  int i, j, k, l, m, length, failed, result;
+  time_t now;
+
+  if (c == NULL) {
+    return IDSA_L_DENY;
+  }
+
+  failed = (c->c_flags & IDSA_F_FAILOPEN) ? IDSA_L_ALLOW : IDSA_L_DENY;
+  result = IDSA_L_ALLOW;
+  now = time(NULL);
+
+  i = 0;
+  while (i < count) {
+
+    if ((c->c_flags & IDSA_F_THREADS) || (c->c_filter != IDSA_CHN_SERVER)) {	/* rules may have arrived in a reply */
+      l = idsa_log(c, e[i]);
+      if (v) {
+	v[i] = l;
+      }
+      if (l == IDSA_L_DENY) {
+	result = IDSA_L_DENY;
+      }
+      i++;
+      continue;
+    }
+
+    /* encode as many as fit, settling hopeless ones on the spot */
+    length = 0;
+    k = 0;
+    for (j = i; (j < count) && (k < IDSA_MAX_BATCH); j++) {
+      l = 0;
+      if (e[j]) {
+	idsa_time(e[j], now);
+	l = idsa_preset_tobuffer(&(c->c_preset), e[j], buffer + length, IDSA_M_BATCH - length);
+	if ((l <= 0) && (length > 0)) {	/* goes into the next write */
+	  break;
+	}
+      }
+      if (l > 0) {
+	length += l;
+	sent[k++] = j;
+      } else {			/* NULL or will never fit */
+	if (v) {
+	  v[j] = failed;
+	}
+	if (failed == IDSA_L_DENY) {
+	  result = IDSA_L_DENY;
+	}
+	if (e[j]) {
+	  idsa_client_reclaim(c, e[j]);
+	}
+      }
+    }
+
+    if (k > 0) {
+      for (l = 0; l < k; l++) {
+	got[l] = (c->c_flags & IDSA_F_NOWAIT) ? IDSA_L_ALLOW : (-1);
+      }
+      m = k;
+      l = idsa_client_send(c, buffer, length);
+      if (l == IDSA_SEND_WIRE) {	/* again in the format agreed on reconnect */
+	length = 0;
+	for (m = 0; m < k; m++) {
+	  l = idsa_preset_tobuffer(&(c->c_preset), e[sent[m]], buffer + length, IDSA_M_BATCH - length);
+	  if (l <= 0) {		/* grew too much, the rest fails */
+	    break;
+	  }
+	  length += l;
+	}
+	for (l = m; l < k; l++) {
+	  got[l] = (-1);
+	}
+	l = (m > 0) ? idsa_client_send(c, buffer, length) : 1;
+      }
+      if (l) {
+	for (l = 0; l < k; l++) {
+	  got[l] = (-1);
+	}
+      } else {
+	c->c_inflight += m;
+	if (c->c_flags & IDSA_F_NOWAIT) {
+	  l = idsa_client_reap(c, IDSA_MAX_INFLIGHT - 1, NULL, NULL);
+	} else {
+	  l = idsa_client_reap(c, 0, got, NULL);
+	}
+	if (l) {
+	  c->c_error = 1;	/* reconnect next time */
+	}
+      }
+    }
+
+    for (l = 0; l < k; l++) {
+      if (got[l] < 0) {		/* remote side didn't work, as in idsa_log */
+	got[l] = failed;
+	if (c->c_filter & IDSA_CHN_FAIL) {
+	  idsa_chain_setname(c->c_chain, idsa_chn_fail);
+	  got[l] = idsa_client_rule(c, e[sent[l]]);
+	}
+      }
+      if (v) {
+	v[sent[l]] = got[l];
+      }
+      if (got[l] == IDSA_L_DENY) {
+	result = IDSA_L_DENY;
+      }
+      idsa_client_reclaim(c, e[sent[l]]);
+    }
+
+    i = j;
+  }
+
+  return result;
+}
+
 /****************************************************************************/
 /* internal functions ****************************************************** */
 
@@ -742,6 +1168,135 @@ static void idsa_client_reclaim(IDSA_CONNECTION * c, IDSA_EVENT * e)
   }
 }
 
+/****************************************************************************/
+/* Does       : Copies the template into e, safe against idsa_template      */
+
+static void idsa_client_template(IDSA_CONNECTION * c, IDSA_EVENT * e)
+{
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_rwlock_rdlock(&(c->c_tlock));
+    idsa_event_copy(e, c->c_template);
+    pthread_rwlock_unlock(&(c->c_tlock));
+  } else {
+    idsa_event_copy(e, c->c_template);
+  }
+}
+
+/****************************************************************************/
+/* Does       : Encodes c_template once, so that its copies only need to    */
+/*              have the units encoded which have been set since            */
+/* Notes      : caller holds c_tlock for writing, if needed                 */
+
+static void idsa_client_preset(IDSA_CONNECTION * c)
+{
+  unsigned int origin;
+
+  do {
+    origin = idsa_origin_next();
+  } while (origin == 0);	/* zero means none */
+
+  idsa_preset_init(&(c->c_preset), c->c_template, origin, c->c_wire);
+}
+
+/****************************************************************************/
+/* Does       : Writes e into s, safe against idsa_template                 */
+/* Returns    : amount written, negative if it does not fit                 */
+
+static int idsa_client_encode(IDSA_CONNECTION * c, IDSA_EVENT * e, char *s, int l)
+{
+  int result;
+
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_rwlock_rdlock(&(c->c_tlock));
+    result = idsa_preset_tobuffer(&(c->c_preset), e, s, l);
+    pthread_rwlock_unlock(&(c->c_tlock));
+  } else {
+    result = idsa_preset_tobuffer(&(c->c_preset), e, s, l);
+  }
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : Releases the spare events                                   */
+
+static void idsa_pool_flush(IDSA_CONNECTION * c)
+{
+  IDSA_EVENT *e;
+  int i;
+
+  for (i = 0; i < IDSA_POOL_SLOTS; i++) {
+    e = idsa_pool_take(&(c->c_pool[i]));
+    if (e) {
+      idsa_event_free(e);
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : Finds the state of the calling thread, creating it the      */
+/*              first time round                                            */
+/* Returns    : pointer to slot, NULL on allocation failure                 */
+/* Notes      : Only for IDSA_F_THREADS. Slots are released when their      */
+/*              thread exits or the connection is closed                    */
+
+static struct idsa_slot *idsa_client_slot(IDSA_CONNECTION * c)
+{
+  struct idsa_slot *s;
+
+  s = pthread_getspecific(c->c_key);
+  if (s) {
+    return s;
+  }
+
+  s = malloc(sizeof(struct idsa_slot));
+  if (s == NULL) {
+    return NULL;
+  }
+
+  s->s_connection = c;
+  s->s_spare = NULL;
+  s->s_done = 0;
+  s->s_result = 0;
+  s->s_hint = 0;
+  s->s_reason[0] = '\0';
+
+  if (pthread_setspecific(c->c_key, s)) {
+    free(s);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&(c->c_lock));
+  s->s_next = c->c_slots;
+  c->c_slots = s;
+  pthread_mutex_unlock(&(c->c_lock));
+
+  return s;
+}
+
+static void idsa_slot_release(void *p)
+{
+  struct idsa_slot *s, **ptr;
+  IDSA_CONNECTION *c;
+
+  s = p;
+  c = s->s_connection;
+
+  pthread_mutex_lock(&(c->c_lock));
+  for (ptr = &(c->c_slots); *ptr != NULL; ptr = &((*ptr)->s_next)) {
+    if (*ptr == s) {
+      *ptr = s->s_next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&(c->c_lock));
+
+  if (s->s_spare) {
+    idsa_event_free(s->s_spare);
+  }
+  free(s);
+}
+
 /****************************************************************************/
 /* Does       : processes units sent in reply                               */
 
@@ -749,12 +1304,16 @@ static int idsa_client_reply(IDSA_CONNECTION * c)
 {
   int result;
   unsigned int i, name, type, delay;
-  int m;
+  int m, hint, generation;
+  char key[IDSA_M_STRING];
   IDSA_EVENT *e;
   IDSA_UNIT *u;
 
   c->c_reason[0] = '\0';
 
+  hint = 0;
+  strcpy(key, IDSA_CACHE_DEFAULT);
+
   e = c->c_reply;
 
   /* first do required fields */
@@ -825,6 +1384,21 @@ static int idsa_client_reply(IDSA_CONNECTION * c)
 	  }
 	  break;
 
+	case IDSA_O_CACHE:
+	  idsa_unit_get(u, &hint, sizeof(int));
+	  break;
+	case IDSA_O_CACHEKEY:
+	  m = idsa_unit_print(u, key, IDSA_M_STRING - 1, 0);
+	  key[(m < 0) ? 0 : m] = '\0';
+	  break;
+	case IDSA_O_GENERATION:
+	  idsa_unit_get(u, &generation, sizeof(int));
+	  if (generation != c->c_generation) {	/* rules have changed */
+	    idsa_cache_flush(c);
+	    c->c_generation = generation;
+	  }
+	  break;
+
 	default:		/* ignore unknown fields */
 	  break;
 	}
@@ -832,6 +1406,15 @@ static int idsa_client_reply(IDSA_CONNECTION * c)
     }
   }
 
+  c->c_hint = 0;
+  if (hint > 0) {
+    if (strcmp(key, c->c_cachekey)) {	/* old entries were keyed differently */
+      idsa_cache_flush(c);
+      strcpy(c->c_cachekey, key);
+    }
+    c->c_hint = hint;
+  }
+
 #if 0
   idsa_client_handle_error(c);
 #endif
@@ -839,40 +1422,186 @@ static int idsa_client_reply(IDSA_CONNECTION * c)
   return result;
 }
 
+/* verdict cache ************************************************************/
+
 /****************************************************************************/
+/* Does       : Writes the values of the c_cachekey fields of e into key    */
+/* Returns    : length of key, -1 if it does not fit                        */
 
-static int idsa_putenv(IDSA_UNIT * u)
+static int idsa_cache_key(IDSA_CONNECTION * c, IDSA_EVENT * e, char *key, unsigned int *hash)
 {
-  char buffer[IDSA_M_MESSAGE];
-  char *value;
-  int len, result;
+  char name[IDSA_M_NAME];
+  char *ptr;
+  int i, l, length;
+  unsigned int h;
+  IDSA_UNIT *u;
 
-  /* get hold of string representation */
-  len = idsa_unit_print(u, buffer, IDSA_M_MESSAGE - 1, 0);
-  result = (-1);
+  length = 0;
+  ptr = c->c_cachekey;
 
-  len = idsa_unit_print(u, buffer, IDSA_M_MESSAGE - 1, 0);
-  if (len > 0) {
-    buffer[len] = '\0';
-    value = strchr(buffer, '=');
-    if (value) {
-      *value = '\0';
-      value++;
-      result = setenv(buffer, value, 1);
+  while (*ptr != '\0') {
+    for (; isspace(*ptr); ptr++);
+    for (i = 0; (*ptr != '\0') && !isspace(*ptr); ptr++) {
+      if (i < IDSA_M_NAME - 1) {
+	name[i++] = *ptr;
+      }
+    }
+    if (i == 0) {
+      break;
+    }
+    name[i] = '\0';
+
+    u = idsa_event_unitbyname(e, name);
+    if (u) {
+      l = idsa_unit_print(u, key + length, IDSA_M_LONG - (length + 1), 0);
+      if (l < 0) {
+	return -1;
+      }
+      length += l;
+    }
+    if (length >= IDSA_M_LONG - 1) {
+      return -1;
     }
+    key[length++] = '\0';	/* printed values never contain one */
   }
 
-  return result;
+  /* FNV-1a */
+  h = 2166136261U;
+  for (i = 0; i < length; i++) {
+    h = (h ^ (unsigned char) key[i]) * 16777619U;
+  }
+  *hash = h;
+
+  return length;
 }
 
 /****************************************************************************/
-/* Does       : Gets environment variable if ok to do so                    */
+/* Does       : Looks for a cached verdict matching e, setting c_reason     */
+/* Returns    : the verdict, -1 if there is none                            */
 
-static char *idsa_getenv(IDSA_CONNECTION * c, char *label)
+static int idsa_cache_lookup(IDSA_CONNECTION * c, IDSA_EVENT * e, time_t now)
 {
-  if (label) {
-    if (c->c_flags & IDSA_F_ENV) {
-      /* I wonder if this is wise - setuid should never use this option */
+  char key[IDSA_M_LONG];
+  struct idsa_verdict *v;
+  unsigned int hash;
+  int length, i;
+
+  if (c->c_verdicts == NULL) {	/* idsad never said we could */
+    return -1;
+  }
+
+  if (c->c_ring && (c->c_ring->r_generation != c->c_generation)) {	/* rules reread since */
+    idsa_cache_flush(c);
+    c->c_generation = c->c_ring->r_generation;
+    return -1;
+  }
+
+  length = idsa_cache_key(c, e, key, &hash);
+  if (length < 0) {
+    return -1;
+  }
+
+  v = &(c->c_verdicts[(hash % (IDSA_CACHE_SLOTS / IDSA_CACHE_WAYS)) * IDSA_CACHE_WAYS]);
+  for (i = 0; i < IDSA_CACHE_WAYS; i++, v++) {
+    if ((v->v_until > now) && (v->v_hash == hash) && (v->v_length == length) && !memcmp(v->v_key, key, length)) {
+      strcpy(c->c_reason, v->v_reason);
+      return v->v_result;
+    }
+  }
+
+  return -1;
+}
+
+/****************************************************************************/
+/* Does       : Remembers the verdict for e for as long as c_hint allows    */
+/* Notes      : Displaces whichever of the slots for e expires first        */
+
+static void idsa_cache_store(IDSA_CONNECTION * c, IDSA_EVENT * e, int result, time_t now)
+{
+  char key[IDSA_M_LONG];
+  struct idsa_verdict *v, *w;
+  unsigned int hash;
+  int length, i;
+
+  if (c->c_verdicts == NULL) {
+    c->c_verdicts = malloc(sizeof(struct idsa_verdict) * IDSA_CACHE_SLOTS);
+    if (c->c_verdicts == NULL) {
+      return;
+    }
+    for (i = 0; i < IDSA_CACHE_SLOTS; i++) {
+      c->c_verdicts[i].v_until = 0;
+    }
+  }
+
+  length = idsa_cache_key(c, e, key, &hash);
+  if (length < 0) {
+    return;
+  }
+
+  w = &(c->c_verdicts[(hash % (IDSA_CACHE_SLOTS / IDSA_CACHE_WAYS)) * IDSA_CACHE_WAYS]);
+  v = w;
+  for (i = 1; i < IDSA_CACHE_WAYS; i++) {
+    if (w[i].v_until < v->v_until) {
+      v = &(w[i]);
+    }
+  }
+
+  v->v_until = now + c->c_hint;
+  v->v_hash = hash;
+  v->v_length = length;
+  v->v_result = result;
+  strcpy(v->v_reason, c->c_reason);
+  memcpy(v->v_key, key, length);
+}
+
+/****************************************************************************/
+/* Does       : Forgets all cached verdicts                                 */
+
+static void idsa_cache_flush(IDSA_CONNECTION * c)
+{
+  int i;
+
+  if (c->c_verdicts) {
+    for (i = 0; i < IDSA_CACHE_SLOTS; i++) {
+      c->c_verdicts[i].v_until = 0;
+    }
+  }
+}
+
+/****************************************************************************/
+
+static int idsa_putenv(IDSA_UNIT * u)
+{
+  char buffer[IDSA_M_MESSAGE];
+  char *value;
+  int len, result;
+
+  /* get hold of string representation */
+  len = idsa_unit_print(u, buffer, IDSA_M_MESSAGE - 1, 0);
+  result = (-1);
+
+  len = idsa_unit_print(u, buffer, IDSA_M_MESSAGE - 1, 0);
+  if (len > 0) {
+    buffer[len] = '\0';
+    value = strchr(buffer, '=');
+    if (value) {
+      *value = '\0';
+      value++;
+      result = setenv(buffer, value, 1);
+    }
+  }
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : Gets environment variable if ok to do so                    */
+
+static char *idsa_getenv(IDSA_CONNECTION * c, char *label)
+{
+  if (label) {
+    if (c->c_flags & IDSA_F_ENV) {
+      /* I wonder if this is wise - setuid should never use this option */
       /* so maybe nanny test if effective uid != real uid ? */
       return getenv(label);
     } else {
@@ -906,7 +1635,7 @@ static int idsa_client_standalone(IDSA_CONNECTION * c)
 
   if (c->c_fresh == 0) {	/* no previous errors */
     failure = c->c_internal;
-    idsa_event_copy(failure, c->c_template);
+    idsa_client_template(c, failure);
   } else {			/* otherwise don't clobber earliest error */
     failure = NULL;
   }
@@ -967,7 +1696,7 @@ static int idsa_client_install(IDSA_CONNECTION * c, IDSA_UNIT * u, int number, i
 
       if (c->c_fresh == 0) {	/* no previous errors */
 	failure = c->c_internal;
-	idsa_event_copy(failure, c->c_template);
+	idsa_client_template(c, failure);
       } else {			/* otherwise don't clobber earliest error */
 	failure = NULL;
       }
@@ -1027,53 +1756,177 @@ static int idsa_client_rule(IDSA_CONNECTION * c, IDSA_EVENT * e)
 /* client server io *********************************************************/
 
 /****************************************************************************/
-/* Does       : Talks to the other side, with linear backoff strategy       */
-
-static int idsa_client_io(IDSA_CONNECTION * c, IDSA_EVENT * q, IDSA_EVENT * p)
+/* Does       : Sends encoded requests, reconnecting if needed              */
+/* Returns    : zero if they went out, IDSA_SEND_WIRE if the idsad found on */
+/*              reconnect agreed to another wire format than they are in,   */
+/*              other nonzero values if they could not be sent              */
+/* Notes      : Never waits for a connection to come up. After the first    */
+/*              failure a reconnect is tried at once, later ones only after */
+/*              a backoff, see idsa_client_backoff                          */
+
+static int idsa_client_send(IDSA_CONNECTION * c, char *buffer, int length)
 {
-  if (c->c_error % (c->c_backoff)) {	/* linear backoff */
+  if (c->c_error == 0) {	/* no previous errors, attempt a normal write */
+    if (idsa_client_write(c, buffer, length) >= 0) {
+      return 0;
+    }
 #ifdef DEBUG
-    fprintf(stderr, "idsa_client_io(): backoff active, %d/%d\n", c->c_error, c->c_backoff);
+    fprintf(stderr, "idsa_client_send(): write request failed\n");
 #endif
-    c->c_error = c->c_error + 1;
+    c->c_error = 1;
+    c->c_retry = idsa_client_now();	/* idsad may merely have restarted */
+  }
+
+  /* FIXME: possibly report errors here using c_internal/c_fresh */
+
+  if (idsa_client_retry(c)) {	/* not connected (yet) */
+    c->c_error = 1;
     return 1;
   }
 
-  if (c->c_error == 0) {	/* no previous errors, attempt a normal write */
-    if (idsa_client_write(c, q) < 0) {
-      c->c_error = 1;
+  if (((buffer[0] == IDSA_PACK_REQUEST) ? IDSA_WIRE_PACKED : IDSA_WIRE_TEXT) != c->c_wire) {
+    c->c_backoff = 0;		/* encoded for the idsad which went away */
+    c->c_error = 0;
+    return IDSA_SEND_WIRE;
+  }
+
+  if (idsa_client_write(c, buffer, length) < 0) {	/* failed to write, again */
+    c->c_error = 1;
+    idsa_client_backoff(c);
+    return 1;
+  }
 #ifdef DEBUG
-      fprintf(stderr, "idsa_io(): write request failed\n");
+  fprintf(stderr, "idsa_client_send(): reconnect succeeded\n");
 #endif
-    }
+  c->c_backoff = 0;
+  c->c_error = 0;
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : Gets the connection to idsad back without blocking: checks  */
+/*              if a connect or hello started earlier has completed, else   */
+/*              starts one once the backoff has passed                      */
+/* Returns    : zero if connected, nonzero otherwise                        */
+
+static int idsa_client_retry(IDSA_CONNECTION * c)
+{
+  struct pollfd pfd;
+  socklen_t len;
+  int result, error;
+
+  if (c->c_reader) {		/* another thread still receives on it */
+    shutdown(c->c_fd, SHUT_RDWR);	/* make it give up, reconnect later */
+    return 1;
   }
 
-  /* FIXME: possibly report errors here using c_internal/c_fresh */
+  if (c->c_pending == IDSA_PENDING_HELLO) {
+    result = idsa_client_answer(c, 0);
+  } else if (c->c_pending) {
+    pfd.fd = c->c_fd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, 0) == 0) {	/* still connecting */
+      return 1;
+    }
+    c->c_pending = 0;
 
-  if (c->c_error > 0) {		/* one retry after the first failure */
-    if (c->c_fd != (-1)) {	/* close broken connection */
+    len = sizeof(int);
+    if (getsockopt(c->c_fd, SOL_SOCKET, SO_ERROR, &error, &len) || error) {
       close(c->c_fd);
       c->c_fd = (-1);
+      result = (-1);
+    } else {
+      result = idsa_client_ready(c, 0);
     }
-    if (idsa_client_connect(c)) {	/* failed to connect */
-      if (!((c->c_flags & IDSA_F_NOBACKOFF) || (c->c_backoff >= IDSA_MAX_BACKOFF))) {
-	c->c_backoff = c->c_backoff + 1;
-      }
+  } else if (!(c->c_flags & IDSA_F_NOBACKOFF) && ((long) (c->c_retry - idsa_client_now()) > 0)) {
+    return 1;
+  } else {
+    result = idsa_client_connect(c, 0);
+  }
+
+  if (result < 0) {
+    idsa_client_backoff(c);
+  }
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : Schedules the next reconnect. The interval doubles with     */
+/*              each failure up to IDSA_MAX_BACKOFF, and the actual wait is */
+/*              picked at random from its upper half, so that the clients   */
+/*              of a restarted idsad do not all come back at once           */
+
+static void idsa_client_backoff(IDSA_CONNECTION * c)
+{
+  if (c->c_flags & IDSA_F_NOBACKOFF) {
+    return;
+  }
+
+  if (c->c_backoff < IDSA_MIN_BACKOFF) {
+    c->c_backoff = IDSA_MIN_BACKOFF;
+  } else if (c->c_backoff < IDSA_MAX_BACKOFF) {
+    c->c_backoff = (2 * c->c_backoff < IDSA_MAX_BACKOFF) ? 2 * c->c_backoff : IDSA_MAX_BACKOFF;
+  }
+
+  c->c_seed = c->c_seed * 1103515245 + 12345;
+  c->c_retry = idsa_client_now() + c->c_backoff / 2 + (c->c_seed >> 16) % (c->c_backoff / 2 + 1);
+}
+
+/****************************************************************************/
+/* Does       : Talks to the other side                                     */
+
+static int idsa_client_io(IDSA_CONNECTION * c, IDSA_EVENT * q, IDSA_EVENT * p)
+{
+  char buffer[IDSA_M_MESSAGE];
+  int length;
+  struct idsa_slot *s;
+
+  length = idsa_client_encode(c, q, buffer, IDSA_M_MESSAGE);
+  if (length <= 0) {
+    return 1;
+  }
+
+  if ((c->c_flags & IDSA_F_THREADS) && (c->c_inflight >= IDSA_MAX_INFLIGHT)) {
+    if (idsa_client_reap(c, IDSA_MAX_INFLIGHT - 1, NULL, NULL)) {	/* make room in c_waiting */
       c->c_error = 1;
-      return 1;
     }
-    if (idsa_client_write(c, q) < 0) {	/* failed to write, again */
-      if (!((c->c_flags & IDSA_F_NOBACKOFF) || (c->c_backoff >= IDSA_MAX_BACKOFF))) {
-	c->c_backoff = c->c_backoff + 1;
-      }
+  }
+
+  length = idsa_client_send(c, buffer, length);
+  if (length == IDSA_SEND_WIRE) {	/* connected again, so the preset is new too */
+    length = idsa_client_encode(c, q, buffer, IDSA_M_MESSAGE);
+    length = (length > 0) ? idsa_client_send(c, buffer, length) : 1;
+  }
+  if (length) {
+    return 1;
+  }
+
+  if (c->c_flags & IDSA_F_NOWAIT) {	/* only collect what has arrived */
+    c->c_inflight++;
+    if (idsa_client_reap(c, IDSA_MAX_INFLIGHT - 1, NULL, NULL)) {
+      c->c_error = 1;		/* request went out, reconnect next time */
+    }
+    return 0;
+  }
+
+  if (c->c_flags & IDSA_F_THREADS) {	/* replies come in order, wait for ours */
+    s = pthread_getspecific(c->c_key);
+    s->s_done = 0;
+    c->c_waiting[(c->c_head + c->c_inflight) % IDSA_MAX_INFLIGHT] = s;
+    c->c_inflight++;
+
+    if (idsa_client_reap(c, 0, NULL, s) || (s->s_result < 0)) {
       c->c_error = 1;
       return 1;
     }
-#ifdef DEBUG
-    fprintf(stderr, "idsa_client_io(): reconnect succeeded\n");
-#endif
-    c->c_backoff = 1;
-    c->c_error = 0;
+
+    c->c_result = s->s_result;
+    c->c_hint = s->s_hint;
+    strcpy(c->c_reason, s->s_reason);
+
+    return 0;
   }
 
   /* write ok, now try to get reply */
@@ -1097,29 +1950,18 @@ static int idsa_client_io(IDSA_CONNECTION * c, IDSA_EVENT * q, IDSA_EVENT * p)
 }
 
 /****************************************************************************/
-/* Does       : Send something to the other side, hoping that tobuffer does */
-/*              a decent conversion                                         */
+/* Does       : Send something to the other side                            */
 
-static int idsa_client_write(IDSA_CONNECTION * c, IDSA_EVENT * e)
+static int idsa_client_write(IDSA_CONNECTION * c, char *buffer, int should_write)
 {
-  char buffer[IDSA_M_MESSAGE];
-  int should_write, have_written, write_result;
-  struct sigaction nag, sag;
-  unsigned int salr;
+  int have_written, write_result;
+  time_t deadline;
 
-  should_write = idsa_event_tobuffer(e, buffer, IDSA_M_MESSAGE);
-  if (should_write <= 0) {
-    return -1;
+  if (c->c_ring) {
+    return idsa_client_give(c, buffer, should_write);
   }
 
-  salr = 0;
-  if (c->c_flags & IDSA_F_TIMEOUT) {
-    salr = alarm(c->c_timeout);
-    nag.sa_handler = idsa_alarm_handle;
-    sigfillset(&(nag.sa_mask));
-    nag.sa_flags = 0;
-    sigaction(SIGALRM, &nag, &sag);
-  }
+  deadline = idsa_client_deadline(c);
 
   have_written = 0;
   do {
@@ -1130,12 +1972,14 @@ static int idsa_client_write(IDSA_CONNECTION * c, IDSA_EVENT * e)
 #endif
     if (write_result < 0) {
       switch (errno) {
-      case EAGAIN:
-      case EINTR:
-	if (idsa_alarm_set == 0) {
+      case EAGAIN:		/* only if nonblocking, see idsa_client_connect */
+	if (idsa_client_wait(c, POLLOUT, deadline) == 0) {
 	  write_result = 0;
 	}
 	break;
+      case EINTR:
+	write_result = 0;
+	break;
       default:
 	break;
       }
@@ -1144,91 +1988,373 @@ static int idsa_client_write(IDSA_CONNECTION * c, IDSA_EVENT * e)
     }
   } while ((write_result >= 0) && (have_written < should_write));
 
-  if (c->c_flags & IDSA_F_TIMEOUT) {
-    alarm(salr);
-    sigaction(SIGALRM, &sag, NULL);
-    idsa_alarm_set = 0;
-  }
-
   if (have_written < should_write) {
     return -1;
   }
   return should_write;
 }
 
+/****************************************************************************/
+/* Does       : Waits for the reply to a single request and decodes it      */
+/* Returns    : its length on success, -1 otherwise                         */
+
 static int idsa_client_read(IDSA_CONNECTION * c, IDSA_EVENT * e)
 {
-  char buffer[IDSA_M_MESSAGE];
-  int read_result, have_read, have_copied, result;
-  struct sigaction nag, sag;
-  int salr;
+  char *reply;
+  int read_result, room, length;
+  time_t deadline;
 
-  salr = 0;
-  if (c->c_flags & IDSA_F_TIMEOUT) {
-    salr = alarm(c->c_timeout);
-    nag.sa_handler = idsa_alarm_handle;
-    sigfillset(&(nag.sa_mask));
-    nag.sa_flags = 0;
-    sigaction(SIGALRM, &nag, &sag);
-  }
+  deadline = idsa_client_deadline(c);
 
-  have_read = 0;
-  have_copied = (-1);
+  while ((reply = idsa_client_frame(c, &length)) == NULL) {
+    room = idsa_client_room(c);
+    if (room <= 0) {		/* too long to be a reply */
+      return -1;
+    }
 
-  do {
+    if (c->c_ring) {
+      read_result = idsa_client_take(c, c->c_rbuf + c->c_rlen, room, deadline, 1);
+      if (read_result <= 0) {
+	return -1;
+      }
+    } else {
+      /* wait first, the reply is unlikely to be there yet */
+      if ((c->c_flags & IDSA_F_TIMEOUT) && idsa_client_wait(c, POLLIN, deadline)) {
+	return -1;
+      }
 #ifdef MSG_NOSIGNAL
-    read_result = recv(c->c_fd, buffer + have_read, IDSA_M_MESSAGE - have_read, MSG_NOSIGNAL);
+      read_result = recv(c->c_fd, c->c_rbuf + c->c_rlen, room, MSG_NOSIGNAL);
 #else
-    read_result = read(c->c_fd, buffer + have_read, IDSA_M_MESSAGE - have_read);
+      read_result = read(c->c_fd, c->c_rbuf + c->c_rlen, room);
 #endif
-    if (read_result < 0) {
-      switch (errno) {
-      case EAGAIN:
-      case EINTR:
-	if (idsa_alarm_set) {
-	  have_read = IDSA_M_MESSAGE;
+      if (read_result < 0) {
+	if ((errno == EAGAIN) || (errno == EINTR)) {
+	  continue;
 	}
+	return -1;
+      }
+      if (read_result == 0) {	/* idsad went away */
+	return -1;
+      }
+    }
+
+    c->c_rlen += read_result;
+  }
+
+  if (idsa_event_frombuffer(e, reply, length) != length) {
+    return -1;
+  }
+
+  return length;
+}
+
+/****************************************************************************/
+/* Does       : Takes the next complete reply out of c_rbuf. Bytes already  */
+/*              searched for its end are not looked at again, and anything  */
+/*              received after it stays for the next call                   */
+/* Returns    : start of the reply, with its length in length, NULL if it   */
+/*              has not been received in full                               */
+/* Notes      : Text replies end with a newline, escaping removes any       */
+/*              others. Packed ones start with their length                 */
+
+static char *idsa_client_frame(IDSA_CONNECTION * c, int *length)
+{
+  char *start, *end;
+  int l;
+
+  start = c->c_rbuf + c->c_roff;
+
+  if ((c->c_roff < c->c_rlen) && (*start == IDSA_PACK_REPLY)) {
+    l = idsa_wire_frame(start, c->c_rlen - c->c_roff);
+    if (l <= 0) {		/* never complete is caught by idsa_client_room */
+      return NULL;
+    }
+    *length = l;
+  } else {
+    end = memchr(c->c_rbuf + c->c_rscan, '\n', c->c_rlen - c->c_rscan);
+    if (end == NULL) {
+      c->c_rscan = c->c_rlen;
+      return NULL;
+    }
+    *length = end + 1 - start;
+  }
+
+  c->c_roff += *length;
+  c->c_rscan = c->c_roff;
+
+  return start;
+}
+
+/****************************************************************************/
+/* Does       : Moves what is left of c_rbuf to its start                   */
+/* Returns    : bytes which can be received after c_rlen                    */
+
+static int idsa_client_room(IDSA_CONNECTION * c)
+{
+  if (c->c_roff > 0) {
+    c->c_rlen -= c->c_roff;
+    c->c_rscan -= c->c_roff;
+    memmove(c->c_rbuf, c->c_rbuf + c->c_roff, c->c_rlen);
+    c->c_roff = 0;
+  }
+
+  return IDSA_M_MESSAGE - c->c_rlen;
+}
+
+/****************************************************************************/
+/* Does       : Collects replies to pipelined requests, processing each as  */
+/*              idsa_log would have. Blocks only while more than keep are   */
+/*              outstanding, or until the reply for until has arrived. If   */
+/*              verdicts is not NULL, the result of each reply is stored    */
+/*              there in turn                                               */
+/* Returns    : zero on success, -1 if the connection is broken             */
+/* Notes      : The bound on outstanding requests keeps the replies within  */
+/*              the socket buffer, so that idsad never blocks writing them  */
+/*              while we block writing requests. With IDSA_F_THREADS it is  */
+/*              called with c_lock held, which is dropped while receiving,  */
+/*              and replies are handed to the threads waiting for them      */
+
+static int idsa_client_reap(IDSA_CONNECTION * c, int keep, int *verdicts, struct idsa_slot *until)
+{
+  int used, room, read_result, block, result, verdict, done;
+  struct idsa_slot *s;
+  char *reply;
+  time_t deadline;
+
+  result = 0;
+  done = 0;
+  deadline = 0;
+
+  while ((result == 0) && (c->c_inflight > 0) && !(until && until->s_done)) {
+    block = until || (c->c_inflight > keep);
+
+    if (c->c_reader) {		/* another thread owns c_rbuf, it will deliver */
+      if (!block) {
 	break;
-      default:
-	have_read = IDSA_M_MESSAGE;
-	break;
       }
-    } else if (read_result == 0) {
-      have_read = IDSA_M_MESSAGE;
+      pthread_cond_wait(&(c->c_ready), &(c->c_lock));
+      continue;
+    }
+
+    reply = idsa_client_frame(c, &used);
+    if (reply) {		/* a complete reply */
+      c->c_inflight--;
+
+      s = c->c_waiting[c->c_head];
+      c->c_waiting[c->c_head] = NULL;
+      c->c_head = (c->c_head + 1) % IDSA_MAX_INFLIGHT;
+
+      if ((idsa_event_frombuffer(c->c_reply, reply, used) != used) || idsa_reply_check(c->c_reply)) {
+	verdict = (-1);
+	result = (-1);
+      } else {
+	verdict = idsa_client_reply(c);
+	if (verdicts) {
+	  verdicts[done++] = verdict;
+	}
+      }
+
+      if (s) {			/* some thread is waiting for this one */
+	s->s_result = verdict;
+	s->s_hint = c->c_hint;
+	strcpy(s->s_reason, c->c_reason);
+	s->s_done = 1;
+	pthread_cond_broadcast(&(c->c_ready));
+      }
+
+      if ((result == 0) && (c->c_fd == (-1))) {	/* told to go autonomous, rest is moot */
+	idsa_client_abandon(c);
+      }
+      continue;
+    }
+
+    room = idsa_client_room(c);
+    if (room <= 0) {		/* full, yet nothing recognisable */
+      result = (-1);
+      continue;
+    }
+
+    if (block) {
+      if ((c->c_flags & IDSA_F_TIMEOUT) && (deadline == 0)) {	/* one limit for all replies waited for */
+	deadline = idsa_client_deadline(c);
+      }
+
+      if (c->c_flags & IDSA_F_THREADS) {	/* others may send meanwhile */
+	c->c_reader = 1;
+	pthread_mutex_unlock(&(c->c_lock));
+      }
+
+      if (c->c_ring) {
+	read_result = idsa_client_take(c, c->c_rbuf + c->c_rlen, room, deadline, 1);
+      } else if (deadline && idsa_client_wait(c, POLLIN, deadline)) {
+	read_result = (-1);
+      } else {
+	read_result = recv(c->c_fd, c->c_rbuf + c->c_rlen, room, 0);
+	if ((read_result < 0) && ((errno == EINTR) || (errno == EAGAIN))) {
+	  read_result = 0;	/* try again */
+	} else if (read_result == 0) {
+	  read_result = (-1);	/* idsad went away */
+	}
+      }
+
+      if (c->c_flags & IDSA_F_THREADS) {
+	pthread_mutex_lock(&(c->c_lock));
+	c->c_reader = 0;
+	pthread_cond_broadcast(&(c->c_ready));
+      }
+    } else if (c->c_ring) {
+      read_result = idsa_client_take(c, c->c_rbuf + c->c_rlen, room, 0, 0);
+      if (read_result <= 0) {
+	if (read_result < 0) {
+	  result = (-1);
+	}
+	break;			/* nothing more just now */
+      }
+    } else {
+#ifdef MSG_DONTWAIT
+      read_result = recv(c->c_fd, c->c_rbuf + c->c_rlen, room, MSG_DONTWAIT);
+      if (read_result < 0) {
+	if ((errno != EAGAIN) && (errno != EINTR)) {
+	  result = (-1);
+	}
+	break;			/* nothing more just now */
+      } else if (read_result == 0) {
+	read_result = (-1);
+      }
+#else
+      break;			/* no way of looking without blocking */
+#endif
+    }
+
+    if (read_result < 0) {
+      result = (-1);
     } else {
-      have_read += read_result;
-      have_copied = idsa_event_frombuffer(e, buffer, have_read);
+      c->c_rlen += read_result;
     }
+  }
+
+  if (result && (c->c_flags & IDSA_F_THREADS)) {	/* nobody may wait forever */
+    idsa_client_abandon(c);
+  }
 
-  } while ((have_read < IDSA_M_MESSAGE) && (have_copied < 0));
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : Gives up on all outstanding replies, failing the threads    */
+/*              waiting for them                                            */
 
+static void idsa_client_abandon(IDSA_CONNECTION * c)
+{
+  struct idsa_slot *s;
+  int i;
+
+  for (i = 0; i < IDSA_MAX_INFLIGHT; i++) {
+    s = c->c_waiting[i];
+    if (s) {
+      s->s_result = (-1);
+      s->s_done = 1;
+      c->c_waiting[i] = NULL;
+    }
+  }
+
+  c->c_inflight = 0;
+  c->c_head = 0;
+  c->c_roff = 0;
+  c->c_rscan = 0;
+  c->c_rlen = 0;
+
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_cond_broadcast(&(c->c_ready));
+  }
+}
+
+/****************************************************************************/
+/* Does       : Works out until when a call may take with IDSA_F_TIMEOUT    */
+/* Returns    : deadline on the idsa_monotonic clock, zero if there is none */
+
+static time_t idsa_client_deadline(IDSA_CONNECTION * c)
+{
   if (c->c_flags & IDSA_F_TIMEOUT) {
-    alarm(salr);
-    sigaction(SIGALRM, &sag, NULL);
-    idsa_alarm_set = 0;
+    return idsa_monotonic() + c->c_timeout;
   }
+  return 0;
+}
 
-  if (have_copied == have_read) {
-    result = have_copied;
-  } else {
-    result = (-1);
+/****************************************************************************/
+/* Returns    : milliseconds on the idsa_monotonic clock, wraps around      */
+
+static unsigned long idsa_client_now()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
   }
+#endif
 
-  return result;
+  return idsa_monotonic() * 1000UL;
 }
 
-static int idsa_client_connect(IDSA_CONNECTION * c)
+/****************************************************************************/
+/* Does       : Waits for the connection to become ready for events         */
+/* Returns    : zero if ready, nonzero if deadline passed or poll failed    */
+/* Notes      : Replaces alarm(), so that the application keeps SIGALRM     */
+/*              and threads are no problem. Only the slow path gets here    */
+
+static int idsa_client_wait(IDSA_CONNECTION * c, int events, time_t deadline)
+{
+  struct pollfd pfd;
+  time_t now;
+  int result, ms;
+
+  pfd.fd = c->c_fd;
+  pfd.events = events;
+
+  do {
+    ms = (-1);
+    if (deadline) {
+      now = idsa_monotonic();
+      if (now >= deadline) {
+	return 1;
+      }
+      ms = (deadline - now) * 1000;
+    }
+    result = poll(&pfd, 1, ms);
+  } while ((result < 0) && (errno == EINTR));
+
+  return (result > 0) ? 0 : 1;
+}
+
+/****************************************************************************/
+/* Does       : (Re)connects to idsad. Unless block is set, does not wait   */
+/*              for connect to complete, idsa_client_retry checks on it     */
+/* Returns    : zero if connected, 1 if still connecting, -1 on failure     */
+
+static int idsa_client_connect(IDSA_CONNECTION * c, int block)
 {
   struct sockaddr_un addr;
   char *f;
-  struct sigaction nag, sag;
-  int salr;
-  int result;
+  time_t deadline;
+  int result, error;
+  socklen_t len;
 
+  if (c->c_ring) {
+    munmap(c->c_ring, sizeof(IDSA_RING));
+    c->c_ring = NULL;
+  }
   if (c->c_fd != (-1)) {
     close(c->c_fd);
     c->c_fd = (-1);
   }
+  c->c_pending = 0;
+
+  /* whatever was outstanding on the old connection is gone */
+  idsa_client_abandon(c);
+
+  /* and a new idsad may have other rules */
+  idsa_cache_flush(c);
 
   f = idsa_getenv(c, "IDSA_SOCKET");
 
@@ -1239,23 +2365,30 @@ static int idsa_client_connect(IDSA_CONNECTION * c)
     return -1;
   }
 
-  salr = 0;
-  if (c->c_flags & IDSA_F_TIMEOUT) {
-    salr = alarm(c->c_timeout);
-
-    nag.sa_handler = idsa_alarm_handle;
-    sigfillset(&(nag.sa_mask));
-    nag.sa_flags = 0;
-
-    sigaction(SIGALRM, &nag, &sag);
+  deadline = block ? idsa_client_deadline(c) : 0;
+  if (deadline || !block) {	/* all io goes through idsa_client_wait */
+    fcntl(c->c_fd, F_SETFL, O_NONBLOCK | fcntl(c->c_fd, F_GETFL, 0));
   }
 
   result = connect(c->c_fd, (struct sockaddr *) &addr, sizeof(addr));
+  while (result && deadline) {
+    if ((errno == EINPROGRESS) || (errno == EALREADY) || (errno == EINTR)) {	/* goes on without us */
+      len = sizeof(int);
+      if (idsa_client_wait(c, POLLOUT, deadline) || getsockopt(c->c_fd, SOL_SOCKET, SO_ERROR, &error, &len) || error) {
+	break;
+      }
+      result = 0;
+    } else if ((errno == EAGAIN) && (idsa_monotonic() < deadline)) {
+      poll(NULL, 0, 10);	/* listen queue full, nothing to wait on */
+      result = connect(c->c_fd, (struct sockaddr *) &addr, sizeof(addr));
+    } else {
+      break;
+    }
+  }
 
-  if (c->c_flags & IDSA_F_TIMEOUT) {
-    alarm(salr);
-    sigaction(SIGALRM, &sag, NULL);
-    idsa_alarm_set = 0;
+  if (result && !block && ((errno == EINPROGRESS) || (errno == EINTR))) {
+    c->c_pending = IDSA_PENDING_CONNECT;
+    return 1;
   }
 
   if (result) {
@@ -1264,11 +2397,319 @@ static int idsa_client_connect(IDSA_CONNECTION * c)
     return -1;
   }
 
+  return idsa_client_ready(c, block);
+}
+
+/****************************************************************************/
+/* Does       : Finishes setting up a connection once connect went through  */
+/* Returns    : like idsa_client_connect                                    */
+/* Notes      : Unless block is set, does not wait for the answer to the    */
+/*              hello either, idsa_client_retry picks it up                 */
+
+static int idsa_client_ready(IDSA_CONNECTION * c, int block)
+{
   fcntl(c->c_fd, F_SETFD, 1);	/* only one at a time please. Anybody know of a close on fork/thread ? */
 
+  idsa_client_agree(c, IDSA_WIRE_TEXT);
+
+  if (((c->c_flags & IDSA_F_PACKED) || ((c->c_flags & IDSA_F_RING) && !(c->c_flags & IDSA_F_THREADS) && !c->c_noring)) && !c->c_nohello) {
+    if (idsa_client_hello(c, block)) {
+      close(c->c_fd);
+      c->c_fd = (-1);
+      return -1;
+    }
+    if (!block) {
+      c->c_pending = IDSA_PENDING_HELLO;
+      c->c_hello = idsa_monotonic() + IDSA_HELLO_TIMEOUT;
+      return 1;
+    }
+    return idsa_client_answer(c, 1);
+  }
+
+  if (!(c->c_flags & IDSA_F_TIMEOUT)) {	/* nonblocking only while connecting */
+    fcntl(c->c_fd, F_SETFL, (~O_NONBLOCK) & fcntl(c->c_fd, F_GETFL, 0));
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : Sets c_wire, encoding c_template anew if that changes it    */
+
+static void idsa_client_agree(IDSA_CONNECTION * c, int wire)
+{
+  if (c->c_wire == wire) {
+    return;
+  }
+
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_rwlock_wrlock(&(c->c_tlock));
+  }
+  c->c_wire = wire;		/* replies to the old format are gone anyway */
+  idsa_client_preset(c);
+  if (c->c_flags & IDSA_F_THREADS) {
+    pthread_rwlock_unlock(&(c->c_tlock));
+  }
+}
+
+/****************************************************************************/
+/* Returns    : the IDSA_WIRE_* format to ask idsad for                     */
+
+static int idsa_client_wanted(IDSA_CONNECTION * c)
+{
+  return (c->c_flags & IDSA_F_PACKED) ? IDSA_WIRE_PACKED : IDSA_WIRE_TEXT;
+}
+
+/****************************************************************************/
+/* Does       : Tells idsad which wire format and transport it would like,  */
+/*              idsa_client_answer takes in what it has to say to that      */
+/* Returns    : zero if the hello went out, nonzero otherwise               */
+/* Notes      : Unless block is set the hello has to fit into the socket    */
+/*              buffer at once, which it does on a fresh connection         */
+
+static int idsa_client_hello(IDSA_CONNECTION * c, int block)
+{
+  char hello[IDSA_HELLO_SIZE];
+  int wire, l;
+
+  wire = idsa_client_wanted(c);
+
+  memset(hello, ' ', IDSA_HELLO_SIZE);
+  l = strlen(IDSA_HELLO);
+  memcpy(hello, IDSA_HELLO, l);
+  if ((c->c_flags & IDSA_F_RING) && !(c->c_flags & IDSA_F_THREADS) && !c->c_noring) {
+    l += sprintf(hello + l, " %s", IDSA_HELLO_RING);
+  }
+  if (wire != IDSA_WIRE_TEXT) {
+    l += sprintf(hello + l, " %s%d", IDSA_HELLO_WIRE, wire);
+  }
+  hello[l] = ' ';
+  hello[IDSA_HELLO_SIZE - 1] = '\n';
+
+  if (block) {
+    return (idsa_client_write(c, hello, IDSA_HELLO_SIZE) < 0) ? 1 : 0;
+  }
+
+#ifdef MSG_NOSIGNAL
+  l = send(c->c_fd, hello, IDSA_HELLO_SIZE, MSG_NOSIGNAL);
+#else
+  l = write(c->c_fd, hello, IDSA_HELLO_SIZE);
+#endif
+
+  return (l == IDSA_HELLO_SIZE) ? 0 : 1;
+}
+
+/****************************************************************************/
+/* Does       : Takes in the answer to a hello, then sets c_wire to the     */
+/*              format idsad agreed to and maps the ring, see lib/ring.c,   */
+/*              if given one. Unless block is set, only looks if the answer */
+/*              is there, giving up on it after IDSA_HELLO_TIMEOUT          */
+/* Returns    : like idsa_client_connect                                    */
+/* Notes      : Sets c_nohello if idsad does not know about hellos, and     */
+/*              c_noring if not about rings, then reconnects without       */
+
+static int idsa_client_answer(IDSA_CONNECTION * c, int block)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  struct stat st;
+  struct pollfd pfd;
+  char control[CMSG_SPACE(sizeof(int))];
+  char answer;
+  time_t deadline;
+  void *r;
+  int fd, rr, wire;
+
+  c->c_pending = 0;
+  deadline = idsa_client_deadline(c);
+
+  do {
+    if (block) {
+      if (idsa_client_wait(c, POLLIN, deadline)) {
+	rr = (-1);
+	break;
+      }
+    } else {
+      pfd.fd = c->c_fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 0) == 0) {	/* not yet */
+	if (idsa_monotonic() < c->c_hello) {
+	  c->c_pending = IDSA_PENDING_HELLO;
+	  return 1;
+	}
+	rr = (-1);
+	break;
+      }
+    }
+
+    iov.iov_base = &answer;
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    rr = recvmsg(c->c_fd, &msg, 0);
+  } while ((rr < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+
+  wire = idsa_client_wanted(c);
+
+  fd = (-1);
+  if (rr > 0) {
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  r = MAP_FAILED;
+  if ((rr == 1) && (answer >= '0') && (answer <= '0' + wire)) {
+    wire = answer - '0';
+    if (fd < 0) {		/* idsad could not make one, use the socket */
+      r = NULL;
+    } else if ((fstat(fd, &st) == 0) && (st.st_size == sizeof(IDSA_RING))) {
+      r = mmap(NULL, sizeof(IDSA_RING), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {			/* other idea of what a ring is */
+      c->c_noring = 1;
+    }
+  } else if (rr == 0) {
+    c->c_nohello = 1;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  if (r == MAP_FAILED) {
+    close(c->c_fd);
+    c->c_fd = (-1);
+    /* an older idsad hangs up on the hello, so try again without */
+    return (c->c_nohello || c->c_noring) ? idsa_client_connect(c, block) : -1;
+  }
+
+  c->c_ring = r;
+
+  if (!(c->c_flags & IDSA_F_TIMEOUT)) {	/* nonblocking only while connecting */
+    fcntl(c->c_fd, F_SETFL, (~O_NONBLOCK) & fcntl(c->c_fd, F_GETFL, 0));
+  }
+
+  idsa_client_agree(c, wire);
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : idsa_client_write for rings, waits while the ring is full   */
+/* Returns    : length on success, -1 otherwise                             */
+
+static int idsa_client_give(IDSA_CONNECTION * c, char *buffer, int length)
+{
+  IDSA_RING_HALF *h;
+  time_t deadline;
+  int done, put;
+
+  h = &(c->c_ring->r_request);
+  deadline = idsa_client_deadline(c);
+
+  done = 0;
+  while (done < length) {
+    put = idsa_ring_put(h, buffer + done, length - done);
+    if (put < 0) {
+      return -1;
+    }
+    if (put > 0) {
+      done += put;
+      if (idsa_ring_wake(h, 1) && idsa_client_ring_notify(c)) {
+	return -1;
+      }
+    } else if ((idsa_ring_sleep(h, 1) == 0) && idsa_client_doorbell(c, deadline)) {
+      return -1;
+    }
+  }
+
+  return length;
+}
+
+/****************************************************************************/
+/* Does       : Copies replies out of the ring, waiting for some if block   */
+/* Returns    : bytes copied, zero if none and not block, -1 on failure     */
+
+static int idsa_client_take(IDSA_CONNECTION * c, char *buffer, int length, time_t deadline, int block)
+{
+  IDSA_RING_HALF *h;
+  int got;
+
+  h = &(c->c_ring->r_reply);
+
+  for (;;) {
+    got = idsa_ring_get(h, buffer, length);
+    if (got < 0) {
+      return -1;
+    }
+    if (got > 0) {
+      if (idsa_ring_wake(h, 0) && idsa_client_ring_notify(c)) {
+	return -1;
+      }
+      return got;
+    }
+    if (!block) {
+      return 0;
+    }
+    if ((idsa_ring_sleep(h, 0) == 0) && idsa_client_doorbell(c, deadline)) {
+      return -1;
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : Sleeps until idsad rings, then swallows what it sent        */
+/* Returns    : zero if woken, nonzero if idsad has gone or took too long   */
+/* Notes      : Wakeups may be stale, callers look at the ring again        */
+
+static int idsa_client_doorbell(IDSA_CONNECTION * c, time_t deadline)
+{
+  char buffer[IDSA_M_STRING];
+  int rr;
+
+  if (idsa_client_wait(c, POLLIN, deadline)) {
+    return 1;
+  }
+
+  do {
+    rr = recv(c->c_fd, buffer, IDSA_M_STRING, MSG_DONTWAIT);
+  } while (rr == IDSA_M_STRING);
+
+  if (rr == 0) {
+    return 1;
+  }
+  if ((rr < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+    return 1;
+  }
+
   return 0;
 }
 
+/****************************************************************************/
+/* Does       : Wakes idsad, which waits on the socket for the ring         */
+/* Returns    : zero on success, nonzero if the connection is broken        */
+
+static int idsa_client_ring_notify(IDSA_CONNECTION * c)
+{
+  int wr;
+
+  do {
+#ifdef MSG_NOSIGNAL
+    wr = send(c->c_fd, "", 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    wr = send(c->c_fd, "", 1, MSG_DONTWAIT);
+#endif
+  } while ((wr < 0) && (errno == EINTR));
+
+  /* a full socket already holds plenty of wakeups */
+  return (wr < 0) && (errno != EAGAIN);
+}
+
 /* error handling code ******************************************************/
 
 #if 0
@@ -1305,7 +2746,7 @@ static void idsa_client_error_internal(IDSA_CONNECTION * c, char *s, ...)
   va_start(ap, s);
 
   if (c->c_fresh == 0) {
-    idsa_event_copy(c->c_internal, c->c_template);
+    idsa_client_template(c, c->c_internal);
     idsa_scheme_verror_internal(c->c_internal, s, ap);
   }
 
@@ -8,6 +8,23 @@
 #include <idsa_internal.h>
 #include <idsa_schemes.h>
 
+/****************************************************************************/
+/* Notes      : c_event is shared by all threads evaluating the chain       */
+
+static void idsa_chain_error_lock(IDSA_RULE_CHAIN * c)
+{
+  if (c->c_lock) {
+    (*c->c_lock) (c->c_lockstate, NULL);
+  }
+}
+
+static void idsa_chain_error_unlock(IDSA_RULE_CHAIN * c)
+{
+  if (c->c_unlock) {
+    (*c->c_unlock) (c->c_lockstate, NULL);
+  }
+}
+
 /****************************************************************************/
 /* parse errors, to export for other modules ********************************/
 
@@ -17,6 +34,8 @@ void idsa_chain_error_system(IDSA_RULE_CHAIN * c, int e, char *s, ...)
 
   va_start(ap, s);
 
+  idsa_chain_error_lock(c);
+
   if ((c->c_event != NULL) && (c->c_fresh == 0)) {
     idsa_scheme_verror_system(c->c_event, e, s, ap);
   }
@@ -24,6 +43,8 @@ void idsa_chain_error_system(IDSA_RULE_CHAIN * c, int e, char *s, ...)
   c->c_fresh = 1;
   c->c_error = 1;
 
+  idsa_chain_error_unlock(c);
+
   va_end(ap);
 }
 
@@ -33,6 +54,8 @@ void idsa_chain_error_internal(IDSA_RULE_CHAIN * c, char *s, ...)
 
   va_start(ap, s);
 
+  idsa_chain_error_lock(c);
+
   if ((c->c_event != NULL) && (c->c_fresh == 0)) {
     idsa_scheme_verror_internal(c->c_event, s, ap);
   }
@@ -40,6 +63,8 @@ void idsa_chain_error_internal(IDSA_RULE_CHAIN * c, char *s, ...)
   c->c_fresh = 1;
   c->c_error = 1;
 
+  idsa_chain_error_unlock(c);
+
   va_end(ap);
 }
 
@@ -49,6 +74,8 @@ void idsa_chain_error_usage(IDSA_RULE_CHAIN * c, char *s, ...)
 
   va_start(ap, s);
 
+  idsa_chain_error_lock(c);
+
   if ((c->c_event != NULL) && (c->c_fresh == 0)) {
     idsa_scheme_verror_usage(c->c_event, s, ap);
   }
@@ -56,17 +83,23 @@ void idsa_chain_error_usage(IDSA_RULE_CHAIN * c, char *s, ...)
   c->c_fresh = 1;
   c->c_error = 1;
 
+  idsa_chain_error_unlock(c);
+
   va_end(ap);
 }
 
 void idsa_chain_error_malloc(IDSA_RULE_CHAIN * c, int bytes)
 {
+  idsa_chain_error_lock(c);
+
   if ((c->c_event != NULL) && (c->c_fresh == 0)) {
     idsa_scheme_error_malloc(c->c_event, bytes);
   }
 
   c->c_fresh = 1;
   c->c_error = 1;
+
+  idsa_chain_error_unlock(c);
 }
 
 /****************************************************************************/
@@ -78,6 +111,8 @@ void idsa_chain_error_token(IDSA_RULE_CHAIN * c, IDSA_MEX_TOKEN * t)
 {
   char buffer[IDSA_M_STRING];
 
+  idsa_chain_error_lock(c);
+
   if ((c->c_event != NULL) && (c->c_fresh == 0)) {
 
     snprintf(buffer, IDSA_M_STRING - 1, "unexpected token <%s> on line %d", t->t_buf, t->t_line);
@@ -90,6 +125,8 @@ void idsa_chain_error_token(IDSA_RULE_CHAIN * c, IDSA_MEX_TOKEN * t)
   c->c_fresh = 1;
   c->c_error = 1;
 
+  idsa_chain_error_unlock(c);
+
 }
 
 /****************************************************************************/
@@ -101,6 +138,8 @@ void idsa_chain_error_mex(IDSA_RULE_CHAIN * c, IDSA_MEX_STATE * m)
 
   ptr = idsa_mex_error(m);
 
+  idsa_chain_error_lock(c);
+
   if ((c->c_event != NULL) && (c->c_fresh == 0)) {
 
     idsa_request_scan(c->c_event, "tokenizing-error", "idsa", 0, IDSA_R_UNKNOWN, IDSA_R_UNKNOWN, IDSA_R_UNKNOWN, IDSA_ES, IDSA_T_STRING, IDSA_ES_USAGE, "comment", IDSA_T_STRING, ptr ? ptr : "unexpected end of rule chain", NULL);
@@ -110,6 +149,8 @@ void idsa_chain_error_mex(IDSA_RULE_CHAIN * c, IDSA_MEX_STATE * m)
   c->c_fresh = 1;
   c->c_error = 1;
 
+  idsa_chain_error_unlock(c);
+
 }
 
 /****************************************************************************/
@@ -5,6 +5,11 @@
 
 #include <idsa_internal.h>
 
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(IDSA_SCAN_SCALAR)
+#include <emmintrin.h>
+#define IDSA_SCAN_SSE2
+#endif
+
 static unsigned char *idsa_escape_table = "0123456789ABCDEF";
 
 static unsigned char escape_unix_xdigit(unsigned int c)
@@ -62,6 +67,155 @@ static int descape_unix_xdigit(unsigned char c)
 #define is_unix_control(c)   (((c)<0x20)||((c)==0x7f))
 #define is_unix_high(c)      ((c)&0x80)
 
+/****************************************************************************/
+/* Does       : scans for the first byte which needs attention, 16 at a     */
+/*              time where SSE2 is available, which is always the case on   */
+/*              x86-64, the rest one by one                                 */
+/* Returns    : its offset, len if there is none                            */
+/* Notes      : most values contain nothing to escape, so the callers can   */
+/*              return at once, or at least skip the clean start            */
+
+#ifdef IDSA_SCAN_SSE2
+#define idsa_scan_load(b, i)    _mm_loadu_si128((__m128i *) ((b) + (i)))
+#define idsa_scan_is(v, c)      _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+#define idsa_scan_first(m)      __builtin_ctz(m)
+#endif
+
+/* bytes which idsa_escape_unix replaces */
+int idsa_scan_unix(unsigned char *buffer, int len)
+{
+  int i;
+#ifdef IDSA_SCAN_SSE2
+  __m128i v, m;
+  int bits;
+#endif
+
+  i = 0;
+
+#ifdef IDSA_SCAN_SSE2
+  for (; i + 16 <= len; i += 16) {
+    v = idsa_scan_load(buffer, i);
+    /* signed compare, so high bytes count as less than a blank */
+    m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+    m = _mm_or_si128(m, idsa_scan_is(v, 0x7f));
+    m = _mm_or_si128(m, idsa_scan_is(v, '\\'));
+    m = _mm_or_si128(m, idsa_scan_is(v, '"'));
+    m = _mm_or_si128(m, idsa_scan_is(v, '^'));
+    bits = _mm_movemask_epi8(m);
+    if (bits) {
+      return i + idsa_scan_first(bits);
+    }
+  }
+#endif
+
+  for (; i < len; i++) {
+    if (is_unix_high(buffer[i]) || is_unix_special(buffer[i]) || is_unix_control(buffer[i])) {
+      return i;
+    }
+  }
+
+  return len;
+}
+
+/* bytes which idsa_descape_unix interprets */
+int idsa_scan_descape(unsigned char *buffer, int len)
+{
+  int i;
+#ifdef IDSA_SCAN_SSE2
+  __m128i v, m;
+  int bits;
+#endif
+
+  i = 0;
+
+#ifdef IDSA_SCAN_SSE2
+  for (; i + 16 <= len; i += 16) {
+    v = idsa_scan_load(buffer, i);
+    m = _mm_or_si128(idsa_scan_is(v, '\\'), idsa_scan_is(v, '^'));
+    bits = _mm_movemask_epi8(m);
+    if (bits) {
+      return i + idsa_scan_first(bits);
+    }
+  }
+#endif
+
+  for (; i < len; i++) {
+    if ((buffer[i] == '\\') || (buffer[i] == '^')) {
+      return i;
+    }
+  }
+
+  return len;
+}
+
+/* bytes which idsa_escape_xml replaces */
+int idsa_scan_xml(unsigned char *buffer, int len)
+{
+  int i;
+#ifdef IDSA_SCAN_SSE2
+  __m128i v, m;
+  int bits;
+#endif
+
+  i = 0;
+
+#ifdef IDSA_SCAN_SSE2
+  for (; i + 16 <= len; i += 16) {
+    v = idsa_scan_load(buffer, i);
+    m = _mm_or_si128(idsa_scan_is(v, '<'), idsa_scan_is(v, '>'));
+    m = _mm_or_si128(m, idsa_scan_is(v, '&'));
+    m = _mm_or_si128(m, idsa_scan_is(v, '"'));
+    bits = _mm_movemask_epi8(m);
+    if (bits) {
+      return i + idsa_scan_first(bits);
+    }
+  }
+#endif
+
+  for (; i < len; i++) {
+    switch (buffer[i]) {
+    case '<':
+    case '>':
+    case '&':
+    case '"':
+      return i;
+    }
+  }
+
+  return len;
+}
+
+/* end of a value in the text wire format */
+int idsa_scan_field(unsigned char *buffer, int len)
+{
+  int i;
+#ifdef IDSA_SCAN_SSE2
+  __m128i v, m;
+  int bits;
+#endif
+
+  i = 0;
+
+#ifdef IDSA_SCAN_SSE2
+  for (; i + 16 <= len; i += 16) {
+    v = idsa_scan_load(buffer, i);
+    m = _mm_or_si128(idsa_scan_is(v, '\t'), idsa_scan_is(v, '\n'));
+    bits = _mm_movemask_epi8(m);
+    if (bits) {
+      return i + idsa_scan_first(bits);
+    }
+  }
+#endif
+
+  for (; i < len; i++) {
+    if ((buffer[i] == '\t') || (buffer[i] == '\n')) {
+      return i;
+    }
+  }
+
+  return len;
+}
+
 #ifdef IDSA_OPTIMISTIC
 /* assumes only a few escape characters */
 
@@ -72,7 +226,7 @@ int idsa_escape_unix(unsigned char *buffer, int len, int max)
 
   result = len;
 
-  for (i = 0; i < result; i++) {
+  for (i = idsa_scan_unix(buffer, len); i < result; i++) {
     if (is_unix_high(buffer[i])) {	/* high characters are escaped as \xx */
       if (result + 2 <= max) {
 	memmove(buffer + i + 2, buffer + i, result - i);
@@ -122,7 +276,7 @@ int idsa_descape_unix(unsigned char *buffer, int len)
   int result;
 
   result = len;
-  i = 0;
+  i = idsa_scan_descape(buffer, len);
 
   while (i < result) {
     switch (buffer[i]) {
@@ -165,7 +319,12 @@ int idsa_escape_unix(unsigned char *buffer, int len, int max)
   int extra, result, i;
   unsigned char c;
 
-  for (i = 0, extra = 0; i < len; i++) {
+  i = idsa_scan_unix(buffer, len);
+  if (i >= len) {		/* the usual case */
+    return len;
+  }
+
+  for (extra = 0; i < len; i++) {
     if (is_unix_high(buffer[i])) {
       extra += 2;
     } else if (is_unix_special(buffer[i])) {
@@ -221,8 +380,8 @@ int idsa_descape_unix(unsigned char *buffer, int len)
   int result;
   unsigned char c, d;
 
-  result = 0;
-  i = 0;
+  i = idsa_scan_descape(buffer, len);	/* clean start stays in place */
+  result = i;
 
   while (i < len) {
     switch (buffer[i]) {
@@ -277,7 +436,7 @@ int idsa_escape_xml(unsigned char *buffer, int len, int max)
 
   result = len;
 
-  for (i = 0; i < result; i++) {
+  for (i = idsa_scan_xml(buffer, len); i < result; i++) {
     switch (buffer[i]) {
     case '<':
       if (result + 3 <= max) {
@@ -334,3 +493,100 @@ int idsa_escape_xml(unsigned char *buffer, int len, int max)
 
   return result;
 }
+
+#ifdef STANDALONE
+/* throughput of the escapers and the text wire format. Build in lib with */
+/* gcc -O2 -DSTANDALONE -I../include escape.c -o escape -L. -lidsa and   */
+/* once more with -DIDSA_SCAN_SCALAR to compare against the byte at a     */
+/* time kernels                                                           */
+
+#include <time.h>
+
+#define ROUNDS 200000
+
+static double bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+  IDSA_EVENT *e, *f;
+  char buffer[IDSA_M_MESSAGE], check[IDSA_M_MESSAGE];
+  unsigned char s[IDSA_M_MESSAGE];
+  int i, k, l;
+  long bytes;
+  double t;
+
+  e = idsa_event_new(0);
+  f = idsa_event_new(0);
+
+  idsa_request_init(e, "a-service-name", "scheme", "some-event-name");
+  idsa_add_string(e, "path", "/usr/local/share/some/rather/long/path/to/a/file/which/is/logged.txt");
+  idsa_add_string(e, "message", "connection from remote host accepted after authentication with public key, session opened for user");
+  idsa_add_string(e, "quoted", "a \"value\" with\ta few ^ escapes \\ in it");
+  idsa_add_integer(e, "count", 123456);
+
+  l = idsa_event_tobuffer(e, buffer, IDSA_M_MESSAGE);
+  if (l <= 0) {
+    return 1;
+  }
+
+  t = bench_now();
+  for (i = 0; i < ROUNDS; i++) {
+    if (idsa_event_frombuffer(f, buffer, l) != l) {
+      return 1;
+    }
+  }
+  t = bench_now() - t;
+  printf("idsa_event_frombuffer %4d %8.1f MB/s\n", l, (double) l * ROUNDS / t / 1e6);
+
+  t = bench_now();
+  for (i = 0; i < ROUNDS; i++) {
+    if (idsa_event_tobuffer(f, check, IDSA_M_MESSAGE) != l) {
+      return 1;
+    }
+  }
+  t = bench_now() - t;
+  printf("idsa_event_tobuffer   %4d %8.1f MB/s\n", l, (double) l * ROUNDS / t / 1e6);
+
+  if (memcmp(buffer, check, l)) {
+    printf("differences: ouch\n");
+    return 1;
+  }
+
+  /* values without anything to escape, the usual case, left as they are */
+  memset(s, 'a', sizeof(s));
+  for (k = 16; k <= 1024; k *= 4) {
+    bytes = 0;
+    t = bench_now();
+    for (i = 0; i < ROUNDS; i++) {
+      bytes += idsa_escape_unix(s, k, IDSA_M_MESSAGE);
+    }
+    t = bench_now() - t;
+    printf("idsa_escape_unix      %4d %8.1f MB/s\n", k, bytes / t / 1e6);
+
+    bytes = 0;
+    t = bench_now();
+    for (i = 0; i < ROUNDS; i++) {
+      bytes += idsa_escape_xml(s, k, IDSA_M_MESSAGE);
+    }
+    t = bench_now() - t;
+    printf("idsa_escape_xml       %4d %8.1f MB/s\n", k, bytes / t / 1e6);
+
+    bytes = 0;
+    t = bench_now();
+    for (i = 0; i < ROUNDS; i++) {
+      bytes += idsa_descape_unix(s, k);
+    }
+    t = bench_now() - t;
+    printf("idsa_descape_unix     %4d %8.1f MB/s\n", k, bytes / t / 1e6);
+  }
+
+  return 0;
+}
+#endif
@@ -24,6 +24,196 @@
 
 #define idsa_event_space(e) (IDSA_M_MESSAGE-(e->e_size+(e->e_count*sizeof(int))))
 
+/****************************************************************************/
+/* Notes      : e_hash maps each bucket to the latest unit whose name falls */
+/*              into it, e_chain each unit to the one before it in the same */
+/*              bucket. Lookup by name starts at the latest and follows the */
+/*              chain, so it only looks at names in its own bucket. Zero    */
+/*              ends both. Units are too large for more than 255 to fit.    */
+/*              Names are not supposed to change once appended              */
+
+static unsigned int idsa_event_hash(char *n)
+{
+  unsigned int h;
+  int i;
+
+  h = 2166136261U;
+  for (i = 0; (i < IDSA_M_NAME) && (n[i] != '\0'); i++) {
+    h = (h ^ (unsigned char) n[i]) * 16777619U;
+  }
+
+  return h & (IDSA_EVENT_HASH - 1);
+}
+
+static void idsa_event_index(IDSA_EVENT * e, IDSA_UNIT * u, unsigned int i)
+{
+  unsigned char *b;
+
+  b = &(e->e_hash[idsa_event_hash(idsa_unit_name_get(u))]);
+  if (*b <= i) {
+    e->e_chain[i] = *b;
+    *b = i + 1;
+  }
+}
+
+/****************************************************************************/
+/* Does       : notes that unit n no longer is as in the template e came    */
+/*              from, see idsa_preset_tobuffer                              */
+
+static void idsa_event_dirty(IDSA_EVENT * e, int n)
+{
+  if (n < IDSA_PRESET_UNITS) {
+    e->e_dirty |= (1U << n);
+  }
+}
+
+/****************************************************************************/
+/* Notes      : units appended by idsa_event_lazyappend hold their value as */
+/*              text, still escaped, until it is first asked for. Their     */
+/*              slot has room for the text and for the value scanned from   */
+/*              it, so that scanning happens in place and no other unit has */
+/*              to move. Afterwards the value may not fill the slot, which  */
+/*              is why such events set e_slack                              */
+
+static int idsa_event_israw(IDSA_EVENT * e, unsigned int n)
+{
+  return (n < IDSA_EVENT_RAW) && (e->e_raw[n / 8] & (1 << (n % 8)));
+}
+
+static void idsa_event_cooked(IDSA_EVENT * e, unsigned int n)
+{
+  if (n < IDSA_EVENT_RAW) {
+    e->e_raw[n / 8] &= ~(1 << (n % 8));
+  }
+}
+
+/****************************************************************************/
+/* Returns    : unit n of e as it is, NULL if there is none                 */
+
+static IDSA_UNIT *idsa_event_locate(IDSA_EVENT * e, unsigned int n)
+{
+  unsigned int offset;
+
+  if (n >= e->e_count) {
+    return NULL;
+  }
+
+  memcpy(&offset, e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * (n + 1))), sizeof(unsigned int));
+
+  return (IDSA_UNIT *) (e->e_ptr + offset);
+}
+
+/****************************************************************************/
+/* Returns    : bytes from the start of unit n to the start of the next     */
+
+static unsigned int idsa_event_slot(IDSA_EVENT * e, unsigned int n)
+{
+  unsigned int offset, next;
+
+  memcpy(&offset, e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * (n + 1))), sizeof(unsigned int));
+  if (n + 1 < e->e_count) {
+    memcpy(&next, e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * (n + 2))), sizeof(unsigned int));
+  } else {
+    next = e->e_size - IDSA_S_OFFSET;
+  }
+
+  return next - offset;
+}
+
+/****************************************************************************/
+/* Does       : scans the text held by unit u, number n, into its value     */
+/* Returns    : u on success, NULL if the text is no value of its type      */
+/* Notes      : such a unit stays text and marks e as faulty, the request  */
+/*              is rejected as if it had not parsed in the first place      */
+
+static IDSA_UNIT *idsa_event_decode(IDSA_EVENT * e, unsigned int n, IDSA_UNIT * u)
+{
+  IDSA_UNIT v;
+  char text[IDSA_M_MESSAGE];
+  int l;
+
+  l = strlen(u->u_ptr);
+  memcpy(text, u->u_ptr, l);
+  l = idsa_descape_unix((unsigned char *) text, l);
+  text[l] = '\0';
+
+  memcpy(v.u_name, u->u_name, IDSA_M_NAME);
+  v.u_type = u->u_type;
+  memset(v.u_ptr, '\0', idsa_type_size(v.u_type));
+
+  if (idsa_unit_scan(&v, text)) {
+    e->e_fault = 1;
+    return NULL;
+  }
+
+  memcpy(u, &v, idsa_unit_size(&v));
+  idsa_event_cooked(e, n);
+
+  return u;
+}
+
+/****************************************************************************/
+/* Does       : sets the size of e to end with u, its last unit, after the  */
+/*              value of u has been written                                 */
+
+static void idsa_event_trim(IDSA_EVENT * e, IDSA_UNIT * u)
+{
+  e->e_size = IDSA_S_OFFSET + (((char *) u) - e->e_ptr) + idsa_unit_size(u);
+}
+
+/****************************************************************************/
+/* Does       : overwrites unit u, number n, with v and moves the units     */
+/*              after it to fit, as units only take up the space their      */
+/*              value needs                                                 */
+/* Returns    : new location of the unit, NULL if e has no room for it      */
+
+static IDSA_UNIT *idsa_event_replace(IDSA_EVENT * e, int n, IDSA_UNIT * u, IDSA_UNIT * v)
+{
+  unsigned int offset, lookup, old, new, tail, i, j;
+
+  old = idsa_event_slot(e, n);
+  new = idsa_unit_size(v);
+
+  if ((new > old) && (idsa_event_space(e) < new - old)) {
+    return NULL;
+  }
+
+  offset = ((char *) u) - e->e_ptr;
+  tail = e->e_size - (IDSA_S_OFFSET + offset + old);
+
+  memmove(e->e_ptr + offset + new, e->e_ptr + offset + old, tail);
+  memcpy(u, v, new);
+
+  for (i = n + 1; i < e->e_count; i++) {
+    lookup = IDSA_M_UNITS - (sizeof(unsigned int) * (i + 1));
+    memcpy(&j, e->e_ptr + lookup, sizeof(unsigned int));
+    j = j + new - old;
+    memcpy(e->e_ptr + lookup, &j, sizeof(unsigned int));
+  }
+  e->e_size = e->e_size + new - old;
+
+  return u;
+}
+
+/****************************************************************************/
+/* Returns    : size of unit u, for which there are limit bytes, or a value */
+/*              exceeding limit if it does not fit                          */
+/* Notes      : a string without terminator is measured up to limit only    */
+
+static unsigned int idsa_event_bounded(IDSA_UNIT * u, unsigned int limit)
+{
+  unsigned int header;
+
+  header = sizeof(IDSA_UNIT) - IDSA_M_LONG;
+  if (header + idsa_type_size(idsa_unit_type(u)) > limit) {
+    if ((limit <= header) || (memchr(u->u_ptr, '\0', limit - header) == NULL)) {
+      return limit + 1;
+    }
+  }
+
+  return idsa_unit_size(u);
+}
+
 /****************************************************************************/
 /* Does       : Formats event with required fields                          */
 
@@ -32,9 +222,12 @@ void idsa_event_clear(IDSA_EVENT * e, unsigned int m)
   e->e_magic = m;
   e->e_size = IDSA_S_OFFSET;
   e->e_count = 0;
-
-  /* pointless, but tidy */
-  memset(e->e_ptr, '\0', IDSA_M_UNITS);
+  memset(e->e_hash, 0, IDSA_EVENT_HASH);
+  e->e_origin = 0;
+  e->e_dirty = 0;
+  e->e_slack = 0;
+  memset(e->e_raw, 0, IDSA_EVENT_RAW / 8);
+  e->e_fault = 0;
 
 #ifdef DEBUG
   fprintf(stderr, "idsa_event_clear(): formatted event\n");
@@ -66,13 +259,26 @@ void idsa_event_free(IDSA_EVENT * e)
 
 /****************************************************************************/
 /* Does       : Make copy of event                                          */
+/* Notes      : only copies units and index, not the gap between them       */
 
 void idsa_event_copy(IDSA_EVENT * a, IDSA_EVENT * b)
 {
+  unsigned int index;
+
+  index = sizeof(unsigned int) * b->e_count;
+
   a->e_magic = b->e_magic;
   a->e_size = b->e_size;
   a->e_count = b->e_count;
-  memcpy(a->e_ptr, b->e_ptr, IDSA_M_UNITS);
+  memcpy(a->e_ptr, b->e_ptr, b->e_size - IDSA_S_OFFSET);
+  memcpy(a->e_ptr + IDSA_M_UNITS - index, b->e_ptr + IDSA_M_UNITS - index, index);
+  memcpy(a->e_hash, b->e_hash, IDSA_EVENT_HASH);
+  memcpy(a->e_chain, b->e_chain, b->e_count);
+  a->e_origin = b->e_origin;
+  a->e_dirty = b->e_dirty;
+  a->e_slack = b->e_slack;
+  memcpy(a->e_raw, b->e_raw, IDSA_EVENT_RAW / 8);
+  a->e_fault = b->e_fault;
 }
 
 /****************************************************************************/
@@ -100,6 +306,66 @@ int idsa_event_concat(IDSA_EVENT * t, IDSA_EVENT * s)
 }
 
 
+/****************************************************************************/
+/* Does       : check for events with slack, whose index is the only guide  */
+/*              to where units start. Units still holding text only need a  */
+/*              terminator, their value gets checked when scanned           */
+
+static int idsa_event_checkslots(IDSA_EVENT * e)
+{
+  unsigned int offset, next, lookup, i;
+  IDSA_UNIT *u;
+
+  memset(e->e_hash, 0, IDSA_EVENT_HASH);
+  e->e_origin = 0;
+
+  lookup = IDSA_M_UNITS - (sizeof(unsigned int) * e->e_count);
+  if ((e->e_count > IDSA_EVENT_RAW) || (e->e_size - IDSA_S_OFFSET > lookup)) {
+    e->e_count = 0;
+    e->e_size = IDSA_S_OFFSET;
+    return 1;
+  }
+
+  offset = 0;
+  for (i = 0; i < e->e_count; i++) {
+    memcpy(&next, e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * (i + 1))), sizeof(unsigned int));
+    if (next != offset) {	/* slots have to follow each other */
+      break;
+    }
+    next = offset + idsa_event_slot(e, i);
+    if ((next > e->e_size - IDSA_S_OFFSET) || (next < offset + sizeof(IDSA_UNIT) - IDSA_M_LONG)) {
+      break;
+    }
+
+    u = (IDSA_UNIT *) (e->e_ptr + offset);
+    if (idsa_event_israw(e, i)) {
+      if ((idsa_unit_type(u) >= IDSA_M_TYPES) || (idsa_unit_type(u) == IDSA_T_NULL)) {
+	break;
+      }
+      if (memchr(u->u_ptr, '\0', next - offset - (sizeof(IDSA_UNIT) - IDSA_M_LONG)) == NULL) {
+	break;
+      }
+      u->u_name[IDSA_M_NAME - 1] = '\0';
+    } else if ((idsa_event_bounded(u, next - offset) > next - offset) || idsa_unit_check(u)) {
+      break;
+    }
+
+    idsa_event_index(e, u, i);
+    offset = next;
+  }
+
+  if (i < e->e_count) {
+#ifdef DEBUG
+    fprintf(stderr, "idsa_event_checkslots(): failure at %d\n", i + 1);
+#endif
+    e->e_count = i;
+    e->e_size = IDSA_S_OFFSET + offset;
+    return 1;
+  }
+
+  return 0;
+}
+
 /****************************************************************************/
 /* Does       : Eyeballs event, attempts to overwrite as much as possible   */
 /*              to make it consistent, and build index                      */
@@ -111,10 +377,17 @@ int idsa_event_check(IDSA_EVENT * e)
   unsigned int offset, lookup, i, len;
   IDSA_UNIT *u;
 
+  if (e->e_slack) {
+    return idsa_event_checkslots(e);
+  }
+
   i = 0;
   offset = 0;
   lookup = IDSA_M_UNITS;
 
+  memset(e->e_hash, 0, IDSA_EVENT_HASH);
+  e->e_origin = 0;
+
   while (i < e->e_count) {
     u = (IDSA_UNIT *) (e->e_ptr + offset);
     lookup -= (sizeof(unsigned int));
@@ -126,7 +399,7 @@ int idsa_event_check(IDSA_EVENT * e)
       result++;
       e->e_count = i;
     } else {			/* sufficent to read name and type */
-      len = idsa_unit_size(u);
+      len = idsa_event_bounded(u, lookup - offset);
 
       if ((offset + len > lookup) || idsa_unit_check(u)) {	/* unit too long or buggered */
 #ifdef DEBUG
@@ -139,6 +412,7 @@ int idsa_event_check(IDSA_EVENT * e)
 	fprintf(stderr, "idsa_event_check(): [%d] <%s> 0x%04x: ok\n", i + 1, idsa_unit_name_get(u), idsa_unit_type(u));
 #endif
 	memcpy(e->e_ptr + lookup, &offset, sizeof(int));	/* add index */
+	idsa_event_index(e, u, i);
 	i++;
 	offset += len;
       }
@@ -171,11 +445,18 @@ int idsa_event_dump(IDSA_EVENT * e, FILE * f)
   fprintf(f, "event: magic <0x%04x>, size <%d>\n", e->e_magic, e->e_size);
   fprintf(f, "event: ptr <%p>, ptrsize <%d>, count <%d>\n", e->e_ptr, l, e->e_count);
 
-  while (i < l) {
+  while ((i < l) && (j < e->e_count)) {
     u = (IDSA_UNIT *) (e->e_ptr + i);
     lookup = IDSA_M_UNITS - (sizeof(unsigned int) * (j + 1));
     memcpy(&offset, e->e_ptr + lookup, sizeof(unsigned int));
-    r = idsa_unit_print(u, buffer, IDSA_M_MESSAGE - 1, 0);
+    if (idsa_event_israw(e, j)) {	/* not scanned yet */
+      r = snprintf(buffer, IDSA_M_MESSAGE - 1, "text \"%s\"", u->u_ptr);
+      if (r >= IDSA_M_MESSAGE - 1) {
+	r = IDSA_M_MESSAGE - 2;
+      }
+    } else {
+      r = idsa_unit_print(u, buffer, IDSA_M_MESSAGE - 1, 0);
+    }
     if (r < 0) {
       r = 0;
     }
@@ -183,7 +464,7 @@ int idsa_event_dump(IDSA_EVENT * e, FILE * f)
 
     fprintf(f, "unit[%02d]: %p[%04d [%04d]=%04d]: 0x%04x, <%s>, <%s:%d>\n", j + 1, e->e_ptr, i, lookup, offset, idsa_unit_type(u), idsa_unit_name_get(u), buffer, r);
 
-    i += idsa_unit_size(u);
+    i += e->e_slack ? idsa_event_slot(e, j) : idsa_unit_size(u);
     j++;
   }
 
@@ -198,9 +479,19 @@ int idsa_event_dump(IDSA_EVENT * e, FILE * f)
 IDSA_UNIT *idsa_event_setbynumber(IDSA_EVENT * e, int n, void *p)
 {
   IDSA_UNIT *u;
-  u = idsa_event_unitbynumber(e, n);
+  IDSA_UNIT v;
+  int i;
+
+  u = idsa_event_locate(e, n);	/* old value does not matter */
   if (u && p) {
-    if (idsa_unit_set(u, p)) {
+    idsa_event_dirty(e, n);
+    memcpy(&v, u, idsa_unit_size(u));
+    i = idsa_unit_set(&v, p);
+    u = idsa_event_replace(e, n, u, &v);
+    if (u) {
+      idsa_event_cooked(e, n);
+    }
+    if (i) {
       u = NULL;
     }
   }
@@ -213,9 +504,19 @@ IDSA_UNIT *idsa_event_setbynumber(IDSA_EVENT * e, int n, void *p)
 IDSA_UNIT *idsa_event_scanbynumber(IDSA_EVENT * e, int n, char *s)
 {
   IDSA_UNIT *u;
-  u = idsa_event_unitbynumber(e, n);
+  IDSA_UNIT v;
+  int i;
+
+  u = idsa_event_locate(e, n);
   if (u && s) {
-    if (idsa_unit_scan(u, s)) {
+    idsa_event_dirty(e, n);
+    memcpy(&v, u, idsa_unit_size(u));
+    i = idsa_unit_scan(&v, s);
+    u = idsa_event_replace(e, n, u, &v);
+    if (u) {
+      idsa_event_cooked(e, n);
+    }
+    if (i) {
       u = NULL;
     }
   }
@@ -228,6 +529,8 @@ IDSA_UNIT *idsa_event_scanbynumber(IDSA_EVENT * e, int n, char *s)
 IDSA_UNIT *idsa_event_setappend(IDSA_EVENT * e, char *n, unsigned int t, void *p)
 {
   IDSA_UNIT *u;
+  int i;
+
   u = idsa_event_append(e, t);
 #ifdef DEBUG
   fprintf(stderr, "idsa_event_setappend(): appended unit at <%p>\n", u);
@@ -236,8 +539,11 @@ IDSA_UNIT *idsa_event_setappend(IDSA_EVENT * e, char *n, unsigned int t, void *p
     if (n) {
       idsa_unit_name_set(u, n);
     }
+    idsa_event_index(e, u, e->e_count - 1);
     if (p) {
-      if (idsa_unit_set(u, p)) {
+      i = idsa_unit_set(u, p);
+      idsa_event_trim(e, u);
+      if (i) {
 	u = NULL;
       }
     }
@@ -251,13 +557,18 @@ IDSA_UNIT *idsa_event_setappend(IDSA_EVENT * e, char *n, unsigned int t, void *p
 IDSA_UNIT *idsa_event_scanappend(IDSA_EVENT * e, char *n, unsigned int t, char *s)
 {
   IDSA_UNIT *u;
+  int i;
+
   u = idsa_event_append(e, t);
   if (u) {
     if (n) {
       idsa_unit_name_set(u, n);
     }
+    idsa_event_index(e, u, e->e_count - 1);
     if (s) {
-      if (idsa_unit_scan(u, s)) {
+      i = idsa_unit_scan(u, s);
+      idsa_event_trim(e, u);
+      if (i) {
 	u = NULL;
       }
     }
@@ -265,6 +576,70 @@ IDSA_UNIT *idsa_event_scanappend(IDSA_EVENT * e, char *n, unsigned int t, char *
   return u;
 }
 
+/****************************************************************************/
+/* Does       : appends new unit to event with the first l bytes of its     */
+/*              value copied from p, as they are held in memory             */
+
+IDSA_UNIT *idsa_event_rawappend(IDSA_EVENT * e, char *n, unsigned int t, char *p, int l)
+{
+  IDSA_UNIT *u;
+
+  if ((l < 0) || (l > idsa_type_size(t))) {
+    return NULL;
+  }
+
+  u = idsa_event_append(e, t);
+  if (u) {
+    idsa_unit_name_set(u, n);
+    idsa_event_index(e, u, e->e_count - 1);
+    memcpy(u->u_ptr, p, l);
+    idsa_event_trim(e, u);
+  }
+  return u;
+}
+
+/****************************************************************************/
+/* Does       : appends new unit to event holding the l characters of text  */
+/*              at s, still escaped, to be scanned once asked for           */
+
+IDSA_UNIT *idsa_event_lazyappend(IDSA_EVENT * e, char *n, unsigned int t, char *s, int l)
+{
+  unsigned int offset, slot;
+  IDSA_UNIT *u;
+
+  if ((t >= IDSA_M_TYPES) || (t == IDSA_T_NULL) || (l < 0) || (e->e_count >= IDSA_EVENT_RAW)) {
+    return NULL;
+  }
+
+  /* text with terminator, or the value scanned from it, if larger */
+  slot = (l + sizeof(int)) & ~(sizeof(int) - 1);
+  if (slot < idsa_type_payload(t, l)) {
+    slot = idsa_type_payload(t, l);
+  }
+  slot += sizeof(IDSA_UNIT) - IDSA_M_LONG;
+
+  if (idsa_event_space(e) < slot + sizeof(unsigned int)) {
+    return NULL;
+  }
+
+  offset = e->e_size - IDSA_S_OFFSET;
+  u = (IDSA_UNIT *) (e->e_ptr + offset);
+  e->e_count++;
+  memcpy(e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * e->e_count)), &offset, sizeof(unsigned int));
+
+  idsa_unit_name_set(u, n);
+  idsa_event_index(e, u, e->e_count - 1);
+  u->u_type = t;
+  memcpy(u->u_ptr, s, l);
+  u->u_ptr[l] = '\0';
+
+  e->e_size += slot;
+  e->e_slack = 1;
+  e->e_raw[(e->e_count - 1) / 8] |= 1 << ((e->e_count - 1) % 8);
+
+  return u;
+}
+
 /****************************************************************************/
 /* Does       : appends new unit to event with no value                     */
 
@@ -274,6 +649,8 @@ IDSA_UNIT *idsa_event_unitappend(IDSA_EVENT * e, IDSA_UNIT * u)
   v = idsa_event_append(e, u->u_type);
   if (v) {
     idsa_unit_copy(v, u);
+    idsa_event_trim(e, v);
+    idsa_event_index(e, v, e->e_count - 1);
   }
   return v;
 }
@@ -297,7 +674,11 @@ IDSA_UNIT *idsa_event_unitbyname(IDSA_EVENT * e, char *n)
   IDSA_UNIT *result;
   unsigned int i, offset;
 
-  i = e->e_count;
+  /* latest candidate, zero if no unit has a name in the bucket */
+  i = e->e_hash[idsa_event_hash(n)];
+  if (i > e->e_count) {
+    i = e->e_count;
+  }
 
   while (i > 0) {
     memcpy(&offset, e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * i)), sizeof(unsigned int));
@@ -310,9 +691,12 @@ IDSA_UNIT *idsa_event_unitbyname(IDSA_EVENT * e, char *n)
 #ifdef DEBUG
       fprintf(stderr, "idsa_event_unitbyname(): got it [%d]=%p (%s)\n", i, result, idsa_unit_name_get(result));
 #endif
+      if (idsa_event_israw(e, i - 1)) {
+	return idsa_event_decode(e, i - 1, result);
+      }
       return result;
     }
-    i--;
+    i = e->e_chain[i - 1];
   }
 
 #ifdef DEBUG
@@ -329,14 +713,15 @@ IDSA_UNIT *idsa_event_unitbyname(IDSA_EVENT * e, char *n)
 IDSA_UNIT *idsa_event_unitbynumber(IDSA_EVENT * e, int n)
 {
   IDSA_UNIT *result;
-  unsigned int offset;
 
-  if (n < e->e_count) {
-    memcpy(&offset, e->e_ptr + (IDSA_M_UNITS - (sizeof(unsigned int) * (n + 1))), sizeof(unsigned int));
-    result = (IDSA_UNIT *) (e->e_ptr + offset);
+  if ((n >= 0) && (n < e->e_count)) {
+    result = idsa_event_locate(e, n);
 #ifdef DEBUG
     fprintf(stderr, "idsa_event_unitbynumber(): got it [%d]=%p (%s)\n", n, result, idsa_unit_name_get(result));
 #endif
+    if (idsa_event_israw(e, n)) {
+      return idsa_event_decode(e, n, result);
+    }
     return result;
   } else {
 #ifdef DEBUG
@@ -346,9 +731,24 @@ IDSA_UNIT *idsa_event_unitbynumber(IDSA_EVENT * e, int n)
   }
 }
 
+/****************************************************************************/
+/* Returns    : type of unit n, IDSA_T_NULL if there is none                */
+/* Notes      : does not scan a value still held as text                    */
+
+unsigned int idsa_event_unittype(IDSA_EVENT * e, int n)
+{
+  IDSA_UNIT *u;
+
+  u = ((n >= 0) && (n < e->e_count)) ? idsa_event_locate(e, n) : NULL;
+
+  return u ? idsa_unit_type(u) : IDSA_T_NULL;
+}
+
 /****************************************************************************/
 /* Does       : Add another unit to event                                   */
 /* Returns    : pointer to unit on success, NULL otherwise                  */
+/* Notes      : the unit is left out of the index by name, callers add it   */
+/*              once it has its name, see idsa_event_index                  */
 
 IDSA_UNIT *idsa_event_append(IDSA_EVENT * e, unsigned int t)
 {
@@ -384,8 +784,11 @@ IDSA_UNIT *idsa_event_append(IDSA_EVENT * e, unsigned int t)
 #endif
 
   idsa_unit_name_set(result, "");
+  idsa_event_cooked(e, e->e_count - 1);	/* may be left over from a check */
 
+  /* room for the largest value, but only the empty one counts for now */
   result->u_type = t;
+  memset(result->u_ptr, '\0', idsa_type_size(t));
   e->e_size += idsa_unit_size(result);
 
   return result;
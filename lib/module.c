@@ -97,6 +97,31 @@ void idsa_module_stop_global(IDSA_RULE_CHAIN * c)
   }
 }
 
+/****************************************************************************/
+/* Does       : lets each module of c pick up state from its namesake in o  */
+/* Returns    : number of modules which were given the chance               */
+
+int idsa_module_carry_global(IDSA_RULE_CHAIN * c, IDSA_RULE_CHAIN * o)
+{
+  IDSA_MODULE *mi, *mj;
+  int result = 0;
+
+  for (mi = c->c_modules; mi != NULL; mi = mi->m_next) {
+    if ((mi->global_carry == NULL) || (mi->m_state == NULL)) {
+      continue;
+    }
+    for (mj = o->c_modules; mj != NULL; mj = mj->m_next) {
+      if ((mj->m_version == mi->m_version) && (mj->m_state != NULL) && !strcmp(mj->m_name, mi->m_name)) {
+	(*mi->global_carry) (c, mi->m_state, mj->m_state);
+	result++;
+	break;
+      }
+    }
+  }
+
+  return result;
+}
+
 /****************************************************************************/
 
 IDSA_RULE_TEST *idsa_module_start_test(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, char *n)
@@ -192,10 +217,21 @@ IDSA_RULE_TEST *idsa_module_start_test(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c,
   return result;
 }
 
-int idsa_module_do_test(IDSA_RULE_CHAIN * c, IDSA_RULE_TEST * t, IDSA_EVENT * q)
+int idsa_module_do_test(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_RULE_TEST * t, IDSA_EVENT * q)
 {
-  if (t->t_module->test_do) {
-    return (*t->t_module->test_do) (c, t->t_module->m_state, t->t_state, q);
+  IDSA_MODULE *module;
+  int result;
+
+  module = t->t_module;
+
+  if (module->test_do) {
+    if (c->c_lock && !(module->m_flags & IDSA_MODULE_F_CONCURRENT)) {
+      (*c->c_lock) (c->c_lockstate, module->m_lock);
+      result = (*module->test_do) (c, l, module->m_state, t->t_state, q);
+      (*c->c_unlock) (c->c_lockstate, module->m_lock);
+      return result;
+    }
+    return (*module->test_do) (c, l, module->m_state, t->t_state, q);
   }
 
   return 0;
@@ -311,13 +347,24 @@ IDSA_RULE_ACTION *idsa_module_start_action(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN *
   return result;
 }
 
-int idsa_module_do_action(IDSA_RULE_CHAIN * c, IDSA_RULE_ACTION * a, IDSA_EVENT * q, IDSA_EVENT * p)
+int idsa_module_do_action(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_RULE_ACTION * a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
-  if (a->a_module->action_do) {
+  IDSA_MODULE *module;
+  int result;
+
+  module = a->a_module;
+
+  if (module->action_do) {
 #ifdef DEBUG
-    fprintf(stderr, "idsa_module_do_action(): doing %s\n", a->a_module->m_name);
+    fprintf(stderr, "idsa_module_do_action(): doing %s\n", module->m_name);
 #endif
-    return (*a->a_module->action_do) (c, a->a_module->m_state, a->a_state, q, p);
+    if (c->c_lock && !(module->m_flags & IDSA_MODULE_F_CONCURRENT)) {
+      (*c->c_lock) (c->c_lockstate, module->m_lock);
+      result = (*module->action_do) (c, l, module->m_state, a->a_state, q, p);
+      (*c->c_unlock) (c->c_lockstate, module->m_lock);
+      return result;
+    }
+    return (*module->action_do) (c, l, module->m_state, a->a_state, q, p);
   }
 
   return 0;
@@ -400,10 +447,13 @@ IDSA_MODULE *idsa_module_load(IDSA_RULE_CHAIN * c, char *n)
     return NULL;
   }
 
-  /* check for inconsistencies if module interface should change in future
-     if(result->m_version != IDSA_MODULE_INTERFACE_VERSION){
-     }
-   */
+  /* do functions of older modules lack the local parameter */
+  if (result->m_version != IDSA_MODULE_INTERFACE_VERSION) {
+    idsa_chain_error_usage(c, "module %s was built for interface version %d, library requires %d", n, result->m_version, IDSA_MODULE_INTERFACE_VERSION);
+    idsa_module_free(c, result);
+    dlclose(handle);
+    return NULL;
+  }
 
   result->m_handle = handle;
 
@@ -1,3 +1,27 @@
+/****************************************************************************/
+/*                                                                          */
+/*  Rewrites the node graph built by the parser before it is compiled. The  */
+/*  graph is a dag: each rule adds a test for every term of its head, the   */
+/*  false branches of its first test lead to the next rule. Configurations  */
+/*  tend to start many rules with the same test, which then is repeated on  */
+/*  every path through them. Three things are done:                         */
+/*                                                                          */
+/*  - a branch into a node whose outcome is already known on every path to */
+/*    it, because the same pure test was done before, or because its test  */
+/*    is constant, goes directly to where that node would have gone        */
+/*  - nodes with the same test and the same branches, and no body, are     */
+/*    merged                                                                */
+/*  - nodes which can no longer be reached are freed                        */
+/*                                                                          */
+/*  Only tests of modules with IDSA_MODULE_F_PURE or IDSA_MODULE_F_CONSTANT */
+/*  are skipped. A body with actions which may change what tests see ends  */
+/*  what is known                                                           */
+/*                                                                          */
+/****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <idsa_internal.h>
 
 struct idsa_node_set {
@@ -9,6 +33,19 @@ typedef struct idsa_node_set IDSA_NODE_SET;
 
 #define DEFAULT_SET_SIZE 128
 
+/* outcomes remembered per node, older ones are forgotten first */
+#define IDSA_OPTIMIZE_FACTS 16
+
+struct idsa_node_info {
+  int i_pending;		/* branches into node from nodes not yet visited */
+  int i_reached;		/* some path gets here */
+  int i_have;			/* number of facts */
+  IDSA_RULE_TEST *i_test[IDSA_OPTIMIZE_FACTS];	/* outcomes known on every path */
+  char i_value[IDSA_OPTIMIZE_FACTS];
+  IDSA_RULE_NODE *i_same;	/* node kept in place of this one */
+};
+typedef struct idsa_node_info IDSA_NODE_INFO;
+
 static IDSA_NODE_SET *idsa_new_set(IDSA_RULE_CHAIN * c)
 {
   IDSA_NODE_SET *result;
@@ -49,7 +86,7 @@ static void idsa_push_set(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * n, IDSA_RULE_NODE
   IDSA_RULE_NODE **t;
 
   if (n->n_used >= n->n_have) {
-    t = realloc(n->n_array, sizeof(IDSA_RULE_NODE) * 2 * n->n_have);
+    t = realloc(n->n_array, sizeof(IDSA_RULE_NODE *) * 2 * n->n_have);
     if (t) {
       n->n_array = t;
       n->n_have = 2 * n->n_have;
@@ -64,19 +101,6 @@ static void idsa_push_set(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * n, IDSA_RULE_NODE
   }
 }
 
-static void idsa_del_set(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * n, IDSA_RULE_NODE * d)
-{
-  int i;
-  for (i = 0; i < n->n_used; i++) {
-    if (n->n_array[i] == d) {
-      n->n_used = n->n_used - 1;
-      if (n->n_used > i) {
-	n->n_array[i] = n->n_array[n->n_used];
-      }
-    }
-  }
-}
-
 static void idsa_clear_set(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * n)
 {
   n->n_used = 0;
@@ -91,3 +115,457 @@ static IDSA_RULE_NODE *idsa_pop_set(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * n)
     return NULL;
   }
 }
+
+/****************************************************************************/
+/* Returns    : branch b of n if idsa_chain_run may take it, NULL otherwise */
+
+static IDSA_RULE_NODE *idsa_optimize_next(IDSA_RULE_NODE * n, int b)
+{
+  if (n->n_test == NULL) {
+    return NULL;
+  }
+
+  return b ? n->n_true : n->n_false;
+}
+
+static void idsa_optimize_link(IDSA_RULE_NODE * n, int b, IDSA_RULE_NODE * t)
+{
+  IDSA_RULE_NODE **p;
+
+  p = b ? &(n->n_true) : &(n->n_false);
+
+  if (*p == t) {
+    return;
+  }
+  if (*p) {
+    (*p)->n_count--;
+  }
+  if (t) {
+    t->n_count++;
+  }
+  *p = t;
+}
+
+/****************************************************************************/
+/* Returns    : nonzero if the body of n does nothing                       */
+
+static int idsa_optimize_quiet(IDSA_RULE_NODE * n)
+{
+  IDSA_RULE_BODY *b;
+
+  b = n->n_body;
+
+  return (b == NULL) || ((b->b_have == 0) && (b->b_deny == 0) && (b->b_drop == 0));
+}
+
+/****************************************************************************/
+/* Returns    : nonzero if running the body of n leaves intact what tests   */
+/*              see, which is what IDSA_MODULE_F_DEFER promises             */
+
+static int idsa_optimize_harmless(IDSA_RULE_NODE * n)
+{
+  IDSA_RULE_BODY *b;
+  int i;
+
+  b = n->n_body;
+  if (b == NULL) {
+    return 1;
+  }
+
+  for (i = 0; i < b->b_have; i++) {
+    if (!(b->b_array[i]->a_module->m_flags & IDSA_MODULE_F_DEFER)) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/****************************************************************************/
+/* Returns    : outcome of the test of n given facts f, -1 if not known     */
+
+static int idsa_optimize_known(IDSA_RULE_CHAIN * c, IDSA_NODE_INFO * f, IDSA_RULE_NODE * n)
+{
+  IDSA_RULE_TEST *t;
+  int i;
+
+  t = n->n_test;
+
+  if (t->t_module->m_flags & IDSA_MODULE_F_CONSTANT) {
+    return idsa_module_do_test(c, NULL, t, NULL) ? 1 : 0;
+  }
+
+  if (!(t->t_module->m_flags & IDSA_MODULE_F_PURE)) {
+    return -1;
+  }
+
+  for (i = 0; i < f->i_have; i++) {
+    if (f->i_test[i] == t) {
+      return f->i_value[i];
+    }
+  }
+
+  if (n->n_true == n->n_false) {	/* outcome makes no difference */
+    return 1;
+  }
+
+  return -1;
+}
+
+static void idsa_optimize_learn(IDSA_NODE_INFO * f, IDSA_RULE_TEST * t, int v)
+{
+  int i;
+
+  if (!(t->t_module->m_flags & IDSA_MODULE_F_PURE)) {
+    return;
+  }
+
+  if (f->i_have >= IDSA_OPTIMIZE_FACTS) {
+    for (i = 1; i < f->i_have; i++) {
+      f->i_test[i - 1] = f->i_test[i];
+      f->i_value[i - 1] = f->i_value[i];
+    }
+    f->i_have--;
+  }
+
+  f->i_test[f->i_have] = t;
+  f->i_value[f->i_have] = v;
+  f->i_have++;
+}
+
+/****************************************************************************/
+/* Does       : keeps only those facts of target t which also are in f      */
+
+static void idsa_optimize_meet(IDSA_NODE_INFO * t, IDSA_NODE_INFO * f)
+{
+  int i, j, k;
+
+  if (t->i_reached == 0) {
+    t->i_reached = 1;
+    t->i_have = f->i_have;
+    for (i = 0; i < f->i_have; i++) {
+      t->i_test[i] = f->i_test[i];
+      t->i_value[i] = f->i_value[i];
+    }
+    return;
+  }
+
+  k = 0;
+  for (i = 0; i < t->i_have; i++) {
+    for (j = 0; (j < f->i_have) && (f->i_test[j] != t->i_test[i]); j++);
+    if ((j < f->i_have) && (f->i_value[j] == t->i_value[i])) {
+      t->i_test[k] = t->i_test[i];
+      t->i_value[k] = t->i_value[i];
+      k++;
+    }
+  }
+  t->i_have = k;
+}
+
+/****************************************************************************/
+/* Does       : follows n for as long as the outcome of nodes is known      */
+/* Returns    : first node which has to be evaluated, NULL if none          */
+
+static IDSA_RULE_NODE *idsa_optimize_skip(IDSA_RULE_CHAIN * c, IDSA_NODE_INFO * f, IDSA_RULE_NODE * n)
+{
+  int v;
+
+  while (n) {
+    if (!idsa_optimize_quiet(n)) {
+      return n;
+    }
+    if (n->n_test == NULL) {	/* nothing to do and nowhere to go */
+      return NULL;
+    }
+    v = idsa_optimize_known(c, f, n);
+    if (v < 0) {
+      return n;
+    }
+    n = v ? n->n_true : n->n_false;
+  }
+
+  return NULL;
+}
+
+/****************************************************************************/
+/* Does       : collects every node of c in s, numbering them in n_mark     */
+/* Returns    : zero on success, nonzero otherwise                          */
+
+static int idsa_optimize_collect(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * s, IDSA_NODE_SET * w)
+{
+  IDSA_RULE_NODE *n;
+
+  if (c->c_nodes == NULL) {
+    return 0;
+  }
+
+  c->c_nodes->n_mark = 0;
+  idsa_push_set(c, s, c->c_nodes);
+  idsa_push_set(c, w, c->c_nodes);
+
+  while ((n = idsa_pop_set(c, w)) != NULL) {
+    if (n->n_true && (n->n_true->n_mark < 0)) {
+      n->n_true->n_mark = s->n_used;
+      idsa_push_set(c, s, n->n_true);
+      idsa_push_set(c, w, n->n_true);
+    }
+    if (n->n_false && (n->n_false->n_mark < 0)) {
+      n->n_false->n_mark = s->n_used;
+      idsa_push_set(c, s, n->n_false);
+      idsa_push_set(c, w, n->n_false);
+    }
+  }
+
+  return c->c_error;
+}
+
+/****************************************************************************/
+/* Does       : visits the nodes of s parents first, redirecting branches   */
+/*              past nodes with a known outcome. Leaves the order in o      */
+
+static void idsa_optimize_forward(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * s, IDSA_NODE_INFO * info, IDSA_NODE_SET * o, IDSA_NODE_SET * w)
+{
+  IDSA_RULE_NODE *n, *m, *t;
+  IDSA_NODE_INFO f;
+  int i, b;
+
+  for (i = 0; i < s->n_used; i++) {
+    for (b = 0; b < 2; b++) {
+      m = idsa_optimize_next(s->n_array[i], b);
+      if (m) {
+	info[m->n_mark].i_pending++;
+      }
+    }
+  }
+
+  for (i = 0; i < s->n_used; i++) {
+    if (info[i].i_pending == 0) {
+      idsa_push_set(c, w, s->n_array[i]);
+    }
+  }
+
+  while ((n = idsa_pop_set(c, w)) != NULL) {
+    idsa_push_set(c, o, n);
+
+    for (b = 0; b < 2; b++) {
+      m = idsa_optimize_next(n, b);
+      if (m == NULL) {
+	continue;
+      }
+
+      if (info[n->n_mark].i_reached) {
+	f.i_have = 0;
+	if (idsa_optimize_harmless(n)) {
+	  f = info[n->n_mark];
+	}
+	idsa_optimize_learn(&f, n->n_test, b);
+
+	t = idsa_optimize_skip(c, &f, m);
+	idsa_optimize_link(n, b, t);
+	if (t) {
+	  idsa_optimize_meet(&(info[t->n_mark]), &f);
+	}
+      }
+
+      info[m->n_mark].i_pending--;
+      if (info[m->n_mark].i_pending == 0) {
+	idsa_push_set(c, w, m);
+      }
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : visits the nodes of o children first, merging nodes without */
+/*              body which test the same and go to the same places          */
+
+static int idsa_optimize_merge(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * o, IDSA_NODE_INFO * info)
+{
+  IDSA_RULE_NODE **table, *n, *m;
+  unsigned long h;
+  int size, i, b;
+
+  for (size = 16; size < 2 * o->n_used; size *= 2);
+
+  table = malloc(sizeof(IDSA_RULE_NODE *) * size);
+  if (table == NULL) {
+    idsa_chain_error_malloc(c, sizeof(IDSA_RULE_NODE *) * size);
+    return 1;
+  }
+  for (i = 0; i < size; i++) {
+    table[i] = NULL;
+  }
+
+  for (i = o->n_used - 1; i >= 0; i--) {
+    n = o->n_array[i];
+    info[n->n_mark].i_same = n;
+    if (!info[n->n_mark].i_reached) {
+      continue;
+    }
+
+    for (b = 0; b < 2; b++) {
+      m = idsa_optimize_next(n, b);
+      if (m) {
+	idsa_optimize_link(n, b, info[m->n_mark].i_same);
+      }
+    }
+
+    if ((n->n_body != NULL) || (n->n_test == NULL)) {
+      continue;
+    }
+
+    h = (((unsigned long) n->n_test) * 31 + ((unsigned long) n->n_true)) * 31 + ((unsigned long) n->n_false);
+    h = (h >> 4) ^ (h >> 13);
+    for (h = h % size; (m = table[h]) != NULL; h = (h + 1) % size) {
+      if ((m->n_test == n->n_test) && (m->n_true == n->n_true) && (m->n_false == n->n_false)) {
+	info[n->n_mark].i_same = m;
+	break;
+      }
+    }
+    if (m == NULL) {
+      table[h] = n;
+    }
+  }
+
+  free(table);
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : frees the nodes of s which c_nodes no longer leads to and   */
+/*              counts those left                                           */
+
+static void idsa_optimize_prune(IDSA_RULE_CHAIN * c, IDSA_NODE_SET * s, IDSA_NODE_INFO * info, IDSA_NODE_SET * w)
+{
+  IDSA_RULE_NODE *n, *m;
+  int i, b;
+
+  for (i = 0; i < s->n_used; i++) {
+    info[i].i_reached = 0;
+  }
+
+  if (c->c_nodes) {
+    info[c->c_nodes->n_mark].i_reached = 1;
+    idsa_push_set(c, w, c->c_nodes);
+  }
+  while ((n = idsa_pop_set(c, w)) != NULL) {
+    for (b = 0; b < 2; b++) {
+      m = idsa_optimize_next(n, b);
+      if (m && !info[m->n_mark].i_reached) {
+	info[m->n_mark].i_reached = 1;
+	idsa_push_set(c, w, m);
+      }
+    }
+  }
+
+  /* first cut all branches which are never taken, so counts are right */
+  c->c_optimalnodes = 0;
+  c->c_optimaltests = 0;
+  for (i = 0; i < s->n_used; i++) {
+    n = s->n_array[i];
+    if (!info[i].i_reached || (n->n_test == NULL)) {
+      idsa_optimize_link(n, 0, NULL);
+      idsa_optimize_link(n, 1, NULL);
+    }
+    if (info[i].i_reached) {
+      c->c_optimalnodes++;
+      if (n->n_test) {
+	c->c_optimaltests++;
+      }
+    }
+  }
+
+  for (i = 0; i < s->n_used; i++) {
+    n = s->n_array[i];
+    n->n_mark = (-1);
+    if (!info[i].i_reached) {
+#ifdef DEBUG
+      if (n->n_count) {
+	fprintf(stderr, "idsa_optimize_prune(): assertion failure, node %p still has count %d\n", n, n->n_count);
+	exit(1);
+      }
+#endif
+      idsa_node_free(c, n);
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : simplifies the node graph of c, see top of file             */
+/* Returns    : zero on success, nonzero otherwise                          */
+/* Errors     : c->c_error set on failure, c is left intact                 */
+/* Notes      : has to be called before idsa_chain_compile. Records the     */
+/*              size of the graph before and after in c_parsed* and         */
+/*              c_optimal*, counting nodes and the tests they carry         */
+
+int idsa_chain_optimize(IDSA_RULE_CHAIN * c)
+{
+  IDSA_NODE_SET *all, *work, *order;
+  IDSA_NODE_INFO *info;
+  int i;
+
+  all = idsa_new_set(c);
+  work = idsa_new_set(c);
+  order = idsa_new_set(c);
+  info = NULL;
+
+  if (all && work && order && (idsa_optimize_collect(c, all, work) == 0)) {
+    info = malloc(sizeof(IDSA_NODE_INFO) * (all->n_used + 1));
+    if (info == NULL) {
+      idsa_chain_error_malloc(c, sizeof(IDSA_NODE_INFO) * (all->n_used + 1));
+    }
+  }
+
+  if (info == NULL) {
+    if (all) {
+      for (i = 0; i < all->n_used; i++) {
+	all->n_array[i]->n_mark = (-1);
+      }
+    }
+    idsa_free_set(c, all);
+    idsa_free_set(c, work);
+    idsa_free_set(c, order);
+    return 1;
+  }
+
+  c->c_parsednodes = all->n_used;
+  c->c_parsedtests = 0;
+  for (i = 0; i < all->n_used; i++) {
+    info[i].i_pending = 0;
+    info[i].i_reached = 0;
+    info[i].i_have = 0;
+    info[i].i_same = NULL;
+    if (all->n_array[i]->n_test) {
+      c->c_parsedtests++;
+    }
+  }
+
+  /* the root can be skipped as well */
+  if (c->c_nodes) {
+    c->c_nodes = idsa_optimize_skip(c, &(info[c->c_nodes->n_mark]), c->c_nodes);
+    if (c->c_nodes) {
+      info[c->c_nodes->n_mark].i_reached = 1;
+    }
+  }
+
+  idsa_optimize_forward(c, all, info, order, work);
+  idsa_clear_set(c, work);
+
+  if (c->c_error == 0) {
+    idsa_optimize_merge(c, order, info);
+  }
+
+  idsa_optimize_prune(c, all, info, work);
+
+#ifdef DEBUG
+  fprintf(stderr, "idsa_chain_optimize(): nodes %d -> %d, tests %d -> %d\n", c->c_parsednodes, c->c_optimalnodes, c->c_parsedtests, c->c_optimaltests);
+#endif
+
+  free(info);
+  idsa_free_set(c, all);
+  idsa_free_set(c, work);
+  idsa_free_set(c, order);
+
+  return c->c_error;
+}
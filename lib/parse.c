@@ -97,7 +97,7 @@ IDSA_RULE_CHAIN *idsa_parse_buffer(IDSA_EVENT * e, char *buffer, int len, int fl
 
 /****************************************************************************/
 /* Does       : The overall parsing, called by parse_{file,fd,buffer}       */
-/* Parameters : m - token stream, flags - parse options                     */
+/* Parameters : m - token stream, flags - parse options, IDSA_CHAIN_F_*    */
 /* Returns    : rule chain which can be used to test events                 */
 /* Errors     :                                                             */
 /* Notes      :                                                             */
@@ -175,8 +175,6 @@ static IDSA_RULE_CHAIN *idsa_parse_chain(IDSA_EVENT * e, IDSA_MEX_STATE * m, int
   idsa_parse_dump(c->c_nodes, stderr, 0);
 #endif
 
-  /* FIXME: optimize */
-
   /* check for unused tokens */
   token = idsa_mex_peek(m);
   if (token) {
@@ -189,6 +187,13 @@ static IDSA_RULE_CHAIN *idsa_parse_chain(IDSA_EVENT * e, IDSA_MEX_STATE * m, int
     idsa_chain_error_mex(c, m);
   }
 
+  if ((idsa_chain_failure(c) == 0) && !(flags & (IDSA_CHAIN_F_GRAPH | IDSA_CHAIN_F_ASIS))) {
+    idsa_chain_optimize(c);
+  }
+  if ((idsa_chain_failure(c) == 0) && !(flags & IDSA_CHAIN_F_GRAPH)) {
+    idsa_chain_compile(c);
+  }
+
   if (idsa_chain_failure(c)) {
     idsa_chain_stop(c);
     return NULL;
@@ -54,7 +54,10 @@ static struct idsa_reserved idsa_res_tab[IDSA_M_RESERVED] = {
   [IDSA_O_BOTHFILE] = {"bothfile", IDSA_T_FILE, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN},
   [IDSA_O_SLEEP] = {"sleep", IDSA_T_INT, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN},
   [IDSA_O_STOP] = {"stop", IDSA_T_FLAG, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN},
-  [IDSA_O_ENV] = {"env", IDSA_T_STRING, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN}
+  [IDSA_O_ENV] = {"env", IDSA_T_STRING, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN},
+  [IDSA_O_CACHE] = {"cache", IDSA_T_INT, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN},
+  [IDSA_O_CACHEKEY] = {"cachekey", IDSA_T_STRING, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN},
+  [IDSA_O_GENERATION] = {"generation", IDSA_T_INT, IDSA_M_UNKNOWN, IDSA_M_UNKNOWN}
 };
 
 /* reverse lookups */
@@ -238,23 +241,20 @@ int idsa_reply_init(IDSA_EVENT * e)
 }
 
 /****************************************************************************/
+/* Notes      : only compares declared types, values idsad has yet to scan  */
+/*              stay text until a rule asks for them                        */
 
 static int idsa_any_check(IDSA_EVENT * event, unsigned int *table, unsigned int size)
 {
-  IDSA_UNIT *u;
-  unsigned int i, j;
+  unsigned int i, j, t;
 
   for (i = 0; i < size; i++) {
     j = table[i];
-    u = idsa_event_unitbynumber(event, i);
-    if (u) {
-      if (idsa_res_tab[j].r_type != idsa_unit_type(u)) {
+    t = idsa_event_unittype(event, i);
+    if (idsa_res_tab[j].r_type != t) {	/* IDSA_T_NULL if missing */
 #ifdef DEBUG
-	fprintf(stderr, "idsa_any_check(): unit[%d].type=%02x != table[%d]=%02x\n", i, idsa_unit_type(u), j, idsa_res_tab[j].r_type);
+      fprintf(stderr, "idsa_any_check(): unit[%d].type=%02x != table[%d]=%02x\n", i, t, j, idsa_res_tab[j].r_type);
 #endif
-	return 1;
-      }
-    } else {
       return 1;
     }
   }
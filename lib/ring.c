@@ -0,0 +1,184 @@
+/****************************************************************************/
+/*                                                                          */
+/*  Byte rings in memory shared by a client and idsad. Each direction has   */
+/*  one producer and one consumer, which only ever advance their own        */
+/*  counter, so no locks are needed. The messages carried are the same as   */
+/*  on the socket. The socket stays open: it tells idsad who the client is, */
+/*  when it goes away, and carries a byte whenever a side which has gone    */
+/*  to sleep needs to be woken                                              */
+/*                                                                          */
+/****************************************************************************/
+
+#include <string.h>
+
+#include <idsa_internal.h>
+
+#ifdef __GNUC__
+#define idsa_ring_barrier()     __sync_synchronize()
+#define idsa_ring_clear(p)      __sync_lock_test_and_set((p), 0)
+#else
+#define idsa_ring_barrier()
+#define idsa_ring_clear(p)      idsa_ring_swap(p)
+static int idsa_ring_swap(volatile int *p)
+{
+  int old;
+
+  old = *p;
+  *p = 0;
+
+  return old;
+}
+#endif
+
+/****************************************************************************/
+/* Does       : sets up both directions empty, with nobody asleep           */
+
+void idsa_ring_init(IDSA_RING * r)
+{
+  r->r_request.h_head = 0;
+  r->r_request.h_tail = 0;
+  r->r_request.h_waiting = 0;
+  r->r_request.h_full = 0;
+
+  r->r_reply.h_head = 0;
+  r->r_reply.h_tail = 0;
+  r->r_reply.h_waiting = 0;
+  r->r_reply.h_full = 0;
+
+  r->r_generation = 0;
+}
+
+/****************************************************************************/
+/* Returns    : bytes waiting to be consumed, -1 if the counters are bogus  */
+/* Notes      : the other side may scribble over the counters, so they are  */
+/*              checked each time                                           */
+
+int idsa_ring_used(IDSA_RING_HALF * h)
+{
+  unsigned int used;
+
+  used = h->h_head - h->h_tail;
+  if (used > IDSA_RING_SIZE) {
+    return -1;
+  }
+
+  return used;
+}
+
+/****************************************************************************/
+/* Does       : appends as much of s as fits                                */
+/* Returns    : bytes appended, zero if full, -1 if the ring is corrupt     */
+
+int idsa_ring_put(IDSA_RING_HALF * h, char *s, int l)
+{
+  unsigned int head, used, at, first;
+
+  head = h->h_head;
+  used = head - h->h_tail;
+  if (used > IDSA_RING_SIZE) {
+    return -1;
+  }
+
+  if (l > IDSA_RING_SIZE - used) {
+    l = IDSA_RING_SIZE - used;
+  }
+  if (l <= 0) {
+    return 0;
+  }
+
+  at = head % IDSA_RING_SIZE;
+  first = IDSA_RING_SIZE - at;
+  if (first > l) {
+    first = l;
+  }
+  memcpy(h->h_data + at, s, first);
+  memcpy(h->h_data, s + first, l - first);
+
+  /* data has to be there before the consumer sees the new head */
+  idsa_ring_barrier();
+  h->h_head = head + l;
+
+  return l;
+}
+
+/****************************************************************************/
+/* Does       : copies up to l bytes out of the ring into s                 */
+/* Returns    : bytes copied, zero if empty, -1 if the ring is corrupt      */
+
+int idsa_ring_get(IDSA_RING_HALF * h, char *s, int l)
+{
+  unsigned int tail, used, at, first;
+
+  tail = h->h_tail;
+  used = h->h_head - tail;
+  if (used > IDSA_RING_SIZE) {
+    return -1;
+  }
+
+  /* head read before the data it covers */
+  idsa_ring_barrier();
+
+  if (l > used) {
+    l = used;
+  }
+  if (l <= 0) {
+    return 0;
+  }
+
+  at = tail % IDSA_RING_SIZE;
+  first = IDSA_RING_SIZE - at;
+  if (first > l) {
+    first = l;
+  }
+  memcpy(s, h->h_data + at, first);
+  memcpy(s + first, h->h_data, l - first);
+
+  /* done copying before the producer may overwrite it */
+  idsa_ring_barrier();
+  h->h_tail = tail + l;
+
+  return l;
+}
+
+/****************************************************************************/
+/* Does       : announces that the caller is about to sleep, the producer   */
+/*              until there is room, the consumer until there is data       */
+/* Returns    : nonzero if it should not, because things changed meanwhile  */
+/* Notes      : flag first, then look again. The other side changes the     */
+/*              counter first, then looks at the flag, see idsa_ring_wake.  */
+/*              So at least one of the two notices the other                */
+
+int idsa_ring_sleep(IDSA_RING_HALF * h, int producer)
+{
+  volatile int *flag;
+  int used;
+
+  flag = producer ? &(h->h_full) : &(h->h_waiting);
+
+  *flag = 1;
+  idsa_ring_barrier();
+
+  used = idsa_ring_used(h);
+  if ((used < 0) || (producer ? (used < IDSA_RING_SIZE) : (used > 0))) {
+    *flag = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : checks if the other side sleeps, after the caller has made  */
+/*              progress (put data if producer, taken it if consumer)       */
+/* Returns    : nonzero if it has to be notified, which the caller does     */
+
+int idsa_ring_wake(IDSA_RING_HALF * h, int producer)
+{
+  idsa_ring_barrier();
+
+  if (producer) {
+    return h->h_waiting ? idsa_ring_clear(&(h->h_waiting)) : 0;
+  } else {
+    return h->h_full ? idsa_ring_clear(&(h->h_full)) : 0;
+  }
+}
@@ -4,65 +4,243 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <time.h>
 
 #include <idsa_internal.h>
 
+#define IDSA_LOCAL_TIME  0x01
+#define IDSA_LOCAL_CLOCK 0x02
+
 int idsa_chain_run(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l)
 {
-  int result;
-  IDSA_RULE_NODE *node;
-  IDSA_RULE_BODY *body;
+  int result, test, resume;
+  int step;
+  IDSA_RULE_STEP *s;
   IDSA_RULE_ACTION *action;
   int i;
 
-  result = IDSA_CHAIN_OK;
-  node = l->l_node;
+  result = l->l_result;
+  step = l->l_step;
+
+  /* resuming a suspended test: the body of its step has been done */
+  resume = l->l_pending;
+  l->l_pending = 0;
 
 #ifdef DEBUG
-  fprintf(stderr, "idsa_chain_run(): root=%p\n", node);
+  fprintf(stderr, "idsa_chain_run(): step=%d, resume=%d\n", step, resume);
 #endif
 
-  /* later this loop might have to be split for interleaving of requests */
-  while (node) {
+  while ((step >= 0) && !(l->l_request->e_fault)) {
+    s = &(c->c_steps[step]);
 #ifdef DEBUG
-    fprintf(stderr, "idsa_chain_run(): considering node %p: count=%d\n", node, node->n_count);
+    fprintf(stderr, "idsa_chain_run(): considering step %d: actions=%d\n", step, s->s_have);
 #endif
-    if (node->n_body) {
-      body = node->n_body;
-      if (body->b_drop) {
+    if (!resume) {
+      if (s->s_drop) {
 	/* mumble, could be made part of the reply */
 	result = IDSA_CHAIN_DROP;
       }
-      if (body->b_deny) {
+      if (s->s_deny) {
 	idsa_reply_deny(l->l_reply);
       }
-      for (i = 0; i < body->b_have; i++) {
-	action = body->b_array[i];
-	idsa_module_do_action(c, action, l->l_request, l->l_reply);
+      for (i = 0; i < s->s_have; i++) {
+	action = &(s->s_array[i]);
+	if (c->c_defer && (action->a_module->m_flags & IDSA_MODULE_F_DEFER) && ((*c->c_defer) (c->c_deferstate, c, l, action) == 0)) {
+	  continue;
+	}
+	idsa_module_do_action(c, l, action, l->l_request, l->l_reply);
       }
     }
-    if (node->n_test) {
-      if (idsa_module_do_test(c, node->n_test, l->l_request)) {
-	node = node->n_true;
+    resume = 0;
+    if (l->l_request->e_fault) {	/* an action found a value which does not scan */
+      break;
+    }
+    if (s->s_test.t_module) {
+      test = idsa_module_do_test(c, l, &(s->s_test), l->l_request);
+      if (test == IDSA_MODULE_PENDING) {
+	if ((l->l_flags & IDSA_LOCAL_F_SUSPEND) && !(l->l_flags & IDSA_LOCAL_F_EXPIRED)) {
 #ifdef DEBUG
-	fprintf(stderr, "idsa_chain_run(): taking true branch to %p\n", node);
+	  fprintf(stderr, "idsa_chain_run(): suspending at step %d\n", step);
 #endif
-      } else {
-	node = node->n_false;
+	  l->l_step = step;
+	  l->l_pending = 1;
+	  l->l_result = result;
+	  return IDSA_CHAIN_AGAIN;
+	}
+	test = 0;		/* nobody to resume it, or had its chance */
+      }
+      l->l_flags &= ~IDSA_LOCAL_F_EXPIRED;
+      step = test ? s->s_true : s->s_false;
 #ifdef DEBUG
-	fprintf(stderr, "idsa_chain_run(): taking false branch to %p\n", node);
+      fprintf(stderr, "idsa_chain_run(): taking %s branch to %d\n", test ? "true" : "false", step);
 #endif
-      }
     } else {
-      node = NULL;
+      step = (-1);
     }
   }
 
-  l->l_node = NULL;
+  if (l->l_request->e_fault) {	/* nothing more to be done for this client */
+    result = IDSA_CHAIN_DROP;
+  }
+
+  l->l_step = (-1);
+  l->l_result = result;
 
   return result;
 }
 
+/****************************************************************************/
+/* Returns    : nonzero if evaluation may as well stop before n             */
+
+static int idsa_chain_idle(IDSA_RULE_NODE * n)
+{
+  IDSA_RULE_BODY *b;
+
+  if (n->n_test) {
+    return 0;
+  }
+
+  b = n->n_body;
+
+  return (b == NULL) || ((b->b_have == 0) && (b->b_deny == 0) && (b->b_drop == 0));
+}
+
+static int idsa_chain_target(IDSA_RULE_NODE * n)
+{
+  if ((n == NULL) || idsa_chain_idle(n)) {
+    return -1;
+  }
+
+  return n->n_index;
+}
+
+/****************************************************************************/
+/* Does       : turns the node graph of c into c_steps, a single array in   */
+/*              which the false branch of a step usually is the next one.   */
+/*              Each step holds copies of its test and actions, the latter  */
+/*              stored after all steps in the same order, so that a pass    */
+/*              along the chain reads memory mostly front to back. The      */
+/*              node graph is freed                                         */
+/* Returns    : zero on success, nonzero otherwise                          */
+/* Errors     : c->c_error set on failure                                   */
+/* Notes      : tests and actions remain owned by c_tests and c_actions, a  */
+/*              copy only borrows their state                               */
+
+int idsa_chain_compile(IDSA_RULE_CHAIN * c)
+{
+  IDSA_RULE_NODE **order, **stack, *n;
+  IDSA_RULE_STEP *steps, *s;
+  IDSA_RULE_ACTION *flat;
+  IDSA_RULE_BODY *b;
+  int count, actions, used, i, j;
+  size_t size;
+
+  /* every node is placed once and pushes at most its two branches */
+  order = malloc(sizeof(IDSA_RULE_NODE *) * (c->c_nodecount + 1));
+  stack = malloc(sizeof(IDSA_RULE_NODE *) * (2 * c->c_nodecount + 1));
+  if ((order == NULL) || (stack == NULL)) {
+    if (order) {
+      free(order);
+    }
+    if (stack) {
+      free(stack);
+    }
+    idsa_chain_error_malloc(c, sizeof(IDSA_RULE_NODE *) * (3 * c->c_nodecount + 2));
+    return 1;
+  }
+
+  count = 0;
+  actions = 0;
+  used = 0;
+
+  if (c->c_nodes && !idsa_chain_idle(c->c_nodes)) {
+    stack[used++] = c->c_nodes;
+  }
+
+  /* depth first, false branch on top so that it gets the next index */
+  while (used > 0) {
+    n = stack[--used];
+    if (n->n_index >= 0) {
+      continue;
+    }
+    n->n_index = count;
+    order[count++] = n;
+    if (n->n_body) {
+      actions += n->n_body->b_have;
+    }
+    if (n->n_test) {
+      if (n->n_true && (n->n_true->n_index < 0) && !idsa_chain_idle(n->n_true)) {
+	stack[used++] = n->n_true;
+      }
+      if (n->n_false && (n->n_false->n_index < 0) && !idsa_chain_idle(n->n_false)) {
+	stack[used++] = n->n_false;
+      }
+    }
+  }
+
+  size = sizeof(IDSA_RULE_STEP) * count + sizeof(IDSA_RULE_ACTION) * actions;
+  steps = NULL;
+  if (size > 0) {
+    steps = malloc(size);
+    if (steps == NULL) {
+      free(order);
+      free(stack);
+      idsa_chain_error_malloc(c, size);
+      return 1;
+    }
+  }
+  flat = (IDSA_RULE_ACTION *) (steps + count);
+
+  for (i = 0; i < count; i++) {
+    n = order[i];
+    s = &(steps[i]);
+
+    if (n->n_test) {
+      s->s_test = *(n->n_test);
+      s->s_test.t_next = NULL;
+      s->s_true = idsa_chain_target(n->n_true);
+      s->s_false = idsa_chain_target(n->n_false);
+    } else {
+      s->s_test.t_module = NULL;
+      s->s_test.t_next = NULL;
+      s->s_test.t_state = NULL;
+      s->s_true = (-1);
+      s->s_false = (-1);
+    }
+
+    b = n->n_body;
+    s->s_array = flat;
+    s->s_have = 0;
+    s->s_deny = 0;
+    s->s_drop = 0;
+    if (b) {
+      for (j = 0; j < b->b_have; j++) {
+	flat[j] = *(b->b_array[j]);
+	flat[j].a_next = NULL;
+      }
+      flat += b->b_have;
+      s->s_have = b->b_have;
+      s->s_deny = b->b_deny;
+      s->s_drop = b->b_drop;
+    }
+  }
+
+  free(order);
+  free(stack);
+
+#ifdef DEBUG
+  fprintf(stderr, "idsa_chain_compile(): %d nodes, %d steps, %d actions\n", c->c_nodecount, count, actions);
+#endif
+
+  idsa_node_free(c, c->c_nodes);
+  c->c_nodes = NULL;
+
+  c->c_steps = steps;
+  c->c_stepcount = count;
+
+  return 0;
+}
+
 IDSA_RULE_CHAIN *idsa_chain_start(IDSA_EVENT * e, int flags)
 {
   IDSA_RULE_CHAIN *result;
@@ -89,6 +267,12 @@ int idsa_chain_stop(IDSA_RULE_CHAIN * c)
   if (c) {
 
     idsa_node_free(c, c->c_nodes);
+    c->c_nodes = NULL;
+
+    if (c->c_steps) {
+      free(c->c_steps);
+      c->c_steps = NULL;
+    }
 
     /* clear out tests */
     ti = c->c_tests;
@@ -147,16 +331,23 @@ IDSA_RULE_CHAIN *idsa_chain_new()
   result = malloc(sizeof(IDSA_RULE_CHAIN));
   if (result) {
     result->c_nodes = NULL;
+    result->c_steps = NULL;
     result->c_tests = NULL;
     result->c_actions = NULL;
     result->c_modules = NULL;
 
     result->c_nodecount = 0;
+    result->c_stepcount = 0;
     result->c_testcount = 0;
     result->c_actioncount = 0;
     result->c_modulecount = 0;
     result->c_rulecount = 0;
 
+    result->c_parsednodes = 0;
+    result->c_parsedtests = 0;
+    result->c_optimalnodes = 0;
+    result->c_optimaltests = 0;
+
     result->c_flags = 0;
 
     result->c_fresh = 0;
@@ -164,11 +355,61 @@ IDSA_RULE_CHAIN *idsa_chain_new()
     result->c_event = NULL;
 
     result->c_chain = NULL;
+
+    result->c_lock = NULL;
+    result->c_unlock = NULL;
+    result->c_lockstate = NULL;
+
+    result->c_defer = NULL;
+    result->c_deferstate = NULL;
   }
 
   return result;
 }
 
+/****************************************************************************/
+/* Does       : makes chain safe for evaluation by several threads. Modules */
+/*              without IDSA_MODULE_F_CONCURRENT are called with lock held  */
+/*              on their m_lock, error reports lock with NULL               */
+/* Notes      : caller has to set m_lock of all modules before first use,   */
+/*              a module may report errors while holding its own lock       */
+
+void idsa_chain_serialize(IDSA_RULE_CHAIN * c, IDSA_CHAIN_LOCK lock, IDSA_CHAIN_LOCK unlock, void *s)
+{
+  c->c_lock = lock;
+  c->c_unlock = unlock;
+  c->c_lockstate = s;
+}
+
+/****************************************************************************/
+/* Does       : lets d run actions of modules with IDSA_MODULE_F_DEFER in   */
+/*              place of idsa_chain_run, typically by copying l_request and */
+/*              l_reply and calling idsa_module_do_action later             */
+/* Notes      : d may be called by several threads if c is serialized. It   */
+/*              has to be done with c before c is stopped                   */
+
+void idsa_chain_defer(IDSA_RULE_CHAIN * c, IDSA_CHAIN_DEFER d, void *s)
+{
+  c->c_defer = d;
+  c->c_deferstate = s;
+}
+
+/****************************************************************************/
+/* Does       : hands state worth keeping from older chain o to chain c,    */
+/*              for use when a rule set is replaced by a freshly parsed one */
+/* Returns    : number of modules which took over state                     */
+/* Notes      : neither chain may be evaluated at the same time. Afterwards */
+/*              o should only be stopped                                    */
+
+int idsa_chain_carry(IDSA_RULE_CHAIN * c, IDSA_RULE_CHAIN * o)
+{
+  if ((c == NULL) || (o == NULL)) {
+    return 0;
+  }
+
+  return idsa_module_carry_global(c, o);
+}
+
 int idsa_chain_failure(IDSA_RULE_CHAIN * c)
 {
   return c->c_error;
@@ -211,6 +452,18 @@ void idsa_chain_setname(IDSA_RULE_CHAIN * c, char *name)
   c->c_chain = name;
 }
 
+/****************************************************************************/
+/* Does       : directs subsequent error reports of c to e                  */
+
+void idsa_chain_setevent(IDSA_RULE_CHAIN * c, IDSA_EVENT * e)
+{
+  if (c == NULL) {
+    return;
+  }
+
+  c->c_event = e;
+}
+
 IDSA_RULE_ACTION *idsa_action_new(IDSA_RULE_CHAIN * c)
 {
   IDSA_RULE_ACTION *result;
@@ -348,6 +601,8 @@ IDSA_RULE_NODE *idsa_node_new(IDSA_RULE_CHAIN * c)
     result->n_body = NULL;
 
     result->n_count = 0;
+    result->n_index = (-1);
+    result->n_mark = (-1);
   } else {
     idsa_chain_error_malloc(c, sizeof(IDSA_RULE_NODE));
   }
@@ -466,6 +721,11 @@ IDSA_MODULE *idsa_module_new_version(IDSA_RULE_CHAIN * c, char *name, int ver)
     result->action_do = NULL;
     result->action_stop = NULL;
 
+    result->m_flags = 0;
+    result->m_lock = NULL;
+
+    result->global_carry = NULL;
+
   } else {
     idsa_chain_error_malloc(c, sizeof(IDSA_MODULE));
   }
@@ -489,11 +749,17 @@ IDSA_RULE_LOCAL *idsa_local_new(IDSA_RULE_CHAIN * c)
   result = malloc(sizeof(IDSA_RULE_LOCAL));
   if (result) {
     result->l_result = IDSA_CHAIN_OK;
+    result->l_clocks = 0;
+    result->l_flags = 0;
+    result->l_pending = 0;
+    result->l_waitfd = (-1);
+    result->l_waitmask = 0;
+    result->l_waitms = (-1);
 
     result->l_request = NULL;
     result->l_reply = NULL;
 
-    result->l_node = c->c_nodes;
+    result->l_step = c->c_stepcount ? 0 : (-1);
   } else {
     idsa_chain_error_malloc(c, sizeof(IDSA_RULE_LOCAL));
   }
@@ -509,10 +775,16 @@ void idsa_local_free(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l)
 
 int idsa_local_init(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_EVENT * q, IDSA_EVENT * p)
 {
-  l->l_node = c->c_nodes;
+  l->l_step = c->c_stepcount ? 0 : (-1);
   l->l_request = q;
   l->l_reply = p;
   l->l_result = IDSA_CHAIN_OK;
+  l->l_clocks = 0;
+  l->l_flags = 0;
+  l->l_pending = 0;
+  l->l_waitfd = (-1);
+  l->l_waitmask = 0;
+  l->l_waitms = (-1);
 
   return 0;
 }
@@ -521,9 +793,397 @@ int idsa_local_quit(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l)
 {
 
   /* currently do nothing, later if traversals are interleaved unlock nodes */
-  l->l_node = c->c_nodes;
+  l->l_step = c->c_stepcount ? 0 : (-1);
   l->l_request = NULL;
   l->l_reply = NULL;
 
   return 0;
 }
+
+/****************************************************************************/
+/* Notes      : modules take the time from the evaluation rather than the   */
+/*              system, so every test and action of one evaluation agrees   */
+/*              on it and the clock is read at most once. Callers which     */
+/*              have already read it, like idsad, hand it in after          */
+/*              idsa_local_init                                             */
+
+void idsa_local_settime(IDSA_RULE_LOCAL * l, time_t wall, time_t mono)
+{
+  l->l_time = wall;
+  l->l_clock = mono;
+  l->l_clocks = IDSA_LOCAL_TIME | IDSA_LOCAL_CLOCK;
+}
+
+time_t idsa_local_time(IDSA_RULE_LOCAL * l)
+{
+  if (!(l->l_clocks & IDSA_LOCAL_TIME)) {
+    l->l_time = time(NULL);
+    l->l_clocks |= IDSA_LOCAL_TIME;
+  }
+
+  return l->l_time;
+}
+
+time_t idsa_local_clock(IDSA_RULE_LOCAL * l)
+{
+  if (!(l->l_clocks & IDSA_LOCAL_CLOCK)) {
+    l->l_clock = idsa_monotonic();
+    l->l_clocks |= IDSA_LOCAL_CLOCK;
+  }
+
+  return l->l_clock;
+}
+
+/****************************************************************************/
+/* Notes      : a test which has to wait for something may, if the caller   */
+/*              permits it, return IDSA_MODULE_PENDING by way of            */
+/*              idsa_local_wait. idsa_chain_run then returns                */
+/*              IDSA_CHAIN_AGAIN and keeps its place in l. Once fd is ready */
+/*              or ms have passed the caller runs l again, which repeats    */
+/*              the test without redoing anything before it. A test may not */
+/*              suspend again after idsa_local_expire, it has to decide     */
+
+void idsa_local_suspend(IDSA_RULE_LOCAL * l)
+{
+  l->l_flags |= IDSA_LOCAL_F_SUSPEND;
+}
+
+void idsa_local_expire(IDSA_RULE_LOCAL * l)
+{
+  l->l_flags |= IDSA_LOCAL_F_EXPIRED;
+}
+
+int idsa_local_cansuspend(IDSA_RULE_LOCAL * l)
+{
+  return (l->l_flags & IDSA_LOCAL_F_SUSPEND) && !(l->l_flags & IDSA_LOCAL_F_EXPIRED);
+}
+
+int idsa_local_expired(IDSA_RULE_LOCAL * l)
+{
+  return (l->l_flags & IDSA_LOCAL_F_EXPIRED) ? 1 : 0;
+}
+
+/****************************************************************************/
+/* Does       : records what a test is waiting for, fd may be -1 if it only */
+/*              waits for some other suspended evaluation to complete       */
+/* Returns    : IDSA_MODULE_PENDING, to be returned by test_do, or 0 if the */
+/*              caller is unable to suspend                                 */
+
+int idsa_local_wait(IDSA_RULE_LOCAL * l, int fd, int mask, int ms)
+{
+  if (!idsa_local_cansuspend(l)) {
+    return 0;
+  }
+
+  l->l_waitfd = fd;
+  l->l_waitmask = mask;
+  l->l_waitms = ms;
+
+  return IDSA_MODULE_PENDING;
+}
+
+/****************************************************************************/
+/* Returns    : seconds on a clock which is not affected by date changes,   */
+/*              falls back to wall time where there is no such thing        */
+
+time_t idsa_monotonic()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    return ts.tv_sec;
+  }
+#endif
+
+  return time(NULL);
+}
+
+#ifdef STANDALONE
+/* random rule sets, run as parsed, compiled and optimized, which have to */
+/* agree on every event. Needs the modules installed. Build in lib with   */
+/* gcc -O2 -DSTANDALONE -I../include rule.c -o rule -L. -lidsa            */
+
+#define ROUNDS 256
+#define RULES 24
+#define UNITS 6
+#define EVENTS 729		/* every unit missing, "0" or "1": 3^UNITS */
+#define HEADS 3
+#define MAX 65536
+#define TRACE 1024
+
+struct trace {
+  int t_have;
+  int t_array[TRACE];
+};
+
+static char *variant_name[] = { "graph", "compiled", "optimized" };
+static int variant_flags[] = { IDSA_CHAIN_F_GRAPH, IDSA_CHAIN_F_ASIS, 0 };
+
+#define VARIANTS ((int) (sizeof(variant_flags) / sizeof(int)))
+
+static char *rules;
+static int at;
+
+static void emit(char *fmt, int x, int y)
+{
+  if (at < MAX) {
+    at += snprintf(rules + at, MAX - at, fmt, x, y);
+  }
+}
+
+static void random_expr(int d);
+
+static void random_term(int d)
+{
+  int r;
+
+  r = rand() % 100;
+  if ((d < 3) && (r < 15)) {
+    emit("(", 0, 0);
+    random_expr(d + 1);
+    emit(")", 0, 0);
+  } else if (r < 30) {
+    emit("! ", 0, 0);
+    random_term(d + 1);
+  } else if (r < 38) {
+    emit("%%true", 0, 0);
+  } else if (r < 44) {
+    emit("%%exists a%d", rand() % (UNITS + 2), 0);
+  } else {
+    emit("a%d:string %d", rand() % UNITS, rand() % 2);
+  }
+}
+
+static void random_expr(int d)
+{
+  int i, j, n, m;
+
+  n = 1 + (rand() % 2);
+  for (i = 0; i < n; i++) {
+    if (i) {
+      emit(" | ", 0, 0);
+    }
+    m = 1 + (rand() % 3);
+    for (j = 0; j < m; j++) {
+      if (j) {
+	emit(" & ", 0, 0);
+      }
+      random_term(d);
+    }
+  }
+}
+
+/* a few heads shared by many rules, actions in any order */
+
+static void random_rules()
+{
+  char *action[5];
+  int head[HEADS][2];
+  int i, j, k, n;
+
+  for (i = 0; i < HEADS; i++) {
+    head[i][0] = rand() % UNITS;
+    head[i][1] = rand() % 2;
+  }
+
+  at = 0;
+  for (i = 0; i < RULES; i++) {
+    n = 0;
+    if ((rand() % 100) < 30) {
+      action[n++] = "deny";
+    }
+    if ((rand() % 100) < 5) {
+      action[n++] = "drop";
+    }
+    if ((rand() % 100) < 40) {
+      action[n++] = "continue";
+    }
+    if ((rand() % 100) < 90) {
+      action[n++] = "log file /dev/null, custom \"r%d^J\"";
+    }
+    if ((rand() % 100) < 30) {
+      action[n++] = "log file /dev/null, custom \"s%d^J\"";
+    }
+    if (n == 0) {
+      action[n++] = "allow";
+    }
+    for (j = n - 1; j > 0; j--) {
+      k = rand() % (j + 1);
+      action[5 - 1] = action[j];
+      action[j] = action[k];
+      action[k] = action[5 - 1];
+    }
+
+    if ((rand() % 100) < 70) {
+      k = rand() % HEADS;
+      emit("a%d:string %d & ", head[k][0], head[k][1]);
+    }
+    random_expr(0);
+    for (j = 0; j < n; j++) {
+      emit(j ? "; " : " : ", 0, 0);
+      emit(action[j], i, 0);
+    }
+    emit("\n", 0, 0);
+  }
+}
+
+/* units a0 to a(UNITS-1) missing, "0" or "1" following the digits of x */
+
+static void random_event(IDSA_EVENT * q, int x)
+{
+  char name[IDSA_M_NAME];
+  int i;
+
+  idsa_request_init(q, "rule", "check", "event");
+  for (i = 0; i < UNITS; i++) {
+    if (x % 3) {
+      sprintf(name, "a%d", i);
+      idsa_event_scanappend(q, name, IDSA_T_STRING, (x % 3 == 1) ? "0" : "1");
+    }
+    x /= 3;
+  }
+}
+
+/* records which action would have run, by its place in c_actions */
+
+static int trace_defer(void *s, IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_RULE_ACTION * a)
+{
+  struct trace *t;
+  IDSA_RULE_ACTION *ai;
+  int i;
+
+  t = s;
+  i = 0;
+  for (ai = c->c_actions; ai && (ai->a_state != a->a_state); ai = ai->a_next) {
+    i++;
+  }
+  if (t->t_have < TRACE) {
+    t->t_array[t->t_have++] = i;
+  }
+
+  return 0;
+}
+
+/* the node graph, walked as idsa_chain_run did before idsa_chain_compile */
+
+static int graph_run(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l)
+{
+  IDSA_RULE_NODE *node;
+  IDSA_RULE_BODY *body;
+  IDSA_RULE_ACTION *action;
+  int result, test, i;
+
+  result = IDSA_CHAIN_OK;
+  node = c->c_nodes;
+
+  while (node) {
+    body = node->n_body;
+    if (body) {
+      if (body->b_drop) {
+	result = IDSA_CHAIN_DROP;
+      }
+      if (body->b_deny) {
+	idsa_reply_deny(l->l_reply);
+      }
+      for (i = 0; i < body->b_have; i++) {
+	action = body->b_array[i];
+	if (c->c_defer && (action->a_module->m_flags & IDSA_MODULE_F_DEFER) && ((*c->c_defer) (c->c_deferstate, c, l, action) == 0)) {
+	  continue;
+	}
+	idsa_module_do_action(c, l, action, l->l_request, l->l_reply);
+      }
+    }
+    if (node->n_test) {
+      test = idsa_module_do_test(c, l, node->n_test, l->l_request);
+      node = (test > 0) ? node->n_true : node->n_false;
+    } else {
+      node = NULL;
+    }
+  }
+
+  return result;
+}
+
+static void show_trace(char *name, int result, int reply, struct trace *t)
+{
+  int i;
+
+  printf("%s: result=%d reply=%d actions", name, result, reply);
+  for (i = 0; i < t->t_have; i++) {
+    printf(" %d", t->t_array[i]);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  IDSA_RULE_CHAIN *c[VARIANTS];
+  IDSA_RULE_LOCAL *l[VARIANTS];
+  struct trace t[VARIANTS];
+  int result[VARIANTS], reply[VARIANTS];
+  IDSA_EVENT *e, *q, *p;
+  int i, j, k, seed;
+
+  seed = (argc > 1) ? atoi(argv[1]) : getpid();
+  srand(seed);
+  printf("seed %d\n", seed);
+
+  rules = malloc(MAX);
+  e = idsa_event_new(0);
+  q = idsa_event_new(0);
+  p = idsa_event_new(0);
+  if ((rules == NULL) || (e == NULL) || (q == NULL) || (p == NULL)) {
+    return 1;
+  }
+
+  for (i = 0; i < ROUNDS; i++) {
+    random_rules();
+    if (at >= MAX) {
+      printf("round %d: rules too long\n", i);
+      exit(1);
+    }
+
+    for (k = 0; k < VARIANTS; k++) {
+      c[k] = idsa_parse_buffer(e, rules, at, variant_flags[k]);
+      if (c[k] == NULL) {
+	printf("round %d: unable to parse %s\n%s", i, variant_name[k], rules);
+	idsa_event_dump(e, stdout);
+	exit(1);
+      }
+      idsa_chain_defer(c[k], &trace_defer, &(t[k]));
+      l[k] = idsa_local_new(c[k]);
+    }
+
+    for (j = 0; j < EVENTS; j++) {
+      random_event(q, j);
+      for (k = 0; k < VARIANTS; k++) {
+	t[k].t_have = 0;
+	idsa_reply_init(p);
+	idsa_local_init(c[k], l[k], q, p);
+	result[k] = (variant_flags[k] & IDSA_CHAIN_F_GRAPH) ? graph_run(c[k], l[k]) : idsa_chain_run(c[k], l[k]);
+	reply[k] = idsa_reply_result(p);
+	idsa_local_quit(c[k], l[k]);
+      }
+      for (k = 1; k < VARIANTS; k++) {
+	if ((result[k] != result[0]) || (reply[k] != reply[0]) || (t[k].t_have != t[0].t_have) || memcmp(t[k].t_array, t[0].t_array, sizeof(int) * t[0].t_have)) {
+	  printf("round %d: differences for event %d: ouch\a\n%s", i, j, rules);
+	  idsa_event_dump(q, stdout);
+	  show_trace(variant_name[0], result[0], reply[0], &(t[0]));
+	  show_trace(variant_name[k], result[k], reply[k], &(t[k]));
+	  exit(1);
+	}
+      }
+    }
+
+    printf("round %d: %d nodes, %d steps, optimized %d/%d tests, %d steps: ok\n", i, c[0]->c_nodecount, c[1]->c_stepcount, c[2]->c_optimaltests, c[2]->c_parsedtests, c[2]->c_stepcount);
+
+    for (k = 0; k < VARIANTS; k++) {
+      idsa_local_free(c[k], l[k]);
+      idsa_chain_stop(c[k]);
+    }
+  }
+
+  return 0;
+}
+#endif
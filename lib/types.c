@@ -32,6 +32,21 @@
 #define ESCAPE_UNIX 1
 #define ESCAPE_XML  2
 
+/****************************************************************************/
+/* Returns    : length of the string held by u, at most one less than the   */
+/*              size of its type. Does not look further, as units inside an */
+/*              event only have the space they use                          */
+
+static int idsa_string_length(IDSA_UNIT * u)
+{
+  int i, m;
+
+  m = idsa_type_size(u->u_type) - 1;
+  for (i = 0; (i < m) && (u->u_ptr[i] != '\0'); i++);
+
+  return i;
+}
+
 /* string handler ******************************************************* */
 
 static int idsa_string_compare(IDSA_UNIT * a, IDSA_UNIT * b)
@@ -57,7 +72,7 @@ static int idsa_string_compare(IDSA_UNIT * a, IDSA_UNIT * b)
 
 static int idsa_string_check(IDSA_UNIT * u)
 {
-  u->u_ptr[idsa_type_size(u->u_type) - 1] = '\0';
+  u->u_ptr[idsa_string_length(u)] = '\0';
   return 0;
 }
 
@@ -840,7 +855,7 @@ static int idsa_host_compare(IDSA_UNIT * a, IDSA_UNIT * b)
 
 static int idsa_host_check(IDSA_UNIT * u)
 {
-  u->u_ptr[idsa_type_size(u->u_type) - 1] = '\0';
+  u->u_ptr[idsa_string_length(u)] = '\0';
   return 0;
 }
 
@@ -1315,7 +1330,7 @@ static int idsa_file_compare(IDSA_UNIT * a, IDSA_UNIT * b)
 
 static int idsa_file_check(IDSA_UNIT * u)
 {
-  u->u_ptr[idsa_type_size(u->u_type) - 1] = '\0';
+  u->u_ptr[idsa_string_length(u)] = '\0';
 
   if (u->u_ptr[0] != '/') {
     return 1;
@@ -2181,6 +2196,45 @@ unsigned int idsa_type_code(char *n)
   return IDSA_T_NULL;
 }
 
+/****************************************************************************/
+/* Returns    : bytes of payload u actually uses, rounded up to keep units  */
+/*              aligned. Strings, hosts and files only take up their value  */
+
+int idsa_unit_payload(IDSA_UNIT * u)
+{
+  switch (u->u_type) {
+  case IDSA_T_STRING:
+  case IDSA_T_HOST:
+  case IDSA_T_FILE:
+    return idsa_type_payload(u->u_type, idsa_string_length(u));
+  default:
+    return idsa_type_size(u->u_type);
+  }
+}
+
+/****************************************************************************/
+/* Returns    : payload of a unit of type t whose value was scanned from at */
+/*              most l characters, see idsa_unit_payload                    */
+
+int idsa_type_payload(unsigned int t, int l)
+{
+  int m;
+
+  m = idsa_type_size(t);
+
+  switch (t) {
+  case IDSA_T_STRING:
+  case IDSA_T_HOST:
+  case IDSA_T_FILE:
+    if (l >= m) {
+      l = m - 1;
+    }
+    return (l + sizeof(int)) & ~(sizeof(int) - 1);
+  default:
+    return m;
+  }
+}
+
 int idsa_type_size(unsigned int t)
 {
   IDSA_TYPE_DETAILS *l;
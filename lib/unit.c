@@ -1,8 +1,9 @@
 
 /****************************************************************************/
 /*                                                                          */
-/*  Work on individual units (typed label value pairs). Fixed size. Is      */
-/*  it worthwhile to make some variable in size ?                           */
+/*  Work on individual units (typed label value pairs). Allocated and       */
+/*  copied at the size of their type, but strings only occupy what their    */
+/*  value needs once they are part of an event, see idsa_unit_payload       */
 /*                                                                          */
 /****************************************************************************/
 
@@ -50,7 +51,7 @@ int idsa_unit_name_set(IDSA_UNIT * u, char *n)
 
 int idsa_unit_size(IDSA_UNIT * u)
 {
-  return idsa_type_size(u->u_type) + sizeof(IDSA_UNIT) - IDSA_M_LONG;
+  return idsa_unit_payload(u) + sizeof(IDSA_UNIT) - IDSA_M_LONG;
 }
 
 IDSA_UNIT *idsa_unit_new(char *n, unsigned int type, char *s)
@@ -98,10 +99,10 @@ void idsa_unit_copy(IDSA_UNIT * a, IDSA_UNIT * b)
 {
   if (a->u_type == b->u_type) {
 #ifdef DEBUG
-    fprintf(stderr, "idsa_unit_copy(): copying %d bytes\n", idsa_type_size(a->u_type));
+    fprintf(stderr, "idsa_unit_copy(): copying %d bytes\n", idsa_unit_payload(b));
 #endif
     strncpy(a->u_name, b->u_name, IDSA_M_NAME);
-    memcpy(a->u_ptr, b->u_ptr, idsa_type_size(b->u_type));
+    memcpy(a->u_ptr, b->u_ptr, idsa_unit_payload(b));
   }
 }
 
@@ -109,11 +110,11 @@ IDSA_UNIT *idsa_unit_dup(IDSA_UNIT * u)
 {
   IDSA_UNIT *result;
 
-  result = malloc(idsa_unit_size(u));
+  result = malloc(idsa_type_size(u->u_type) + sizeof(IDSA_UNIT) - IDSA_M_LONG);
   if (result) {
     strncpy(result->u_name, u->u_name, IDSA_M_NAME);
     result->u_type = u->u_type;
-    memcpy(result->u_ptr, u->u_ptr, idsa_type_size(u->u_type));
+    memcpy(result->u_ptr, u->u_ptr, idsa_unit_payload(u));
   }
   return result;
 }
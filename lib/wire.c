@@ -2,9 +2,19 @@
 /*                                                                          */
 /*  This used to be a fancy protocol, but got lobotomized and is now a      */
 /*  single request / reply pair. The format resembles the ones proposed     */
-/*  by Matt Bishop and the GULP group, slightly. Possible improvements:     */
+/*  by Matt Bishop and the GULP group, slightly.                            */
 /*                                                                          */
-/*    variable sized units (ick, need to hack event.c and unit.c)           */
+/*  Clients which ask for it in their hello (IDSA_F_PACKED) use a packed    */
+/*  format instead, which needs no printing, escaping or scanning:          */
+/*                                                                          */
+/*    message = tag, length of units, units                                 */
+/*    unit    = type, length of name, name, value                           */
+/*                                                                          */
+/*  All numbers are unsigned LEB128 varints, so byte order does not come    */
+/*  into it. Strings are sent as held in memory, words of numeric types     */
+/*  as zigzag varints, anything else as printed text, each after its        */
+/*  length. The tag is never a character the text format starts with, so   */
+/*  decoding is done by whatever format the message is in                   */
 /*                                                                          */
 /****************************************************************************/
 
@@ -21,18 +31,46 @@
 
 #include <idsa_internal.h>
 
+#define IDSA_PACK_TEXT      0	/* printed, as on the text wire */
+#define IDSA_PACK_STRING  (-1)	/* bytes as held in memory */
+
+/* number of words making up a value in the packed format */
+static int idsa_pack_words[IDSA_M_TYPES] = {
+  [IDSA_T_STRING] = IDSA_PACK_STRING,
+  [IDSA_T_INT] = 1,
+  [IDSA_T_UID] = 1,
+  [IDSA_T_GID] = 1,
+  [IDSA_T_PID] = 1,
+  [IDSA_T_TIME] = 1,
+  [IDSA_T_FLAG] = 1,
+  [IDSA_T_RISK] = 1,
+  [IDSA_T_ERRNO] = 1,
+  [IDSA_T_HOST] = IDSA_PACK_STRING,
+  [IDSA_T_IP4ADDR] = 2,
+  [IDSA_T_IPPORT] = 2,
+  [IDSA_T_FILE] = IDSA_PACK_STRING,
+  [IDSA_T_SADDR] = IDSA_PACK_TEXT
+};
+
 /****************************************************************************/
-/* Does       : drop event into buffer                                      */
+/* Does       : drop event into buffer. Units which e still shares with the */
+/*              template of preset p are copied from it, and if start and  */
+/*              end are given, they are set to where the leading units went */
 /* Returns    : amount copied on success, negative on failure               */
 
-int idsa_event_tobuffer(IDSA_EVENT * e, char *s, int l)
+static int idsa_event_encode(IDSA_EVENT * e, IDSA_PRESET * p, int *start, int *end, char *s, int l)
 {
-  unsigned int i, m;
-  int p, j;
+  unsigned int i, m, k;
+  int v, j;
   IDSA_UNIT *u;
   char *name, *type;
   unsigned int nl, tl;
 
+  k = 0;
+  if (p && (e->e_origin != 0) && (e->e_origin == p->p_origin)) {
+    k = p->p_count;
+  }
+
   m = idsa_event_unitcount(e);
   j = 0;
   if (j >= l) {
@@ -53,6 +91,22 @@ int idsa_event_tobuffer(IDSA_EVENT * e, char *s, int l)
 
   for (i = 0; i < m; i++) {	/* for each triple */
     j++;
+
+    if ((i < k) && !(e->e_dirty & (1U << i))) {
+      v = p->p_end[i] - p->p_start[i];
+      if (j + v + 2 >= l) {
+	return -1;
+      }
+      memcpy(s + j, p->p_text + p->p_start[i], v);
+      j += v;
+      s[j] = '\t';
+      continue;
+    }
+
+    if (start && (i < IDSA_PRESET_UNITS)) {
+      start[i] = j;
+    }
+
     u = idsa_event_unitbynumber(e, i);
     if (u == NULL) {
       return -1;
@@ -78,32 +132,445 @@ int idsa_event_tobuffer(IDSA_EVENT * e, char *s, int l)
     s[j++] = '=';
     s[j++] = '"';
 
-    p = idsa_unit_print(u, s + j, l - j, 1);
-    if (p < 0) {
+    v = idsa_unit_print(u, s + j, l - j, 1);
+    if (v < 0) {
       return -1;
     }
-    j += p;
+    j += v;
 
     if (j + 2 >= l) {
       return -1;
     }
     s[j++] = '"';
     s[j] = '\t';
+
+    if (end && (i < IDSA_PRESET_UNITS)) {
+      end[i] = j;
+    }
   }
   s[j++] = '\n';
 
   return j;
 }
 
+int idsa_event_tobuffer(IDSA_EVENT * e, char *s, int l)
+{
+  return idsa_event_encode(e, NULL, NULL, NULL, s, l);
+}
+
+/* packed format *********************************************************** */
+
+/****************************************************************************/
+/* Does       : writes v at offset j of s, which holds l bytes              */
+/* Returns    : offset after it, -1 if it does not fit                      */
+
+static int idsa_pack_number(unsigned long long v, char *s, int j, int l)
+{
+  do {
+    if ((j < 0) || (j >= l)) {
+      return -1;
+    }
+    s[j++] = (v & 0x7f) | ((v > 0x7f) ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+
+  return j;
+}
+
+/****************************************************************************/
+/* Does       : reads a number at offset *j of s into v, advancing *j       */
+/* Returns    : zero on success, nonzero if it is truncated or too large    */
+
+static int idsa_unpack_number(char *s, int *j, int l, unsigned long long *v)
+{
+  unsigned long long x;
+  unsigned char c;
+  int shift;
+
+  x = 0;
+  shift = 0;
+  do {
+    if ((*j >= l) || (shift > 63)) {
+      return 1;
+    }
+    c = s[(*j)++];
+    x |= ((unsigned long long) (c & 0x7f)) << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  *v = x;
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : converts between a signed word of w bytes in memory and the */
+/*              zigzag encoding, which keeps small negative numbers short   */
+/* Returns    : nonzero if no integer type is w bytes long                  */
+
+static int idsa_pack_word(char *p, int w, unsigned long long *v)
+{
+  long long x;
+  int i;
+  short h;
+
+  if (w == sizeof(int)) {
+    memcpy(&i, p, w);
+    x = i;
+  } else if (w == sizeof(long long)) {
+    memcpy(&x, p, w);
+  } else if (w == sizeof(short)) {
+    memcpy(&h, p, w);
+    x = h;
+  } else {
+    return 1;
+  }
+
+  *v = (((unsigned long long) x) << 1) ^ ((x < 0) ? ~0ULL : 0ULL);
+
+  return 0;
+}
+
+static int idsa_unpack_word(char *p, int w, unsigned long long v)
+{
+  long long x;
+  int i;
+  short h;
+
+  x = (long long) ((v >> 1) ^ ((v & 1) ? ~0ULL : 0ULL));
+
+  if (w == sizeof(int)) {
+    i = x;
+    memcpy(p, &i, w);
+  } else if (w == sizeof(long long)) {
+    memcpy(p, &x, w);
+  } else if (w == sizeof(short)) {
+    h = x;
+    memcpy(p, &h, w);
+  } else {
+    return 1;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : appends unit u to s at offset j                             */
+/* Returns    : offset after it, -1 if it does not fit                      */
+
+static int idsa_pack_unit(IDSA_UNIT * u, char *s, int j, int l)
+{
+  unsigned long long v;
+  unsigned int t;
+  int n, w, k, x;
+  char *name;
+  char buffer[IDSA_M_MESSAGE];
+
+  t = idsa_unit_type(u);
+  name = idsa_unit_name_get(u);
+  x = strlen(name);
+
+  j = idsa_pack_number(t, s, j, l);
+  j = idsa_pack_number(x, s, j, l);
+  if ((j < 0) || (j + x > l)) {
+    return -1;
+  }
+  memcpy(s + j, name, x);
+  j += x;
+
+  n = (t < IDSA_M_TYPES) ? idsa_pack_words[t] : IDSA_PACK_TEXT;
+  switch (n) {
+  case IDSA_PACK_STRING:
+    x = strlen(u->u_ptr);
+    j = idsa_pack_number(x, s, j, l);
+    if ((j < 0) || (j + x > l)) {
+      return -1;
+    }
+    memcpy(s + j, u->u_ptr, x);
+    j += x;
+    break;
+  case IDSA_PACK_TEXT:
+    x = idsa_unit_print(u, buffer, IDSA_M_MESSAGE, 0);
+    if (x < 0) {
+      return -1;
+    }
+    j = idsa_pack_number(x, s, j, l);
+    if ((j < 0) || (j + x > l)) {
+      return -1;
+    }
+    memcpy(s + j, buffer, x);
+    j += x;
+    break;
+  default:
+    w = idsa_type_size(t) / n;
+    for (k = 0; k < n; k++) {
+      if (idsa_pack_word(u->u_ptr + (k * w), w, &v)) {
+	return -1;
+      }
+      j = idsa_pack_number(v, s, j, l);
+    }
+    break;
+  }
+
+  return j;
+}
+
+/****************************************************************************/
+/* Does       : idsa_event_encode for the packed format                     */
+/* Notes      : units start after room for the longest header, which is     */
+/*              moved up against them once their length is known           */
+
+static int idsa_event_pack(IDSA_EVENT * e, IDSA_PRESET * p, int *start, int *end, char *s, int l)
+{
+  unsigned int i, m, k;
+  int j, v, h;
+  IDSA_UNIT *u;
+  char head[IDSA_PACK_HEAD];
+
+  if (l > IDSA_M_MESSAGE) {	/* keep it within what the other side accepts */
+    l = IDSA_M_MESSAGE;
+  }
+
+  switch (e->e_magic) {
+  case IDSA_MAGIC_REQUEST:
+    head[0] = IDSA_PACK_REQUEST;
+    break;
+  case IDSA_MAGIC_REPLY:
+    head[0] = IDSA_PACK_REPLY;
+    break;
+  default:
+    return -1;
+  }
+
+  k = 0;
+  if (p && (e->e_origin != 0) && (e->e_origin == p->p_origin)) {
+    k = p->p_count;
+  }
+
+  m = idsa_event_unitcount(e);
+  j = IDSA_PACK_HEAD;
+
+  for (i = 0; i < m; i++) {
+    if ((i < k) && !(e->e_dirty & (1U << i))) {
+      v = p->p_end[i] - p->p_start[i];
+      if (j + v > l) {
+	return -1;
+      }
+      memcpy(s + j, p->p_text + p->p_start[i], v);
+      j += v;
+      continue;
+    }
+
+    u = idsa_event_unitbynumber(e, i);
+    if (u == NULL) {
+      return -1;
+    }
+
+    if (start && (i < IDSA_PRESET_UNITS)) {
+      start[i] = j;
+    }
+    j = idsa_pack_unit(u, s, j, l);
+    if (j < 0) {
+      return -1;
+    }
+    if (end && (i < IDSA_PRESET_UNITS)) {
+      end[i] = j;
+    }
+  }
+
+  h = idsa_pack_number(j - IDSA_PACK_HEAD, head, 1, IDSA_PACK_HEAD);
+  if (h < 0) {
+    return -1;
+  }
+  if (h < IDSA_PACK_HEAD) {
+    memmove(s + h, s + IDSA_PACK_HEAD, j - IDSA_PACK_HEAD);
+    j -= IDSA_PACK_HEAD - h;
+    for (i = 0; (i < m) && (i < IDSA_PRESET_UNITS); i++) {	/* segments moved too */
+      if (start) {
+	start[i] -= IDSA_PACK_HEAD - h;
+      }
+      if (end) {
+	end[i] -= IDSA_PACK_HEAD - h;
+      }
+    }
+  }
+  memcpy(s, head, h);
+
+  return j;
+}
+
+int idsa_event_topacked(IDSA_EVENT * e, char *s, int l)
+{
+  return idsa_event_pack(e, NULL, NULL, NULL, s, l);
+}
+
+/****************************************************************************/
+/* Does       : copy event in packed format from buffer                     */
+/* Returns    : amount copied on success, -1 on failure                     */
+
+int idsa_event_frompacked(IDSA_EVENT * e, char *s, int l)
+{
+  unsigned long long t, x, v;
+  unsigned int size;
+  int i, j, k, n, w;
+  char name[IDSA_M_NAME];
+  char buffer[IDSA_M_MESSAGE];
+  IDSA_UNIT *u;
+
+  l = idsa_wire_frame(s, l);
+  if (l <= 0) {
+    return -1;
+  }
+
+  idsa_event_clear(e, (s[0] == IDSA_PACK_REQUEST) ? IDSA_MAGIC_REQUEST : IDSA_MAGIC_REPLY);
+
+  j = 1;
+  idsa_unpack_number(s, &j, l, &x);	/* length, already checked */
+
+  while (j < l) {
+    if (idsa_unpack_number(s, &j, l, &t) || idsa_unpack_number(s, &j, l, &x)) {
+      return -1;
+    }
+    if ((t == IDSA_T_NULL) || (t >= IDSA_M_TYPES) || (x >= IDSA_M_NAME) || (j + x > l)) {
+      return -1;
+    }
+    memcpy(name, s + j, x);
+    name[x] = '\0';
+    j += x;
+
+    size = idsa_type_size(t);
+    n = idsa_pack_words[t];
+
+    switch (n) {
+    case IDSA_PACK_STRING:
+      if (idsa_unpack_number(s, &j, l, &x) || (x >= size) || (j + x > l)) {
+	return -1;
+      }
+      i = x;
+      u = idsa_event_rawappend(e, name, t, s + j, i);
+      if ((u == NULL) || idsa_unit_check(u)) {
+	return -1;
+      }
+      j += i;
+      break;
+    case IDSA_PACK_TEXT:
+      if (idsa_unpack_number(s, &j, l, &x) || (x >= IDSA_M_MESSAGE) || (j + x > l)) {
+	return -1;
+      }
+      i = x;
+      memcpy(buffer, s + j, i);
+      buffer[i] = '\0';
+      if (idsa_event_scanappend(e, name, t, buffer) == NULL) {
+	return -1;
+      }
+      j += i;
+      break;
+    default:
+      w = size / n;
+      for (k = 0; k < n; k++) {
+	if (idsa_unpack_number(s, &j, l, &v) || idsa_unpack_word(buffer + (k * w), w, v)) {
+	  return -1;
+	}
+      }
+      u = idsa_event_rawappend(e, name, t, buffer, size);
+      if ((u == NULL) || idsa_unit_check(u)) {
+	return -1;
+      }
+      break;
+    }
+  }
+
+  return l;
+}
+
+/****************************************************************************/
+/* Returns    : length of the message at the start of s, in either format,  */
+/*              zero if it is incomplete, -1 if it never will be complete   */
+/* Notes      : text messages end with a newline, escaping removes any      */
+/*              newlines from values. Packed ones state their length        */
+
+int idsa_wire_frame(char *s, int l)
+{
+  unsigned long long x;
+  char *end;
+  int j;
+
+  if (l <= 0) {
+    return 0;
+  }
+
+  if ((s[0] == IDSA_PACK_REQUEST) || (s[0] == IDSA_PACK_REPLY)) {
+    j = 1;
+    if (idsa_unpack_number(s, &j, (l < IDSA_PACK_HEAD) ? l : IDSA_PACK_HEAD, &x)) {
+      return (l < IDSA_PACK_HEAD) ? 0 : -1;
+    }
+    if (j + x > IDSA_M_MESSAGE) {
+      return -1;
+    }
+    return (j + x > l) ? 0 : (j + x);
+  }
+
+  end = memchr(s, '\n', (l < IDSA_M_MESSAGE) ? l : IDSA_M_MESSAGE);
+  if (end) {
+    return end + 1 - s;
+  }
+
+  return (l < IDSA_M_MESSAGE) ? 0 : -1;
+}
+
+/****************************************************************************/
+/* Does       : makes p the preset of template e in format wire, whose      */
+/*              copies are tagged with origin, which has to differ from     */
+/*              that of other presets                                       */
+/* Notes      : e must not change afterwards, only be copied                */
+
+void idsa_preset_init(IDSA_PRESET * p, IDSA_EVENT * e, unsigned int origin, int wire)
+{
+  int l;
+
+  e->e_origin = origin;
+  e->e_dirty = 0;
+
+  p->p_origin = origin;
+  p->p_wire = wire;
+  p->p_count = 0;
+
+  if (wire == IDSA_WIRE_PACKED) {
+    l = idsa_event_pack(e, NULL, p->p_start, p->p_end, p->p_text, IDSA_M_MESSAGE);
+  } else {
+    l = idsa_event_encode(e, NULL, p->p_start, p->p_end, p->p_text, IDSA_M_MESSAGE);
+  }
+  if (l > 0) {
+    p->p_count = idsa_event_unitcount(e);
+    if (p->p_count > IDSA_PRESET_UNITS) {
+      p->p_count = IDSA_PRESET_UNITS;
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : writes e in the format of p, but only encodes the units of  */
+/*              e which are not the same as in the template of p            */
+/* Returns    : amount copied on success, negative on failure               */
+
+int idsa_preset_tobuffer(IDSA_PRESET * p, IDSA_EVENT * e, char *s, int l)
+{
+  if (p->p_wire == IDSA_WIRE_PACKED) {
+    return idsa_event_pack(e, p, NULL, NULL, s, l);
+  }
+
+  return idsa_event_encode(e, p, NULL, NULL, s, l);
+}
+
 /****************************************************************************/
 /* Does       : copy event from buffer                                      */
 /* Returns    : amount copied on success, -1 on failure                     */
 
 int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l)
 {
-  unsigned int i, x, t;
+  unsigned int x, t;
   int j;
-  char *name, *value, *type;
+  char *name, *value, *type, *end;
   char buffer[IDSA_M_MESSAGE];
 
   if (l <= 0) {
@@ -113,15 +580,19 @@ int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l)
     return -1;
   }
 
+  if ((s[0] == IDSA_PACK_REQUEST) || (s[0] == IDSA_PACK_REPLY)) {
+    return idsa_event_frompacked(e, s, l);
+  }
+
   if (l > IDSA_M_MESSAGE) {
-    for (i = 0; (i < IDSA_M_MESSAGE) && (s[i] != '\n'); i++);
-    if (i >= IDSA_M_MESSAGE) {
+    end = memchr(s, '\n', IDSA_M_MESSAGE);
+    if (end == NULL) {
 #ifdef DEBUG
       fprintf(stderr, "idsa_event_frombuffer(): event too long: %d\n", l);
 #endif
       return -1;
     }
-    l = i + 1;
+    l = end + 1 - s;
   }
 
   memcpy(buffer, s, l);
@@ -145,18 +616,16 @@ int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l)
   while (j < l) {
     j++;
     name = buffer + j;		/* assume start of name */
-    while ((j < l) && (buffer[j] != ':')) {
-      j++;
-    }
+    end = memchr(name, ':', l - j);
+    j = end ? (end - buffer) : l;
     if (j + 1 >= l) {
       return -1;
     }
     buffer[j++] = '\0';
 
     type = buffer + j;		/* start of type */
-    while ((j < l) && (buffer[j] != '=')) {
-      j++;
-    }
+    end = memchr(type, '=', l - j);
+    j = end ? (end - buffer) : l;
     if (j + 2 >= l) {
 #ifdef DEBUG
       fprintf(stderr, "idsa_event_frombuffer(): truncation in type\n");
@@ -167,11 +636,8 @@ int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l)
     j++;
 
     value = buffer + j;		/* start of value */
-    x = 0;
-    while ((j < l) && (buffer[j] != '\t') && (buffer[j] != '\n')) {
-      x++;
-      j++;
-    }
+    x = idsa_scan_field((unsigned char *) value, l - j);
+    j += x;
     if (j > l) {
 #ifdef DEBUG
       fprintf(stderr, "idsa_event_frombuffer(): truncation in value\n");
@@ -182,7 +648,7 @@ int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l)
     if (x) {
       x--;
     }
-    x = idsa_descape_unix(value, x);	/* interpret any escapes */
+    x = idsa_descape_unix((unsigned char *) value, x);	/* interpret any escapes */
     value[x] = '\0';
 
     t = idsa_type_code(type);	/* get symbolic code */
@@ -214,19 +680,189 @@ int idsa_event_frombuffer(IDSA_EVENT * e, char *s, int l)
   return -1;
 }
 
+/****************************************************************************/
+/* Does       : copy event from buffer like idsa_event_frombuffer, but text */
+/*              values are only scanned once asked for, see                 */
+/*              idsa_event_lazyappend, so that nobody pays for resolving    */
+/*              names or addresses no rule looks at                         */
+/* Returns    : amount used on success, -1 on failure                       */
+/* Notes      : a value which turns out not to scan sets e_fault, see       */
+/*              idsa_event_decode, the caller then has to reject the event  */
+
+int idsa_event_lazybuffer(IDSA_EVENT * e, char *s, int l)
+{
+  unsigned int t;
+  int j, k, x;
+  char *end, *value;
+  char name[IDSA_M_NAME], type[IDSA_M_NAME];
+  char buffer[IDSA_M_MESSAGE];
+
+  if (l <= 0) {
+    return -1;
+  }
+
+  if ((s[0] == IDSA_PACK_REQUEST) || (s[0] == IDSA_PACK_REPLY)) {
+    return idsa_event_frompacked(e, s, l);	/* nothing to scan there */
+  }
+
+  end = memchr(s, '\n', (l < IDSA_M_MESSAGE) ? l : IDSA_M_MESSAGE);
+  if (end == NULL) {
+    return -1;
+  }
+  l = end + 1 - s;
+
+  switch (s[0]) {
+  case '?':
+    idsa_event_clear(e, IDSA_MAGIC_REQUEST);
+    break;
+  case '!':
+    idsa_event_clear(e, IDSA_MAGIC_REPLY);
+    break;
+  default:
+    return -1;
+  }
+
+  j = 1;
+  for (;;) {
+    end = memchr(s + j, ':', l - j);
+    if (end == NULL) {
+      return -1;
+    }
+    k = end - (s + j);
+    if (k >= IDSA_M_NAME) {	/* as idsa_unit_name_set would */
+      k = IDSA_M_NAME - 1;
+    }
+    memcpy(name, s + j, k);
+    name[k] = '\0';
+    j = end + 1 - s;
+
+    end = memchr(s + j, '=', l - j);
+    if ((end == NULL) || (end + 2 >= s + l) || (end - (s + j) >= IDSA_M_NAME)) {
+      return -1;
+    }
+    k = end - (s + j);
+    memcpy(type, s + j, k);
+    type[k] = '\0';
+    j = end + 2 - s;		/* skip opening quote */
+
+    t = idsa_type_code(type);
+    if (t == IDSA_T_NULL) {
+      return -1;
+    }
+
+    value = s + j;
+    x = idsa_scan_field((unsigned char *) value, l - j);
+    k = x ? (x - 1) : 0;	/* without closing quote */
+
+    if (idsa_event_lazyappend(e, name, t, value, k) == NULL) {	/* maybe the value fits */
+      memcpy(buffer, value, k);
+      k = idsa_descape_unix((unsigned char *) buffer, k);
+      buffer[k] = '\0';
+      if (idsa_event_scanappend(e, name, t, buffer) == NULL) {
+	return -1;
+      }
+    }
+
+    j += x;
+    if (s[j] == '\n') {	/* end of event */
+      return j + 1;
+    }
+    j++;
+  }
+}
+
 #ifdef STANDALONE
+/* round trips through both wire formats. Build in lib with               */
+/* gcc -O2 -DSTANDALONE -I../include wire.c -o wire -L. -lidsa            */
 
 #define MAX 10240
 #define COUNT 512
 #define BUFFER 128
+#define UNITS 24
+
+/* random value of type t, often at the extremes, into unit name of e */
+
+static IDSA_UNIT *random_unit(IDSA_EVENT * e, char *name, unsigned int t)
+{
+  char value[IDSA_M_LONG];
+  unsigned long addr;
+  int i, m;
+
+  m = idsa_type_size(t);
+
+  switch (t) {
+  case IDSA_T_STRING:
+  case IDSA_T_HOST:
+  case IDSA_T_FILE:
+    i = (rand() % 2) ? (m - 1) : (rand() % m);	/* half of them as long as can be */
+    value[i] = '\0';
+    while (i-- > 0) {
+      value[i] = 1 + (rand() % 0xff);
+    }
+    if (t == IDSA_T_FILE) {
+      value[0] = '/';
+      if (value[1] == '\0') {
+	value[1] = 'f';
+	value[2] = '\0';
+      }
+    }
+    break;
+  case IDSA_T_IP4ADDR:
+    addr = rand();
+    memcpy(value, &addr, sizeof(long));
+    break;
+  default:			/* numbers: zero, -1, most negative or anything */
+    switch (rand() % 4) {
+    case 0:
+      memset(value, 0, m);
+      break;
+    case 1:
+      memset(value, 0xff, m);
+      break;
+    case 2:
+      memset(value, 0, m);
+      value[m - 1] = 0x80;
+      break;
+    default:
+      for (i = 0; i < m; i++) {
+	value[i] = rand();
+      }
+      break;
+    }
+    break;
+  }
+
+  return idsa_event_setappend(e, name, t, value);
+}
+
+/* decodes packed of length l into f, and encodes it again into check */
+
+static int packed_again(IDSA_EVENT * f, char *packed, int l, char *check)
+{
+  int result;
+
+  result = idsa_event_frompacked(f, packed, l);
+  if (result != l) {
+    return (result < 0) ? -1 : 1;
+  }
+
+  result = idsa_event_topacked(f, check, MAX);
+  if ((result != l) || memcmp(packed, check, l)) {
+    return 1;
+  }
+
+  return 0;
+}
 
 int main()
 {
   char buffer[MAX];
   char check[MAX];
+  char cut[MAX];
   unsigned int max, result;
+  unsigned long long x;
   IDSA_EVENT *e, *f;
-  int i, j;
+  int i, j, k, l, h, b, n, ok, bad;
   char name[BUFFER];
 
   e = idsa_event_new(0);
@@ -275,6 +911,65 @@ int main()
     }
   }
 
+  /* packed: random units of every type, then the same cut short */
+
+  bad = 0;
+  for (i = 0; i < COUNT; i++) {
+    idsa_request_init(e, "packed", "wire", "roundtrip");
+    n = rand() % UNITS;
+    for (j = 0; j < n; j++) {
+      sprintf(name, "u%d", j);
+      if (random_unit(e, name, 1 + (rand() % (IDSA_T_FILE))) == NULL) {
+	printf("packed %d: unable to append unit %d\n", i, j);
+	exit(1);
+      }
+    }
+
+    l = idsa_event_topacked(e, buffer, MAX);
+    if (l < 0) {		/* too many long strings, fair enough */
+      continue;
+    }
+
+    if (packed_again(f, buffer, l, check)) {
+      printf("packed %d: differences: ouch\a\n", i);
+      idsa_event_dump(e, stdout);
+      idsa_event_dump(f, stdout);
+      exit(1);
+    }
+
+    /* a prefix is incomplete, never a message */
+    for (k = 0; k < l; k++) {
+      if (idsa_event_frompacked(f, buffer, k) >= 0) {
+	printf("packed %d: prefix of %d/%d taken\a\n", i, k, l);
+	exit(1);
+      }
+    }
+
+    /* body cut with its length adjusted, has to fail or be the units before the cut */
+    b = 1;
+    idsa_unpack_number(buffer, &b, l, &x);
+    ok = 0;
+    for (k = b; k < l; k++) {
+      cut[0] = buffer[0];
+      h = idsa_pack_number(k - b, cut, 1, IDSA_PACK_HEAD);
+      memcpy(cut + h, buffer + b, k - b);
+      switch (packed_again(f, cut, h + k - b, check)) {
+      case 0:
+	ok++;
+	break;
+      case 1:
+	printf("packed %d: cut at %d/%d misread\a\n", i, k, l);
+	exit(1);
+      default:
+	bad++;
+	break;
+      }
+    }
+
+    printf("packed %d: %d units, %d bytes, %d cuts whole: ok\n", i, idsa_event_unitcount(e), l, ok);
+  }
+  printf("packed: %d cuts rejected\n", bad);
+
   return 0;
 }
 #endif
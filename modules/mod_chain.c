@@ -89,7 +89,7 @@ static int chain_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, vo
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int chain_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int chain_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct chain_data *d;
   int result;
@@ -144,6 +144,8 @@ IDSA_MODULE *idsa_module_load_chain(IDSA_RULE_CHAIN * c)
     result->test_cache = &chain_test_cache;
     result->test_do = &chain_test_do;
     result->test_stop = &chain_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
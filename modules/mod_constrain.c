@@ -244,7 +244,7 @@ static void constrain_action_stop(IDSA_RULE_CHAIN * c, void *g, void *a)
 
 /****************************************************************************/
 
-static int constrain_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int constrain_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   unsigned char buffer[IDSA_M_MESSAGE];
   IDSA_UNIT *unit;
@@ -283,7 +283,7 @@ static int constrain_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT *
   return 0;
 }
 
-static int constrain_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
+static int constrain_action_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
   unsigned char buffer[IDSA_M_MESSAGE];
   IDSA_UNIT *unit;
@@ -213,7 +213,7 @@ static void count_test_stop(IDSA_RULE_CHAIN * c, void *g, void *t)
   }
 }
 
-static int count_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int count_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   COUNT_OP *o;
   COUNT_VALUE *v;
@@ -281,7 +281,7 @@ static void count_action_stop(IDSA_RULE_CHAIN * c, void *g, void *a)
   }
 }
 
-static int count_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
+static int count_action_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
   COUNT_OP *o;
   COUNT_VALUE *v;
@@ -355,9 +355,22 @@ static void count_global_stop(IDSA_RULE_CHAIN * c, void *g)
   }
 }
 
-
 /****************************************************************************/
+/* Does       : Keeps the values of counters which still exist after reload */
 
+static void count_global_carry(IDSA_RULE_CHAIN * c, void *g, void *h)
+{
+  COUNT_VALUE *alpha, *beta;
+
+  for (alpha = *((COUNT_VALUE **) g); alpha != NULL; alpha = alpha->cv_next) {
+    beta = value_find(h, c, alpha->cv_name);
+    if (beta) {
+      alpha->cv_value = beta->cv_value;
+    }
+  }
+}
+
+/****************************************************************************/
 /****************************************************************************/
 /* Does       : Registers a new module. Usually this function is the same   */
 /*              across modules, except for name changes                     */
@@ -371,6 +384,7 @@ IDSA_MODULE *idsa_module_load_counter(IDSA_RULE_CHAIN * c)
   if (result) {
     result->global_start = &count_global_start;
     result->global_stop = &count_global_stop;
+    result->global_carry = &count_global_carry;
 
     result->test_start = &count_test_start;
     result->test_cache = &count_test_cache;
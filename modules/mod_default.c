@@ -142,7 +142,7 @@ int idsa_default_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, vo
 /* Returns    : nonzero if match, zero otherwise                            */
 /* Notes      : g and t can be NULL on a per module basis                   */
 
-int idsa_default_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+int idsa_default_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct default_test_state *state;
   IDSA_UNIT *unit;
@@ -212,6 +212,8 @@ IDSA_MODULE *idsa_module_load_default(IDSA_RULE_CHAIN * c)
     result->test_cache = &idsa_default_test_cache;
     result->test_do = &idsa_default_test_do;
     result->test_stop = &idsa_default_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
@@ -101,7 +101,7 @@ static int diff_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, voi
   return result;
 }
 
-static int diff_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int diff_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct diff_data *data;
   IDSA_EVENT *alpha, *beta;
@@ -46,7 +46,7 @@ static int example1_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g,
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int example1_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int example1_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct example1_data *result;
 
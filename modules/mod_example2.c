@@ -91,7 +91,7 @@ static int example2_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g,
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int example2_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int example2_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct example2_data *result;
 
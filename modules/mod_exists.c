@@ -79,7 +79,7 @@ static int exists_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, v
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int exists_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int exists_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   EXISTS *e;
   IDSA_UNIT *unit;
@@ -127,6 +127,8 @@ IDSA_MODULE *idsa_module_load_exists(IDSA_RULE_CHAIN * c)
     result->test_cache = &exists_test_cache;
     result->test_do = &exists_test_do;
     result->test_stop = &exists_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
@@ -32,6 +32,7 @@ struct interactive_socket {
   int is_listen;
   int is_accept;
   unsigned int is_count;
+  IDSA_RULE_LOCAL *is_owner;	/* suspended evaluation awaiting a decision */
 
   struct interactive_socket *is_next;
 };
@@ -79,6 +80,7 @@ static INTERACTIVE_SOCKET *socket_make(INTERACTIVE_SOCKET ** g, IDSA_RULE_CHAIN
   strncpy(s->is_name, name, IDSA_M_FILE - 1);
   s->is_name[IDSA_M_FILE - 1] = '\0';
   s->is_accept = -1;
+  s->is_owner = NULL;
 
   /* FIXME: possibly do the entire ../common/udomain.c - udomainlisten() here */
 
@@ -277,19 +279,101 @@ static void interactive_test_stop(IDSA_RULE_CHAIN * c, void *g, void *t)
   }
 }
 
-static int interactive_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+/****************************************************************************/
+/* Does       : tells the client what became of event number is_count      */
+/* Returns    : result                                                      */
+
+static int interactive_answer(INTERACTIVE_SOCKET * s, int result)
+{
+  char buffer[IDSA_M_MESSAGE];
+  int should_write, write_result;
+
+  should_write = snprintf(buffer, IDSA_M_MESSAGE, "%c%u\n", result ? 'A' : 'D', s->is_count);
+
+#ifdef MSG_NOSIGNAL
+  write_result = send(s->is_accept, buffer, should_write, MSG_NOSIGNAL);
+#else
+  write_result = write(s->is_accept, buffer, should_write);
+#endif
+  if (write_result != should_write) {
+#ifdef TRACE
+    fprintf(stderr, "interactive_answer(): reply write failed: %s\n", strerror(errno));
+#endif
+    close(s->is_accept);
+    s->is_accept = (-1);
+  }
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : reads the decision of the client, which should be ready     */
+
+static int interactive_decision(INTERACTIVE_ENTRY * e, INTERACTIVE_SOCKET * s)
+{
+  char buffer[IDSA_M_MESSAGE];
+  int read_result;
+  unsigned int count;
+
+#ifdef MSG_NOSIGNAL
+  read_result = recv(s->is_accept, buffer, IDSA_M_MESSAGE, MSG_NOSIGNAL);
+#else
+  read_result = read(s->is_accept, buffer, IDSA_M_MESSAGE);
+#endif
+  if (read_result <= 0) {
+#ifdef TRACE
+    fprintf(stderr, "interactive_decision(): read from client failed: %s\n", strerror(errno));
+#endif
+    close(s->is_accept);
+    s->is_accept = (-1);
+    return e->ie_failopen;	/* bomb: read from client failed */
+  }
+  buffer[IDSA_M_MESSAGE - 1] = '\0';
+  count = atoi(buffer + 1);
+  if (count != s->is_count) {
+#ifdef TRACE
+    fprintf(stderr, "interactive_decision(): sync %u!=%u\n", count, s->is_count);
+#endif
+    close(s->is_accept);
+    s->is_accept = (-1);
+    return e->ie_failopen;	/* bomb: client out of sync */
+  }
+
+  return interactive_answer(s, (buffer[0] == 'A') ? 1 : 0);
+}
+
+static int interactive_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   INTERACTIVE_ENTRY *e;
   INTERACTIVE_SOCKET *s;
   struct timeval tv;
   fd_set fs;
   char buffer[IDSA_M_MESSAGE];
-  int should_write, write_result, read_result;
-  unsigned int count;
-  int result;
+  int should_write, write_result;
+  int ms;
 
   e = t;
   s = e->ie_socket;
+  ms = (e->ie_timeout.tv_sec * 1000) + (e->ie_timeout.tv_usec / 1000);
+
+  if (s->is_owner == l) {	/* resumed, decision or timeout */
+    s->is_owner = NULL;
+    if (idsa_local_expired(l)) {
+      return interactive_answer(s, e->ie_failopen);
+    }
+    return interactive_decision(e, s);
+  }
+
+  if (s->is_owner) {		/* client still deciding on an earlier event */
+    if (idsa_local_expired(l)) {
+      return e->ie_failopen;
+    }
+    return idsa_local_cansuspend(l) ? idsa_local_wait(l, -1, 0, ms) : e->ie_failopen;
+  }
+
+  if (idsa_local_expired(l)) {	/* waited long enough for the client */
+    return e->ie_failopen;
+  }
 
   if (interactive_accept(s)) {
     return e->ie_failopen;	/* bomb: unable to get client */
@@ -316,56 +400,22 @@ static int interactive_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT
   }
   s->is_count++;
 
-  /* await reply */
+  /* await reply, without blocking everybody else if possible */
+  if (idsa_local_cansuspend(l)) {
+    s->is_owner = l;
+    return idsa_local_wait(l, s->is_accept, IDSA_WAIT_READ, ms);
+  }
+
   FD_ZERO(&fs);
   FD_SET(s->is_accept, &fs);
   tv = e->ie_timeout;
 
   if (select(s->is_accept + 1, &fs, NULL, NULL, &tv) > 0) {
-#ifdef MSG_NOSIGNAL
-    read_result = recv(s->is_accept, buffer, IDSA_M_MESSAGE, MSG_NOSIGNAL);
-#else
-    read_result = read(s->is_accept, buffer, IDSA_M_MESSAGE);
-#endif
-    if (read_result <= 0) {
-#ifdef TRACE
-      fprintf(stderr, "interactive_test_do(): read from client failed: %s\n", strerror(errno));
-#endif
-      close(s->is_accept);
-      s->is_accept = (-1);
-      return e->ie_failopen;	/* bomb: read from client failed */
-    }
-    buffer[IDSA_M_MESSAGE - 1] = '\0';
-    count = atoi(buffer + 1);
-    if (count != s->is_count) {
-#ifdef TRACE
-      fprintf(stderr, "interactive_test_do(): sync %u!=%u\n", count, s->is_count);
-#endif
-      close(s->is_accept);
-      s->is_accept = (-1);
-      return e->ie_failopen;	/* bomb: client out of sync */
-    }
-    result = (buffer[0] == 'A') ? 1 : 0;
-  } else {			/* timeout, fall back */
-    result = e->ie_failopen;
-  }
-
-  should_write = snprintf(buffer, IDSA_M_MESSAGE, "%c%u\n", result ? 'A' : 'D', s->is_count);
-
-#ifdef MSG_NOSIGNAL
-  write_result = send(s->is_accept, buffer, should_write, MSG_NOSIGNAL);
-#else
-  write_result = write(s->is_accept, buffer, should_write);
-#endif
-  if (write_result != should_write) {
-#ifdef TRACE
-    fprintf(stderr, "interactive_test_do(): reply write failed: %s\n", strerror(errno));
-#endif
-    close(s->is_accept);
-    s->is_accept = (-1);
+    return interactive_decision(e, s);
   }
 
-  return result;
+  /* timeout, fall back */
+  return interactive_answer(s, e->ie_failopen);
 }
 
 /****************************************************************************/
@@ -105,6 +105,7 @@ static TREE_ROOT *tree_new(char *name, unsigned int type, int size, int timeout,
     root->r_fd = open(root->r_file, O_RDWR | O_CREAT | O_NOCTTY, S_IRUSR | S_IWUSR);
 #endif
   } else {
+    root->r_file[0] = '\0';
     root->r_fd = (-1);
   }
 
@@ -1244,6 +1245,41 @@ static void keep_global_stop(IDSA_RULE_CHAIN * c, void *g)
   }
 }
 
+/****************************************************************************/
+/* Does       : Moves the contents of sets into the new chain on reload     */
+/* Notes      : only if declared exactly as before. The stale copy is no    */
+/*              longer saved, its file now belongs to the new set           */
+
+static void keep_global_carry(IDSA_RULE_CHAIN * c, void *g, void *h)
+{
+  TREE_ROOT *alpha, *beta;
+  TREE_NODE *node;
+
+  for (alpha = *((TREE_ROOT **) g); alpha != NULL; alpha = alpha->r_next) {
+    beta = root_find(*((TREE_ROOT **) h), alpha->r_name);
+    if ((beta == NULL) || (beta->r_type != alpha->r_type) || (beta->r_size != alpha->r_size) || (beta->r_timeout != alpha->r_timeout) || strcmp(beta->r_file, alpha->r_file)) {
+      continue;
+    }
+
+    node = alpha->r_root;
+    alpha->r_root = beta->r_root;
+    beta->r_root = node;
+
+    node = alpha->r_head;
+    alpha->r_head = beta->r_head;
+    beta->r_head = node;
+
+    node = alpha->r_tail;
+    alpha->r_tail = beta->r_tail;
+    beta->r_tail = node;
+
+    if (beta->r_fd != (-1)) {
+      close(beta->r_fd);
+      beta->r_fd = (-1);
+    }
+  }
+}
+
 /****************************************************************************/
 
 static void *keep_test_start(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g)
@@ -1278,7 +1314,7 @@ static void keep_action_stop(IDSA_RULE_CHAIN * c, void *g, void *a)
 
 /****************************************************************************/
 
-static int keep_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int keep_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   IDSA_UNIT *unit;
   TREE_HANDLE *handle;
@@ -1311,12 +1347,12 @@ static int keep_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
   tree_dump(root->r_root, 0, stderr);
 #endif
 
-  /* FIXME: should try and grab time from event to save a syscall */
-  return tree_find(root, unit, time(NULL));
+  /* wall clock, timeouts end up in the save file */
+  return tree_find(root, unit, idsa_local_time(l));
 }
 
 
-static int keep_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
+static int keep_action_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
   IDSA_UNIT *unit;
   TREE_HANDLE *handle;
@@ -1338,9 +1374,7 @@ static int keep_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q,
   fprintf(stderr, "keep_action_do(): should insert %s:%d\n", idsa_unit_name_get(unit), handle->t_number);
 #endif
 
-
-  /* FIXME: try to get time from event to save a syscall */
-  tree_insert(root, unit, time(NULL));
+  tree_insert(root, unit, idsa_local_time(l));
 
 #ifdef TRACE
   tree_dump(root->r_root, 0, stderr);
@@ -1364,6 +1398,7 @@ IDSA_MODULE *idsa_module_load_keep(IDSA_RULE_CHAIN * c)
   if (result) {
     result->global_start = &keep_global_start;
     result->global_stop = &keep_global_stop;
+    result->global_carry = &keep_global_carry;
 
     result->test_start = &keep_test_start;
     result->test_cache = &keep_test_cache;
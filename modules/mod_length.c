@@ -135,7 +135,7 @@ static int length_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, v
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int length_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int length_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   char buffer[IDSA_M_LONG];
   LENGTH_DATA *e;
@@ -214,6 +214,8 @@ IDSA_MODULE *idsa_module_load_length(IDSA_RULE_CHAIN * c)
     result->test_cache = &length_test_cache;
     result->test_do = &length_test_do;
     result->test_stop = &length_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
@@ -612,7 +612,7 @@ int idsa_log_action_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, void
 
 #define BUFFER (8*IDSA_M_MESSAGE)
 
-int idsa_log_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
+int idsa_log_action_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
   LOG_POINTER *pointer;
   LOG_STATE *state;
@@ -717,6 +717,9 @@ IDSA_MODULE *idsa_module_load_log(IDSA_RULE_CHAIN * c)
     result->action_cache = &idsa_log_action_cache;
     result->action_do = &idsa_log_action_do;
     result->action_stop = &idsa_log_action_stop;
+
+    /* only prints the request */
+    result->m_flags = IDSA_MODULE_F_DEFER;
   }
 
   return result;
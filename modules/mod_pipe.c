@@ -33,6 +33,13 @@ struct pipe_data {
   int p_fd;
   pid_t p_pid;
   char *p_command;
+
+  /* exchange of a suspended evaluation, see pipe_step */
+  IDSA_RULE_LOCAL *p_owner;	/* evaluation talking to child, or NULL */
+  int p_reading;		/* request sent, waiting for reply */
+  int p_should;
+  int p_have;
+  char p_buffer[IDSA_M_MESSAGE];
 };
 
 /****************************************************************************/
@@ -129,21 +136,14 @@ static int pipe_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, voi
   return 0;
 }
 
-static int pipe_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+/****************************************************************************/
+/* Does       : reads whatever a failed exchange may have left behind       */
+
+static void pipe_clean(struct pipe_data *pd)
 {
-  struct pipe_data *pd;
-  int result;
-  fd_set fs;
-  struct timeval tv;
   char buffer[IDSA_M_MESSAGE];
   int i;
-  int should_write, write_result, want_write, have_written;
-  int read_result, want_read, have_read, copied_bytes;
-
-  pd = t;
-
-  result = pd->p_failopen;
-  tv = pd->p_timeout;
+  int read_result;
 
   if (pd->p_fail) {		/* attempt to clean out things */
     for (i = 0; i < FAIL_READS; i++) {
@@ -170,6 +170,30 @@ static int pipe_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
       }
     }
   }
+}
+
+/****************************************************************************/
+/* Does       : sends q to the child and waits for its reply, for callers   */
+/*              unable to suspend. Gives up if a suspended evaluation is    */
+/*              still talking to the child                                  */
+
+static int pipe_block(struct pipe_data *pd, IDSA_EVENT * q)
+{
+  int result;
+  fd_set fs;
+  struct timeval tv;
+  char buffer[IDSA_M_MESSAGE];
+  int should_write, write_result, want_write, have_written;
+  int read_result, want_read, have_read, copied_bytes;
+
+  result = pd->p_failopen;
+  tv = pd->p_timeout;
+
+  if (pd->p_owner) {
+    return result;
+  }
+
+  pipe_clean(pd);
 
   if (pd->p_fail == 0) {	/* ok */
     pd->p_fail = 1;		/* assume failure */
@@ -308,6 +332,107 @@ static int pipe_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
   return result;
 }
 
+/****************************************************************************/
+/* Does       : advances the exchange of evaluation l with the child as far */
+/*              as possible without blocking. Only one evaluation at a time */
+/*              talks to the child, others queue up until it is done       */
+
+static int pipe_step(struct pipe_data *pd, IDSA_RULE_LOCAL * l, IDSA_EVENT * q)
+{
+  int ms, rr, copied_bytes;
+
+  ms = (pd->p_timeout.tv_sec * 1000) + (pd->p_timeout.tv_usec / 1000);
+
+  if (pd->p_owner != l) {
+    if (idsa_local_expired(l)) {	/* waited long enough for the child */
+      return pd->p_failopen;
+    }
+    if (pd->p_owner) {		/* busy with somebody else */
+      return idsa_local_wait(l, -1, 0, ms);
+    }
+    /* child idle, start exchange */
+    pipe_clean(pd);
+    if (pd->p_fail) {
+      kill(pd->p_pid, SIGINT);
+      return pd->p_failopen;
+    }
+    pd->p_should = idsa_event_tobuffer(q, pd->p_buffer, IDSA_M_MESSAGE);
+    if (pd->p_should <= 0) {	/* internal error */
+      return pd->p_failopen;
+    }
+    pd->p_have = 0;
+    pd->p_reading = 0;
+    pd->p_owner = l;
+    pd->p_fail = 1;		/* assume failure */
+  } else if (idsa_local_expired(l)) {	/* child took too long */
+    pd->p_owner = NULL;
+    kill(pd->p_pid, SIGINT);
+    return pd->p_failopen;
+  }
+
+  while (!pd->p_reading) {
+#ifdef MSG_NOSIGNAL
+    rr = send(pd->p_fd, pd->p_buffer + pd->p_have, pd->p_should - pd->p_have, MSG_NOSIGNAL);
+#else
+    rr = write(pd->p_fd, pd->p_buffer + pd->p_have, pd->p_should - pd->p_have);
+#endif
+    if (rr > 0) {
+      pd->p_have += rr;
+      if (pd->p_have >= pd->p_should) {
+	pd->p_have = 0;
+	pd->p_reading = 1;
+      }
+    } else if ((rr < 0) && (errno == EAGAIN)) {
+      return idsa_local_wait(l, pd->p_fd, IDSA_WAIT_WRITE, ms);
+    } else if ((rr == 0) || (errno != EINTR)) {
+      pd->p_owner = NULL;
+      kill(pd->p_pid, SIGINT);
+      return pd->p_failopen;
+    }
+  }
+
+  copied_bytes = (-1);
+  while (copied_bytes <= 0) {
+#ifdef MSG_NOSIGNAL
+    rr = recv(pd->p_fd, pd->p_buffer + pd->p_have, IDSA_M_MESSAGE - pd->p_have, MSG_NOSIGNAL);
+#else
+    rr = read(pd->p_fd, pd->p_buffer + pd->p_have, IDSA_M_MESSAGE - pd->p_have);
+#endif
+    if (rr > 0) {
+      pd->p_have += rr;
+      copied_bytes = idsa_event_frombuffer(pd->p_event, pd->p_buffer, pd->p_have);
+    } else if ((rr < 0) && (errno == EAGAIN)) {
+      return idsa_local_wait(l, pd->p_fd, IDSA_WAIT_READ, ms);
+    } else if ((rr == 0) || (errno != EINTR)) {
+      break;
+    }
+  }
+
+  pd->p_owner = NULL;
+
+  if (copied_bytes != pd->p_have) {
+    kill(pd->p_pid, SIGINT);
+    return pd->p_failopen;
+  }
+
+  pd->p_fail = 0;
+
+  return (idsa_reply_result(pd->p_event) == IDSA_L_DENY) ? 0 : 1;
+}
+
+static int pipe_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
+{
+  struct pipe_data *pd;
+
+  pd = t;
+
+  if (idsa_local_cansuspend(l) || idsa_local_expired(l)) {
+    return pipe_step(pd, l, q);
+  }
+
+  return pipe_block(pd, q);
+}
+
 static void pipe_test_stop(IDSA_RULE_CHAIN * c, void *g, void *t)
 {
   struct pipe_data *pd;
@@ -382,6 +507,7 @@ static struct pipe_data *pipe_new(IDSA_RULE_CHAIN * c, char *command, char *time
   pd->p_failopen = failopen;
 
   pd->p_event = NULL;
+  pd->p_owner = NULL;
   pd->p_fd = (-1);
   pd->p_pid = 0;
   pd->p_command = NULL;
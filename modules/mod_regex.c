@@ -105,7 +105,7 @@ static int regex_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, vo
 /* Returns    : nonzero if match, zero otherwise                            */
 /* Notes      : g and t can be NULL on a per module basis                   */
 
-static int regex_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int regex_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct regex_test_state *state;
   char buffer[IDSA_M_MESSAGE];
@@ -173,6 +173,8 @@ IDSA_MODULE *idsa_module_load_regex(IDSA_RULE_CHAIN * c)
     result->test_cache = &regex_test_cache;
     result->test_do = &regex_test_do;
     result->test_stop = &regex_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
@@ -1352,6 +1352,32 @@ static void sad_global_stop(IDSA_RULE_CHAIN * c, void *g)
   }
 }
 
+/****************************************************************************/
+/* Does       : Hands learned sequences over to the new chain on reload, as  */
+/*              long as they are declared with the same parameters          */
+
+static void sad_global_carry(IDSA_RULE_CHAIN * c, void *g, void *h)
+{
+  SEQUENCE *alpha, *beta;
+  SEQUENCE swap;
+
+  for (alpha = *((SEQUENCE **) g); alpha != NULL; alpha = alpha->s_next) {
+    beta = find_root(*((SEQUENCE **) h), alpha->s_name);
+    if ((beta == NULL) || (beta->s_type != alpha->s_type) || (beta->s_count != alpha->s_count) || (beta->s_history != alpha->s_history) || (beta->s_deviations != alpha->s_deviations) || (beta->s_decay_average != alpha->s_decay_average)) {
+      continue;
+    }
+
+    /* exchange everything but the list linkage */
+    swap = *alpha;
+    *alpha = *beta;
+    *beta = swap;
+
+    swap.s_next = alpha->s_next;
+    alpha->s_next = beta->s_next;
+    beta->s_next = swap.s_next;
+  }
+}
+
 /****************************************************************************/
 
 static void *sad_test_start(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g)
@@ -1518,7 +1544,7 @@ static void *sad_test_start(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g)
 /****************************************************************************/
 /* Does       : The actual work of testing an event                         */
 
-static int sad_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int sad_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   SEQUENCE *sequence;
   VARIABLE *variable;
@@ -1571,10 +1597,11 @@ IDSA_MODULE *idsa_module_load_sad(IDSA_RULE_CHAIN * c)
 {
   IDSA_MODULE *result;
 
-  result = idsa_module_new(c, "sad");
+  result = idsa_module_new_version(c, "sad", IDSA_MODULE_INTERFACE_VERSION);
   if (result) {
     result->global_start = &sad_global_start;
     result->global_stop = &sad_global_stop;
+    result->global_carry = &sad_global_carry;
 
     result->test_start = &sad_test_start;
     result->test_cache = &sad_test_cache;
@@ -90,7 +90,7 @@ static int send_action_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, v
   return result;
 }
 
-static int send_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
+static int send_action_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
   IDSA_UNIT *unit;
   unit = a;
@@ -213,10 +213,10 @@ static void *time_test_start(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g)
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int time_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int time_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   struct time_data *data;
-  struct tm *time_struct;
+  struct tm *time_struct, time_buffer;
   time_t time_type;
   IDSA_UNIT *time_unit;
   int value;
@@ -232,10 +232,11 @@ static int time_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
     return 0;
   }
 
+  /* reentrant versions, may be called from several threads */
   if (data->t_utc) {
-    time_struct = gmtime(&time_type);
+    time_struct = gmtime_r(&time_type, &time_buffer);
   } else {
-    time_struct = localtime(&time_type);
+    time_struct = localtime_r(&time_type, &time_buffer);
   }
 
   switch (data->t_component) {
@@ -342,6 +343,8 @@ IDSA_MODULE *idsa_module_load_time(IDSA_RULE_CHAIN * c)
     result->test_cache = &time_test_cache;
     result->test_do = &time_test_do;
     result->test_stop = &time_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
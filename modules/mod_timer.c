@@ -14,10 +14,6 @@
 
 /****************************************************************************/
 
-static int time_position = 0;
-
-/****************************************************************************/
-
 struct time_value {
   time_t tv_until;
   char tv_name[IDSA_M_NAME];
@@ -174,28 +170,17 @@ static void time_test_stop(IDSA_RULE_CHAIN * c, void *g, void *t)
   }
 }
 
-static int time_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int time_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   TIME_OP *o;
   TIME_VALUE *v;
-  time_t time_now;
-  IDSA_UNIT *time_unit;
-
-  /* get hold of time associated with event */
-  time_unit = idsa_event_unitbynumber(q, time_position);
-  if (time_unit == NULL) {
-    return 0;
-  }
-  if (idsa_unit_get(time_unit, &time_now, sizeof(time_t)) != sizeof(time_t)) {
-    return 0;
-  }
 
   /* get hold of timer */
   o = t;
   v = o->to_timer;
 
-  /* has it expired ? */
-  if (time_now > v->tv_until) {
+  /* has it expired ? monotonic, so that clock changes leave it alone */
+  if (idsa_local_clock(l) > v->tv_until) {
     return 0;
   }
 
@@ -251,7 +236,7 @@ static void time_action_stop(IDSA_RULE_CHAIN * c, void *g, void *a)
   }
 }
 
-static int time_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
+static int time_action_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *a, IDSA_EVENT * q, IDSA_EVENT * p)
 {
   TIME_OP *o;
   TIME_VALUE *v;
@@ -264,8 +249,8 @@ static int time_action_do(IDSA_RULE_CHAIN * c, void *g, void *a, IDSA_EVENT * q,
 #endif
 
   if (o->to_value) {		/* nonzero value lets timer run until some time in the future */
-    v->tv_until = time(NULL) + o->to_value;
-  } else {			/* zero resets it and saves us a system call */
+    v->tv_until = idsa_local_clock(l) + o->to_value;
+  } else {			/* zero resets it */
     v->tv_until = 0;
   }
 
@@ -282,11 +267,6 @@ static void *time_global_start(IDSA_RULE_CHAIN * c)
 {
   TIME_VALUE **pointer;
 
-  if (time_position == 0) {
-    /* WARNING: safety issues if concurrent assignments don't yield the consistent value */
-    time_position = idsa_resolve_request(IDSA_Q_TIME);
-  }
-
   pointer = malloc(sizeof(TIME_VALUE *));
   if (pointer == NULL) {
     idsa_chain_error_malloc(c, sizeof(TIME_VALUE *));
@@ -316,6 +296,21 @@ static void time_global_stop(IDSA_RULE_CHAIN * c, void *g)
   }
 }
 
+/****************************************************************************/
+/* Does       : Lets timers which are still declared keep running on reload */
+
+static void time_global_carry(IDSA_RULE_CHAIN * c, void *g, void *h)
+{
+  TIME_VALUE *alpha, *beta;
+
+  for (alpha = *((TIME_VALUE **) g); alpha != NULL; alpha = alpha->tv_next) {
+    beta = value_find(h, c, alpha->tv_name);
+    if (beta) {
+      alpha->tv_until = beta->tv_until;
+    }
+  }
+}
+
 /****************************************************************************/
 /* Does       : Registers a new module. Usually this function is the same   */
 /*              across modules, except for name changes                     */
@@ -329,6 +324,7 @@ IDSA_MODULE *idsa_module_load_timer(IDSA_RULE_CHAIN * c)
   if (result) {
     result->global_start = &time_global_start;
     result->global_stop = &time_global_stop;
+    result->global_carry = &time_global_carry;
 
     result->test_start = &time_test_start;
     result->test_cache = &time_test_cache;
@@ -30,7 +30,7 @@ static int true_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, voi
 /* Does       : The actual work of testing an event                         */
 /* Returns    : always 1                                                    */
 
-static int true_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int true_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   return 1;
 }
@@ -57,6 +57,8 @@ IDSA_MODULE *idsa_module_load_true(IDSA_RULE_CHAIN * c)
     result->test_cache = &true_test_cache;
     result->test_do = &true_test_do;
     result->test_stop = &true_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_CONSTANT;
   }
 
   return result;
@@ -85,7 +85,7 @@ static int truncated_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int truncated_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int truncated_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   char buffer[IDSA_M_MESSAGE];
   TRUNCATE *o;
@@ -160,6 +160,8 @@ IDSA_MODULE *idsa_module_load_truncated(IDSA_RULE_CHAIN * c)
     result->test_cache = &truncated_test_cache;
     result->test_do = &truncated_test_do;
     result->test_stop = &truncated_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
@@ -100,7 +100,7 @@ static int type_test_cache(IDSA_MEX_STATE * m, IDSA_RULE_CHAIN * c, void *g, voi
 /*              pointer returned by test_start()                            */
 /* Returns    : 1 on match, 0 if not matched                                */
 
-static int type_test_do(IDSA_RULE_CHAIN * c, void *g, void *t, IDSA_EVENT * q)
+static int type_test_do(IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, void *g, void *t, IDSA_EVENT * q)
 {
   TYPE_DATA *e;
   IDSA_UNIT *unit;
@@ -156,6 +156,8 @@ IDSA_MODULE *idsa_module_load_type(IDSA_RULE_CHAIN * c)
     result->test_cache = &type_test_cache;
     result->test_do = &type_test_do;
     result->test_stop = &type_test_stop;
+
+    result->m_flags = IDSA_MODULE_F_CONCURRENT | IDSA_MODULE_F_PURE;
   }
 
   return result;
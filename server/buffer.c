@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : jobs only hold read and write buffers while data is pending */
+/*              so that idle connections cost no more than their JOB        */
+/*              header. Returned buffers are kept on a free list, chained   */
+/*              through their first bytes, up to b_keep of them             */
+
+void buffer_init(BUFFERS * b, int size, int keep)
+{
+  b->b_size = size;
+  b->b_keep = keep;
+  b->b_free = NULL;
+  b->b_spare = 0;
+  b->b_used = 0;
+}
+
+/****************************************************************************/
+/* Does       : puts count buffers on the free list and keeps them there    */
+/* Returns    : zero on success, nonzero if memory ran out                  */
+
+int buffer_fill(BUFFERS * b, int count)
+{
+  char *p;
+
+  if (b->b_keep < count) {
+    b->b_keep = count;
+  }
+
+  while (b->b_spare < count) {
+    p = malloc(b->b_size);
+    if (p == NULL) {
+      return 1;
+    }
+    *((char **) p) = b->b_free;
+    b->b_free = p;
+    b->b_spare++;
+  }
+
+  return 0;
+}
+
+char *buffer_get(BUFFERS * b)
+{
+  char *result;
+
+  if (b->b_free) {
+    result = b->b_free;
+    b->b_free = *((char **) result);
+    b->b_spare--;
+  } else {
+    result = malloc(b->b_size);
+    if (result == NULL) {
+      return NULL;
+    }
+  }
+
+  b->b_used++;
+
+  return result;
+}
+
+void buffer_put(BUFFERS * b, char *p)
+{
+  b->b_used--;
+
+  if (b->b_spare >= b->b_keep) {
+    free(p);
+    return;
+  }
+
+  *((char **) p) = b->b_free;
+  b->b_free = p;
+  b->b_spare++;
+}
+
+/****************************************************************************/
+/* Does       : releases spare buffers, the ones in use are up to the jobs  */
+
+void buffer_flush(BUFFERS * b)
+{
+  char *p;
+
+  while (b->b_free) {
+    p = b->b_free;
+    b->b_free = *((char **) p);
+    free(p);
+  }
+  b->b_spare = 0;
+}
+
+/****************************************************************************/
+/* Returns    : bytes currently allocated for buffers, in use or spare      */
+
+long buffer_bytes(BUFFERS * b)
+{
+  return ((long) (b->b_used + b->b_spare)) * b->b_size;
+}
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <idsa_internal.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : actions of modules with IDSA_MODULE_F_DEFER (log) do not    */
+/*              affect the reply, so the evaluation only copies request and */
+/*              reply into a ring of fixed size and moves on. One executor  */
+/*              thread runs them in order. What happens once the ring is    */
+/*              full is up to d_policy. Chains have to be drained before    */
+/*              they are stopped, see set_sweep                             */
+
+static void defer_clear(DEFERRED * e)
+{
+  if (e->d_request) {
+    idsa_event_free(e->d_request);
+    e->d_request = NULL;
+  }
+  if (e->d_reply) {
+    idsa_event_free(e->d_reply);
+    e->d_reply = NULL;
+  }
+}
+
+static int defer_fill(DEFERRED * e)
+{
+  e->d_chain = NULL;
+  e->d_action = NULL;
+  e->d_request = idsa_event_new(0);
+  e->d_reply = idsa_event_new(0);
+
+  return (e->d_request == NULL) || (e->d_reply == NULL);
+}
+
+static void defer_free(STATE_SET * s, DEFER * d)
+{
+  int i;
+
+  pthread_cond_destroy(&(d->d_room));
+  pthread_cond_destroy(&(d->d_wait));
+  pthread_mutex_destroy(&(d->d_lock));
+
+  for (i = 0; i < d->d_size; i++) {
+    defer_clear(&(d->d_ring[i]));
+  }
+  defer_clear(&(d->d_run));
+  if (d->d_local) {
+    idsa_local_free(s->s_chain, d->d_local);
+  }
+
+  free(d->d_ring);
+  free(d);
+}
+
+/****************************************************************************/
+/* Does       : takes the oldest action off the ring and runs it, until     */
+/*              stopped with nothing left                                   */
+
+static void *defer_main(void *arg)
+{
+  DEFER *d;
+  DEFERRED *e, tmp;
+
+  d = arg;
+
+  pthread_mutex_lock(&(d->d_lock));
+  for (;;) {
+    while ((d->d_count == 0) && (d->d_stop == 0)) {
+      pthread_cond_wait(&(d->d_wait), &(d->d_lock));
+    }
+    if (d->d_count == 0) {	/* stopping and nothing left to do */
+      break;
+    }
+
+    /* swap, so that the slot can take the next action right away */
+    e = &(d->d_ring[d->d_head]);
+    tmp = *e;
+    *e = d->d_run;
+    d->d_run = tmp;
+
+    d->d_head = (d->d_head + 1) % d->d_size;
+    d->d_count--;
+    d->d_busy = 1;
+    pthread_cond_broadcast(&(d->d_room));
+
+    pthread_mutex_unlock(&(d->d_lock));
+
+    e = &(d->d_run);
+    idsa_local_init(e->d_chain, d->d_local, e->d_request, e->d_reply);
+    idsa_local_settime(d->d_local, e->d_time, e->d_clock);
+    idsa_module_do_action(e->d_chain, d->d_local, e->d_action, e->d_request, e->d_reply);
+
+    pthread_mutex_lock(&(d->d_lock));
+    d->d_busy = 0;
+    d->d_done++;
+    d->d_passed++;
+    pthread_cond_broadcast(&(d->d_room));
+  }
+  pthread_mutex_unlock(&(d->d_lock));
+
+  return NULL;
+}
+
+/****************************************************************************/
+/* Does       : copies what action a needs out of l, called by the chain    */
+/* Returns    : zero, a has been queued or discarded                        */
+
+static int defer_queue(void *state, IDSA_RULE_CHAIN * c, IDSA_RULE_LOCAL * l, IDSA_RULE_ACTION * a)
+{
+  DEFER *d;
+  DEFERRED *e;
+  time_t now, clock;
+
+  d = state;
+
+  /* outside the lock, may make system calls for callers without clocks */
+  now = idsa_local_time(l);
+  clock = idsa_local_clock(l);
+
+  pthread_mutex_lock(&(d->d_lock));
+
+  d->d_queued++;
+
+  if (d->d_count >= d->d_size) {
+    switch (d->d_policy) {
+    case DEFER_OLDEST:
+      d->d_head = (d->d_head + 1) % d->d_size;
+      d->d_count--;
+      d->d_dropped++;
+      d->d_passed++;
+      break;
+    case DEFER_NEWEST:
+      d->d_dropped++;
+      pthread_mutex_unlock(&(d->d_lock));
+      return 0;
+    case DEFER_BLOCK:
+    default:
+      while (d->d_count >= d->d_size) {
+	pthread_cond_wait(&(d->d_room), &(d->d_lock));
+      }
+      break;
+    }
+  }
+
+  e = &(d->d_ring[(d->d_head + d->d_count) % d->d_size]);
+  e->d_chain = c;
+  e->d_action = a;
+  e->d_time = now;
+  e->d_clock = clock;
+  idsa_event_copy(e->d_request, l->l_request);
+  idsa_event_copy(e->d_reply, l->l_reply);
+
+  d->d_count++;
+  d->d_entered++;
+  pthread_cond_signal(&(d->d_wait));
+
+  pthread_mutex_unlock(&(d->d_lock));
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Returns    : DEFER_* matching name, -1 if none does                      */
+
+int defer_policy(char *name)
+{
+  if (!strcmp(name, "block")) {
+    return DEFER_BLOCK;
+  }
+  if (!strcmp(name, "oldest")) {
+    return DEFER_OLDEST;
+  }
+  if (!strcmp(name, "newest")) {
+    return DEFER_NEWEST;
+  }
+
+  return -1;
+}
+
+/****************************************************************************/
+/* Does       : starts the executor with a ring of size entries and has     */
+/*              s_chain queue its deferrable actions                        */
+/* Returns    : zero on success, nonzero otherwise                          */
+/* Notes      : like worker_start has to be called after the last fork      */
+
+int defer_start(STATE_SET * s, int size, int policy)
+{
+  DEFER *d;
+  sigset_t all, old;
+  int i;
+
+  d = malloc(sizeof(DEFER));
+  if (d == NULL) {
+    return 1;
+  }
+
+  d->d_ring = malloc(sizeof(DEFERRED) * size);
+  if (d->d_ring == NULL) {
+    free(d);
+    return 1;
+  }
+
+  pthread_mutex_init(&(d->d_lock), NULL);
+  pthread_cond_init(&(d->d_wait), NULL);
+  pthread_cond_init(&(d->d_room), NULL);
+
+  d->d_size = size;
+  d->d_head = 0;
+  d->d_count = 0;
+  d->d_busy = 0;
+  d->d_policy = policy;
+  d->d_stop = 0;
+
+  d->d_queued = 0;
+  d->d_dropped = 0;
+  d->d_done = 0;
+
+  d->d_entered = 0;
+  d->d_passed = 0;
+
+  /* all entries preallocated, queueing never allocates */
+  for (i = 0; i < size; i++) {
+    d->d_ring[i].d_request = NULL;
+    d->d_ring[i].d_reply = NULL;
+  }
+  d->d_run.d_request = NULL;
+  d->d_run.d_reply = NULL;
+  d->d_local = idsa_local_new(s->s_chain);
+
+  for (i = 0; (i < size) && (defer_fill(&(d->d_ring[i])) == 0); i++);
+
+  if ((i < size) || defer_fill(&(d->d_run)) || (d->d_local == NULL)) {
+    defer_free(s, d);
+    return 1;
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  i = pthread_create(&(d->d_thread), NULL, &defer_main, d);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (i) {
+    defer_free(s, d);
+    return 1;
+  }
+
+  s->s_defer = d;
+
+  if (worker_attach(s, s->s_chain)) {
+    defer_stop(s);
+    return 1;
+  }
+
+  defer_attach(s, s->s_chain);
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : runs whatever is still queued, then removes the executor    */
+/* Notes      : nothing else may be evaluating rules by now                 */
+
+void defer_stop(STATE_SET * s)
+{
+  DEFER *d;
+
+  d = s->s_defer;
+  if (d == NULL) {
+    return;
+  }
+
+  if (s->s_chain) {
+    idsa_chain_defer(s->s_chain, NULL, NULL);
+  }
+
+  pthread_mutex_lock(&(d->d_lock));
+  d->d_stop = 1;
+  pthread_cond_signal(&(d->d_wait));
+  pthread_mutex_unlock(&(d->d_lock));
+
+  pthread_join(d->d_thread, NULL);
+
+  s->s_defer = NULL;
+
+  /* back to single threaded, unless there are workers */
+  if (!worker_threaded(s)) {
+    worker_detach(s, s->s_chain);
+  }
+
+  defer_free(s, d);
+}
+
+/****************************************************************************/
+/* Does       : has c queue its deferrable actions, if there is an executor */
+
+void defer_attach(STATE_SET * s, IDSA_RULE_CHAIN * c)
+{
+  if (s->s_defer) {
+    idsa_chain_defer(c, &defer_queue, s->s_defer);
+  }
+}
+
+/****************************************************************************/
+/* Returns    : a mark for the actions queued so far, see defer_past        */
+
+unsigned int defer_mark(STATE_SET * s)
+{
+  DEFER *d;
+  unsigned int result;
+
+  d = s->s_defer;
+  if (d == NULL) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&(d->d_lock));
+  result = d->d_entered;
+  pthread_mutex_unlock(&(d->d_lock));
+
+  return result;
+}
+
+/****************************************************************************/
+/* Returns    : nonzero once every action queued before mark has been run   */
+/*              or discarded, so that its chain may be stopped              */
+/* Notes      : never waits, the ring is run in order                       */
+
+int defer_past(STATE_SET * s, unsigned int mark)
+{
+  DEFER *d;
+  int result;
+
+  d = s->s_defer;
+  if (d == NULL) {
+    return 1;
+  }
+
+  pthread_mutex_lock(&(d->d_lock));
+  result = ((int) (d->d_passed - mark)) >= 0;
+  pthread_mutex_unlock(&(d->d_lock));
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : reads the counters, zero if there is no executor            */
+
+void defer_counts(STATE_SET * s, int *queued, int *dropped, int *done)
+{
+  DEFER *d;
+
+  d = s->s_defer;
+  if (d == NULL) {
+    *queued = 0;
+    *dropped = 0;
+    *done = 0;
+    return;
+  }
+
+  pthread_mutex_lock(&(d->d_lock));
+  *queued = d->d_queued;
+  *dropped = d->d_dropped;
+  *done = d->d_done;
+  pthread_mutex_unlock(&(d->d_lock));
+}
@@ -17,17 +17,42 @@
 
 #define job_isend(j)   ((j->j_state!=JOB_STATEWRITE)&&(j->j_state!=JOB_STATEWAIT))
 #define job_iswrite(j) ((j->j_state==JOB_STATEWRITE)||(j->j_wl>0))
-#define job_iswork(j)  ((j->j_state==JOB_STATEWAIT)&&(j->j_rl>0))
+#define job_iswork(j)  ((j->j_state==JOB_STATEWAIT)&&(j->j_rl>0)&&(j->j_work==NULL)&&(j->j_park==NULL))
+
+/* readiness which means replies can go out, a ring wakes us on the socket */
+#define job_writable(j) ((j)->j_ring ? LOOP_READ : LOOP_WRITE)
 
 int job_accept(JOB *j, int fd);
-void job_copy(JOB *t, JOB *s);
 void job_drop(int fd);
-int job_end(JOB *j);
+int job_end(JOB *j, STATE_SET *s);
+void job_trim(JOB *j, STATE_SET *s);
 
 int job_write(JOB *j);
-int job_read(JOB *j);
+int job_read(JOB *j, STATE_SET *s);
 
 int job_do(JOB *j, STATE_SET *s);
+int job_resume(JOB *j, STATE_SET *s);
+int job_submit(JOB *j, STATE_SET *s);
+int job_finish(JOB *j, STATE_SET *s, WORK *w);
+
+/****************************************************************************/
+
+#define LOOP_READ            0x01
+#define LOOP_WRITE           0x02
+
+#define LOOP_LISTEN    0x80000000  /* key flag: listening socket, not a job */
+#define LOOP_WAKE      0x40000000  /* key: workers have finished something */
+#define LOOP_PARK      0x20000000  /* key flag: descriptor of suspended evaluation */
+#define LOOP_RELOAD    0x10000000  /* key: rules have been reread */
+
+LOOP *loop_new(int max);
+void loop_free(LOOP *l);
+
+int loop_add(LOOP *l, int fd, unsigned int key, int mask);
+int loop_change(LOOP *l, int fd, unsigned int key, int mask);
+int loop_remove(LOOP *l, int fd);
+
+int loop_wait(LOOP *l, LOOP_READY *r, int n, int timeout);
 
 /****************************************************************************/
 
@@ -40,10 +65,103 @@ int io_writereply(STATE_SET *s, JOB *j, IDSA_EVENT *e);
 
 int io_drain(JOB *j);
 
+int io_frame(JOB *j);
+int io_decode(STATE_SET *s, WORK *w, int o, IDSA_EVENT *e);
+void io_stamp(STATE_SET *s, IDSA_EVENT *e);
+
+int io_hello(JOB *j);
+int io_greet(JOB *j, STATE_SET *s);
+
 /****************************************************************************/
 
+int ring_offer(JOB *j, STATE_SET *s);
+void ring_end(JOB *j, STATE_SET *s);
+void ring_generation(STATE_SET *s);
+
+int ring_read(JOB *j, STATE_SET *s);
+int ring_drain(JOB *j);
+
+/****************************************************************************/
+
+int worker_start(STATE_SET *s, int count);
+void worker_stop(STATE_SET *s);
+
+int worker_attach(STATE_SET *s, IDSA_RULE_CHAIN *c);
+void worker_detach(STATE_SET *s, IDSA_RULE_CHAIN *c);
+int worker_carry(STATE_SET *s, IDSA_RULE_CHAIN *c, IDSA_RULE_CHAIN *o);
+
+void worker_queue(STATE_SET *s, WORK *w);
+WORK *worker_collect(STATE_SET *s);
+
+WORK *worker_get(STATE_SET *s);
+void worker_put(STATE_SET *s, WORK *w);
+
+void worker_lock(STATE_SET *s);
+void worker_unlock(STATE_SET *s);
+
+/* chain has to be serialized */
+#define worker_threaded(s) (((s)->s_pool != NULL) || ((s)->s_defer != NULL))
+
+/****************************************************************************/
+
+int defer_start(STATE_SET *s, int size, int policy);
+void defer_stop(STATE_SET *s);
+
+void defer_attach(STATE_SET *s, IDSA_RULE_CHAIN *c);
+unsigned int defer_mark(STATE_SET *s);
+int defer_past(STATE_SET *s, unsigned int mark);
+
+int defer_policy(char *name);
+void defer_counts(STATE_SET *s, int *queued, int *dropped, int *done);
+
+/****************************************************************************/
+
+void buffer_init(BUFFERS *b, int size, int keep);
+int buffer_fill(BUFFERS *b, int count);
+void buffer_flush(BUFFERS *b);
+
+char *buffer_get(BUFFERS *b);
+void buffer_put(BUFFERS *b, char *p);
+
+long buffer_bytes(BUFFERS *b);
+
+/****************************************************************************/
+
+QUOTA *quota_new();
+void quota_free(QUOTA *q);
+
+int quota_count(QUOTA *q, uid_t u);
+int quota_add(QUOTA *q, uid_t u);
+void quota_remove(QUOTA *q, uid_t u);
+
+/****************************************************************************/
+
+PARK *park_get(STATE_SET *s);
+void park_put(STATE_SET *s, PARK *k);
+void park_flush(STATE_SET *s);
+
+void park_add(STATE_SET *s, PARK *k);
+PARK *park_due(STATE_SET *s);
+int park_timeout(STATE_SET *s);
+long park_now();
+
+/****************************************************************************/
+
+/* slot i of the job table, i below set_jobsize */
+#define set_job(s, i)   (&((s)->s_slab[(i) / IDSAD_SLAB][(i) % IDSAD_SLAB]))
+#define set_jobsize(s)  ((s)->s_slabcount * IDSAD_SLAB)
+
 STATE_SET *set_new(int max, int start, int quota);
+JOB *set_jobnew(STATE_SET *s);
+void set_jobfree(STATE_SET *s, JOB *j);
+long set_bytes(STATE_SET *s);
 int set_parse(STATE_SET * s, char * file);
+int set_reparse(STATE_SET * s);
+int set_reparsed(STATE_SET * s);
+int set_swap(STATE_SET * s);
+IDSA_RULE_CHAIN *set_hold(STATE_SET * s);
+void set_release(STATE_SET * s, IDSA_RULE_CHAIN * c);
+void set_sweep(STATE_SET * s);
 void set_free(STATE_SET *s);
 
 /****************************************************************************/
@@ -54,6 +172,8 @@ int message_chain(STATE_SET *s);
 
 int message_start(STATE_SET *s, char *v);
 int message_stop(STATE_SET *s, char *v);
+int message_status(STATE_SET *s);
+int message_reload(STATE_SET *s, int carried);
 
 int message_connect(STATE_SET *s, pid_t p, uid_t u, gid_t g);
 int message_disconnect(STATE_SET *s, pid_t p, uid_t u, gid_t g);
@@ -31,7 +31,9 @@ volatile int signum = 0;
 void usage()
 {
   printf("idsad %s\n", VERSION);
-  printf("Usage: idsad [-knuv] [-f file] [-i username] [-M integer] [-m integer] [-p socket ...] [-r directory]\n");
+  printf("Usage: idsad [-knuv] [-D integer] [-d policy] [-f file] [-i username] [-M integer] [-m integer] [-p socket ...] [-r directory] [-T integer]\n");
+  printf("-D integer       queue up to integer log actions for a separate thread (default is none)\n");
+  printf("-d policy        when that queue is full: block, oldest or newest (default is block)\n");
   printf("-f file          use alternate configuration file (default is %s)\n", IDSAD_CONFIG);
   printf("-i username      run as this username (no default)\n");
   printf("-k               kill existing idsad instance (instead of lockfile)\n");
@@ -40,6 +42,7 @@ void usage()
   printf("-n               do not fork into background\n");
   printf("-p socket ...    whitespace delimited list of unix domain sockets to listen on (default is %s)\n", IDSA_SOCKET);
   printf("-r directory     chroot to directory (no default)\n");
+  printf("-T integer       evaluate rules in given number of threads (default is none)\n");
   printf("-u               honour umask when creating sockets\n");
   printf("-v               print version\n");
 
@@ -55,73 +58,206 @@ static void handle(int s)
   }
 }
 
-#ifndef MAXUID
-#define MAXUID 65535
-#endif
+/****************************************************************************/
+/* Does       : checks a new connection against the quota of its user       */
+/* Returns    : zero if it may stay, nonzero otherwise                      */
+/* Notes      : quotas only apply once half the table is in use, until then */
+/*              a user with many processes is welcome to a slot for each.   */
+/*              Root is never refused                                       */
+
+static int admit(STATE_SET * set, JOB * j)
+{
+  if ((2 * set->s_jobcount >= set->s_jobmax) && (quota_count(set->s_quota, j->j_uid) >= set->s_jobquota)) {
+    message_error_internal(set, "refusing connection of uid %d, over quota of %d connections", (int) j->j_uid, set->s_jobquota);
+    return 1;
+  }
+
+  if (quota_add(set->s_quota, j->j_uid)) {
+    message_error_system(set, errno, "unable to account for a new client");
+    return 1;
+  }
+
+  return 0;
+}
+
+static void watch(STATE_SET * set, JOB * j, int events)
+{
+  int result;
+
+  /* tell loop what job j is waiting for, if that has changed */
+
+  if (events == j->j_events) {
+    return;
+  }
+
+  if (events == 0) {		/* even an empty mask would report hangups */
+    result = loop_remove(set->s_loop, j->j_fd);
+  } else if (j->j_events == 0) {
+    result = loop_add(set->s_loop, j->j_fd, j->j_id, events);
+  } else {
+    result = loop_change(set->s_loop, j->j_fd, j->j_id, events);
+  }
+  j->j_events = events;
 
-static void prune(STATE_SET * set)
+  if (result) {
+    message_error_system(set, errno, "unable to update readiness notification");
+  }
+}
+
+static void backlog_add(STATE_SET * set, JOB * j)
 {
-  JOB *job;
-  uid_t uidlow, uidnext;
-  int i;
-  int count;
-  int start;
-  int ignore;
-
-  /* WARNING: assumes nonzero set->s_jobquota, otherwise drops everything */
-
-  message_error_internal(set, "too many connections, enforcing quotas");
-
-  /* get lowest nonroot uid */
-  uidnext = MAXUID;
-  for (i = 0; i < set->s_jobcount; i++) {
-    job = &(set->s_jobs[i]);
-    if ((job->j_uid > 0) && (uidnext > job->j_uid)) {
-      uidnext = job->j_uid;
+  if (j->j_backlog == 0) {
+    j->j_backlog = 1;
+    set->s_backlog[set->s_backlogcount++] = j;
+  }
+}
+
+static void backlog_remove(STATE_SET * set, JOB * j)
+{
+  int k;
+
+  for (k = 0; k < set->s_backlogcount; k++) {
+    if (set->s_backlog[k] == j) {
+      set->s_backlog[k] = set->s_backlog[--set->s_backlogcount];
+      j->j_backlog = 0;
+      return;
     }
   }
+}
 
+static void reap(STATE_SET * set, JOB * j)
+{
+  /* close job j, its slot goes back to the free list */
+
+  message_disconnect(set, j->j_pid, j->j_uid, j->j_gid);
+  if (j->j_backlog) {
+    backlog_remove(set, j);
+  }
+  if (j->j_events) {
+    loop_remove(set->s_loop, j->j_fd);
+  }
+  quota_remove(set->s_quota, j->j_uid);
+  job_end(j, set);
+  set_jobfree(set, j);
+}
+
+static void service(STATE_SET * set, JOB * j, int mask)
+{
+  int events;
+
+  if ((mask & job_writable(j)) && job_iswrite(j)) {	/* drain out write buffer */
 #ifdef TRACE
-  fprintf(stderr, "prune(): lowest candidate uid is %d\n", uidnext);
+    fprintf(stderr, "service(): write activity on client, fd=<%d>\n", j->j_fd);
 #endif
+    job_write(j);
+  }
+  if (((mask & LOOP_READ) || j->j_more) && !job_isend(j)) {	/* fill in read buffer, also rest of a batch */
+#ifdef TRACE
+    fprintf(stderr, "service(): read activity on client, fd=<%d>\n", j->j_fd);
+#endif
+    job_read(j, set);
+  }
 
-  ignore = 0;
-  while (uidnext < MAXUID) {
-    start = 1;
-    uidlow = uidnext;
-    uidnext = MAXUID;
-    count = 0;
-    /* start with first job not smaller than uid under consideration */
-    for (i = ignore; i < set->s_jobcount; i++) {
-      job = &(set->s_jobs[i]);
-      if (job->j_uid < uidlow) {	/* if smaller */
-	if (start)
-	  ignore++;		/* if at start, move start position for next inner */
-      } else if (job->j_uid == uidlow) {	/* equal */
-	if (start)
-	  ignore++;		/* if not encountered larger uid, can move start */
-	count++;
-	if (count >= set->s_jobquota) {	/* exceeded quota, start dropping things */
-	  job->j_state = JOB_STATEFIN;
-	}
-      } else {			/* larger */
-	start = 0;		/* from now on start can not be moved */
-	if (job->j_uid < uidnext) {	/* candidate for next outer loop */
-	  uidnext = job->j_uid;
-	}
+  if (set->s_pool) {		/* one request at a time goes to the workers */
+    if (job_iswork(j)) {
+      job_submit(j, set);
+    }
+  } else {
+    if (job_iswork(j)) {
+      job_do(j, set);
+      message_chain(set);
+      /* loop will not tell us about input already buffered */
+      if (job_iswork(j) && (j->j_more || (io_frame(j) > 0))) {
+	backlog_add(set, j);
       }
     }
   }
 
+  if (job_isend(j)) {		/* are we finished ? */
+    if ((j->j_work == NULL) && (j->j_park == NULL)) {
+      reap(set, j);
+      return;
+    }
+    events = 0;			/* closed once the worker or module is done with it */
+  } else {
+    events = 0;
+    if (j->j_rl < IDSA_M_MESSAGE) {
+      events |= LOOP_READ;
+    }
+    if (job_iswrite(j)) {
+      events |= job_writable(j);
+    }
+  }
+
+  job_trim(j, set);
+  watch(set, j, events);
+}
+
+static void finish(STATE_SET * set)
+{
+  WORK *w, *next;
+  JOB *j;
+
+  /* hand replies of workers back to their jobs */
+
+  for (w = worker_collect(set); w != NULL; w = next) {
+    next = w->w_next;
+    j = w->w_job;
+    job_finish(j, set, w);
+    worker_put(set, w);
+    service(set, j, 0);
+  }
+
+  message_chain(set);
+}
+
+static void unpark(STATE_SET * set)
+{
+  PARK *k, *next;
+  JOB *j;
+
+  /* continue suspended evaluations which can make progress */
+
+  for (k = park_due(set); k != NULL; k = next) {
+    next = k->k_next;
+    j = k->k_job;
+    job_resume(j, set);
+    service(set, j, 0);
+  }
+
+  message_chain(set);
+}
+
+static void reload(STATE_SET * set)
+{
+  /* rules reread in the background take over, evaluations under */
+  /* the old ones finish there */
+
+  switch (set_reparsed(set)) {
+  case 0:
+    message_chain(set);
+    message_reload(set, set_swap(set));
+    break;
+  case 1:
+    message_reload(set, -1);
+    break;
+  default:
+    return;
+  }
+
+  if (set->s_rehup && set_reparse(set)) {	/* file changed again meanwhile */
+    message_reload(set, -1);
+  }
 }
 
 int main(int argc, char **argv)
 {
-  int mfd, smfd, sr;		/* variables for select */
-  fd_set fsr, fsw;
+  LOOP_READY ready[IDSAD_EVENTS];	/* results of readiness wait */
+  int sr, ms;
 
   int lc, *ltable;		/* listen variables */
-  JOB *j, *jtmp;		/* job variables */
+  JOB *j;			/* job variables */
+  unsigned int key;
 
   STATE_SET *set;		/* almost all state kept here */
 
@@ -139,8 +275,10 @@ int main(int argc, char **argv)
   int zap;			/* kill any running instance before starting */
 
   int max, start, quota;	/* number of clients: maximum/start/per user */
+  int threads;			/* number of rule evaluation threads */
+  int defer, policy;		/* length of queue for deferred actions, what to do once full */
 
-  int i, k, t;			/* misc */
+  int i, k;			/* misc */
 
   /* cmdline defaults */
   id = NULL;
@@ -152,6 +290,9 @@ int main(int argc, char **argv)
   /* defaults */
   quota = IDSAD_JOBQUOTA;
   start = IDSAD_JOBSTART;
+  threads = 0;
+  defer = 0;
+  policy = DEFER_BLOCK;
   max = 2 * getdtablesize() / 3;
   if (max < IDSAD_JOBSTART) {	/* getdtablesize returned something unrealistic */
     max = IDSAD_JOBSTART;	/* fall back to the small startup value */
@@ -240,7 +381,6 @@ int main(int argc, char **argv)
     /* clear out umask */
     mask = umask(S_IXUSR | S_IXGRP | S_IXOTH);
   }
-  mfd = 0;
   i = 1;
   k = 1;
   while (i < argc) {
@@ -260,9 +400,6 @@ int main(int argc, char **argv)
 	      fprintf(stderr, "idsad: unable to listen on socket %s: %s\n", argv[i] + k, strerror(errno));
 	      exit(1);
 	    }
-	    if (ltable[lc] > mfd) {
-	      mfd = ltable[lc];
-	    }
 	    lc++;
 	    k = 0;
 	    i++;
@@ -342,6 +479,60 @@ int main(int argc, char **argv)
 	i++;
 	k = 1;
 	break;
+      case 'T':
+	k++;
+	if (argv[i][k] == '\0') {
+	  k = 0;
+	  i++;
+	}
+	if (i >= argc) {
+	  fprintf(stderr, "idsad: -T option requires an integer as parameter\n");
+	  exit(1);
+	}
+	threads = atoi(argv[i] + k);
+	if ((threads < 0) || (threads > IDSAD_MAXTHREADS)) {
+	  fprintf(stderr, "idsad: -T option requires an integer between 0 and %d\n", IDSAD_MAXTHREADS);
+	  exit(1);
+	}
+	i++;
+	k = 1;
+	break;
+      case 'D':
+	k++;
+	if (argv[i][k] == '\0') {
+	  k = 0;
+	  i++;
+	}
+	if (i >= argc) {
+	  fprintf(stderr, "idsad: -D option requires an integer as parameter\n");
+	  exit(1);
+	}
+	defer = atoi(argv[i] + k);
+	if (defer < 0) {
+	  fprintf(stderr, "idsad: -D option requires a positive integer\n");
+	  exit(1);
+	}
+	i++;
+	k = 1;
+	break;
+      case 'd':
+	k++;
+	if (argv[i][k] == '\0') {
+	  k = 0;
+	  i++;
+	}
+	if (i >= argc) {
+	  fprintf(stderr, "idsad: -d option requires a policy as parameter\n");
+	  exit(1);
+	}
+	policy = defer_policy(argv[i] + k);
+	if (policy < 0) {
+	  fprintf(stderr, "idsad: -d option requires one of block, oldest or newest\n");
+	  exit(1);
+	}
+	i++;
+	k = 1;
+	break;
 	/* these options have already been handled */
       case 'v':
       case 'u':
@@ -396,7 +587,6 @@ int main(int argc, char **argv)
     if (ltable) {
       ltable[0] = udomainlisten(IDSA_SOCKET, IDSAD_BACKLOG, zap);
       if (ltable[0] != (-1)) {
-	mfd = ltable[0];
 	lc = 1;
       } else {
 	fprintf(stderr, "idsad: unable to listen on socket %s: %s\n", IDSA_SOCKET, strerror(errno));
@@ -413,9 +603,36 @@ int main(int argc, char **argv)
   drop_root("idsad", id, rootdir);
   drop_fork("idsad");
 
+  /* listeners, every possible client, the worker and reload pipes share one set */
+  set->s_loop = loop_new(lc + set->s_jobmax + 2);
+  if (set->s_loop == NULL) {
+    fprintf(stderr, "idsad: unable to set up readiness notification: %s\n", strerror(errno));
+    exit(1);
+  }
+  for (i = 0; i < lc; i++) {
+    if (loop_add(set->s_loop, ltable[i], LOOP_LISTEN | i, LOOP_READ)) {
+      fprintf(stderr, "idsad: unable to watch listening socket: %s\n", strerror(errno));
+      exit(1);
+    }
+  }
+
   /* cache our own uid */
   set->s_gid = getgid();
 
+  /* threads do not survive a fork, so only now */
+  if (threads > 0) {
+    if (worker_start(set, threads)) {
+      fprintf(stderr, "idsad: unable to start %d threads: %s\n", threads, strerror(errno));
+      exit(1);
+    }
+  }
+  if (defer > 0) {
+    if (defer_start(set, defer, policy)) {
+      fprintf(stderr, "idsad: unable to queue %d actions: %s\n", defer, strerror(errno));
+      exit(1);
+    }
+  }
+
   sag.sa_handler = handle;
 /*  sag.sa_sigaction = NULL;*/
   sigfillset(&(sag.sa_mask));
@@ -423,6 +640,7 @@ int main(int argc, char **argv)
   sag.sa_flags = SA_RESTART;	/* minor ones */
   sigaction(SIGCHLD, &sag, NULL);
   sigaction(SIGHUP, &sag, NULL);
+  sigaction(SIGUSR1, &sag, NULL);
 
 /*  signal(SIGCHLD, handle);*/
 /*  signal(SIGHUP, handle);*/
@@ -467,12 +685,18 @@ int main(int argc, char **argv)
 #endif
       run = 0;
       signum = 0;
-      /* give us a second before interrupting select */
+      /* give us a second before interrupting the wait */
       alarm(1);
       break;
     case SIGHUP:
       signum = 0;
-      message_error_internal(set, "hangup signal ignored");
+      if (set_reparse(set)) {
+	message_reload(set, -1);
+      }
+      break;
+    case SIGUSR1:
+      signum = 0;
+      message_status(set);
       break;
     case SIGALRM:		/* ha, this should never happen */
       signum = 0;
@@ -486,126 +710,84 @@ int main(int argc, char **argv)
       break;
     }
 
-    FD_ZERO(&fsr);
-    FD_ZERO(&fsw);
-
-    /* listen sockets */
-    for (i = 0; i < lc; i++) {
-      FD_SET(ltable[i], &fsr);
-    }
-
-    /* connected sockets */
-    for (i = 0; i < set->s_jobcount; i++) {
-      j = &(set->s_jobs[i]);
-
-      FD_SET(j->j_fd, &fsr);	/* add all to read list */
-
-      if (job_iswrite(j)) {	/* add those who have something to write list */
-	FD_SET(j->j_fd, &fsw);
+    /* do not sleep if some jobs still have requests buffered */
+    ms = set->s_backlogcount ? 0 : park_timeout(set);
+    if (set->s_retired) {	/* replaced rules, the executor does not wake us */
+      set_sweep(set);
+      if (set->s_retired && ((ms < 0) || (ms > IDSAD_SWEEP))) {
+	ms = IDSAD_SWEEP;
       }
     }
-
-    sr = select(mfd + 1, &fsr, &fsw, NULL, NULL);
+    sr = loop_wait(set->s_loop, ready, IDSAD_EVENTS, ms);
     set->s_time = time(NULL);
-
-    if (sr > 0) {
-
-      /* try to accept a new connection */
-      for (i = 0; i < lc; i++) {
-	if (FD_ISSET(ltable[i], &fsr)) {
-	  if ((set->s_jobcount >= set->s_jobsize) && (set->s_jobsize < set->s_jobmax)) {	/* make space for new slot if required */
-	    t = ((2 * set->s_jobsize) < set->s_jobmax) ? 2 * set->s_jobsize : set->s_jobmax;
-	    jtmp = realloc(set->s_jobs, sizeof(JOB) * t);
-	    if (jtmp) {
-	      set->s_jobs = jtmp;
-	      set->s_jobsize = t;
-	    } else {		/* no space */
-	      message_error_system(set, errno, "unable to service a new client because of memory limitations");
+    set->s_clock = idsa_monotonic();
+
+    for (k = 0; k < sr; k++) {
+      key = ready[k].r_key;
+
+      if (key & LOOP_LISTEN) {	/* try to accept a new connection */
+	i = key & (~LOOP_LISTEN);
+	j = set_jobnew(set);
+	if (j) {
+	  if (job_accept(j, ltable[i]) == 0) {
+	    if (admit(set, j)) {
+	      job_end(j, set);
+	      set_jobfree(set, j);
+	    } else if (message_connect(set, j->j_pid, j->j_uid, j->j_gid) == IDSA_CHAIN_DROP) {	/* instruction to drop connection */
+	      message_disconnect(set, j->j_pid, j->j_uid, j->j_gid);
+	      quota_remove(set->s_quota, j->j_uid);
+	      job_end(j, set);
+	      set_jobfree(set, j);
+	    } else if (loop_add(set->s_loop, j->j_fd, j->j_id, j->j_events)) {
+	      message_error_system(set, errno, "unable to service a new client because of notification failure");
+	      quota_remove(set->s_quota, j->j_uid);
+	      job_end(j, set);
+	      set_jobfree(set, j);
 	    }
+	  } else {
+	    message_error_system(set, errno, "unable to service a new client because of accept failure");
+	    set_jobfree(set, j);
 	  }
-	  if (set->s_jobcount < set->s_jobsize) {
-	    j = &(set->s_jobs[set->s_jobcount]);
-	    if (job_accept(j, ltable[i]) == 0) {
-	      if (message_connect(set, j->j_pid, j->j_uid, j->j_gid) == IDSA_CHAIN_DROP) {	/* instruction to drop connection */
-		j->j_state = JOB_STATEFIN;
-	      }
-	      if (mfd < j->j_fd) {	/* win: update mfd as little as possible ;-) */
-		mfd = j->j_fd;
-	      }
-	      set->s_jobcount++;
-	    } else {
-	      message_error_system(set, errno, "unable to service a new client because of accept failure");
-	    }
-	  } else {		/* should not happen. But if then we drop otherwise select comes back immediately = busy loop */
-	    job_drop(ltable[i]);
-	    /* message_error_internal(set, "unable to service a new client because of accept failure"); */
+	} else {		/* drop it, otherwise we come back immediately = busy loop */
+	  if (set->s_jobcount < set->s_jobmax) {
+	    message_error_system(set, errno, "unable to service a new client because of memory limitations");
 	  }
+	  job_drop(ltable[i]);
 	}
-      }				/* end of handling listeners */
 
-      /* handle connected sockets */
-      for (i = 0; i < set->s_jobcount; i++) {
-	j = &(set->s_jobs[i]);
+      } else if (key == LOOP_WAKE) {	/* workers have results */
+	finish(set);
 
-	if (FD_ISSET(j->j_fd, &fsw)) {	/* drain out write buffer */
-#ifdef TRACE
-	  fprintf(stderr, "main(): write activity on client, fd=<%d>\n", j->j_fd);
-#endif
-	  job_write(j);
-	}
-	if (FD_ISSET(j->j_fd, &fsr)) {	/* fill in read buffer */
-#ifdef TRACE
-	  fprintf(stderr, "main(): read activity on client, fd=<%d>\n", j->j_fd);
-#endif
-	  job_read(j);
-	}
-	if (job_iswork(j)) {	/* are we waiting for input and has it arrived ? */
-	  job_do(j, set);
-	  message_chain(set);
+      } else if (key == LOOP_RELOAD) {	/* rules have been reread */
+	reload(set);
 
+      } else if (key & LOOP_PARK) {	/* something a module waits for */
+	j = set_job(set, key & (~LOOP_PARK));
+	if (j->j_park) {
+	  j->j_park->k_ready = 1;
 	}
-	if (job_isend(j)) {	/* are we finished ? */
-	  message_disconnect(set, j->j_pid, j->j_uid, j->j_gid);
-	  smfd = j->j_fd;
-	  job_end(j);
-	  if (i < (set->s_jobcount - 1)) {
-	    job_copy(j, &(set->s_jobs[set->s_jobcount - 1]));
-	    i--;		/* WARNING: decrement so that copied job gets slice */
-	  }
-	  if (set->s_jobcount > 0) {
-	    set->s_jobcount--;
-	  }
-	  if (smfd >= mfd) {	/* recompute mfd if we have a reason */
 
-	    mfd = ltable[0];
-	    for (t = 1; t < lc; t++) {
-	      if (ltable[t] > mfd) {
-		mfd = ltable[t];
-	      }
-	    }
-	    for (t = 0; t < set->s_jobcount; t++) {
-	      if (set->s_jobs[t].j_fd > mfd) {
-		mfd = set->s_jobs[t].j_fd;
-	      }
-	    }
-#ifdef TRACE
-	    fprintf(stderr, "main(): reduced mfd from <%d> to <%d>\n", smfd, mfd);
-#endif
-	  }
-	}			/* end of shutdown */
-      }				/* end of handling connected sockets */
-
-      /* WARNING: jobcount should never exceed jobmax */
-      if (lc + set->s_jobcount >= set->s_jobmax) {
-	/* drop those nonroot users which are over quota */
-#ifdef TRACE
-	fprintf(stderr, "main(): need to prune\n");
-#endif
-	prune(set);
+      } else if (key < set_jobsize(set)) {	/* connected socket */
+	j = set_job(set, key);
+	if (j->j_fd >= 0) {	/* unless it was closed earlier in this batch */
+	  service(set, j, ready[k].r_mask);
+	}
       }
+    }
+
+    /* jobs which reached IDSAD_BATCH get one more turn each */
+    for (k = set->s_backlogcount; (k > 0) && (set->s_backlogcount > 0); k--) {
+      j = set->s_backlog[0];
+      set->s_backlog[0] = set->s_backlog[--set->s_backlogcount];
+      j->j_backlog = 0;
+      service(set, j, 0);
+    }
 
+    if (set->s_parked) {
+      unpark(set);
     }
-    /* end of handling select */
+
+    /* end of handling readiness */
   } while (run);
 
 #ifdef TRACE
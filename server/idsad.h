@@ -20,9 +20,46 @@
 #define IDSAD_JOBSTART 64
 #endif
 
+/* job slots allocated at once, grown in chunks so that jobs never move */
+#ifndef IDSAD_SLAB
+#define IDSAD_SLAB 64
+#endif
+
+/* unused read and write buffers kept around, unless preallocated by -M */
+#ifndef IDSAD_SPARE
+#define IDSAD_SPARE 16
+#endif
+
+/* readiness events handled per wakeup of the main loop */
+#ifndef IDSAD_EVENTS
+#define IDSAD_EVENTS 64
+#endif
+
+/* requests evaluated for one client before others get a turn, as many */
+/* as idsa_log_batch sends at once                                       */
+#ifndef IDSAD_BATCH
+#define IDSAD_BATCH 64
+#endif
+
+/* milliseconds between looks at rules replaced by a reload, while the */
+/* executor of deferred actions may still have some of their actions    */
+#ifndef IDSAD_SWEEP
+#define IDSAD_SWEEP 100
+#endif
+
+/* upper limit for -T */
+#ifndef IDSAD_MAXTHREADS
+#define IDSAD_MAXTHREADS 64
+#endif
+
 /* maximum number of jobs per nonroot uid */
 #ifndef IDSAD_JOBQUOTA
 #define IDSAD_JOBQUOTA 32
 #endif
 
+/* buckets in table of connections per uid, power of two */
+#ifndef IDSAD_QUOTAHASH
+#define IDSAD_QUOTAHASH 256
+#endif
+
 #endif
@@ -1,19 +1,37 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
 #include <idsa_internal.h>
 
 #include "structures.h"
 #include "functions.h"
 
+static void io_trust(STATE_SET * s, IDSA_EVENT * e, pid_t p, uid_t u, gid_t g, time_t t)
+{
+  if ((u != 0) && (g != s->s_gid)) {	/* if it is not root or our own group, we don't trust it */
+    idsa_uid(e, u);
+    idsa_gid(e, g);
+    idsa_pid(e, p);
+
+    /* globally cached stuff */
+    idsa_time(e, t);
+    idsa_host(e, s->s_hostname);
+  }
+}
+
 int io_readmessage(STATE_SET * s, JOB * j, IDSA_EVENT * e)
 {
   int result = IDSA_IO_OK;
   int l;
 
-  l = idsa_event_frombuffer(e, j->j_rbuf, j->j_rl);
+  l = idsa_event_lazybuffer(e, j->j_rbuf, j->j_rl);
   if (l > 0) {
     if (idsa_request_check(e)) {	/* corrupted */
 #ifdef TRACE
@@ -24,15 +42,7 @@ int io_readmessage(STATE_SET * s, JOB * j, IDSA_EVENT * e)
 #ifdef TRACE
       idsa_event_dump(e, stderr);
 #endif
-      if ((j->j_uid != 0) && (j->j_gid != s->s_gid)) {	/* if it is not root or our own group, we don't trust it */
-	idsa_uid(e, j->j_uid);
-	idsa_gid(e, j->j_gid);
-	idsa_pid(e, j->j_pid);
-
-	/* globally cached stuff */
-	idsa_time(e, s->s_time);
-	idsa_host(e, s->s_hostname);
-      }
+      io_trust(s, e, j->j_pid, j->j_uid, j->j_gid, s->s_time);
       result = IDSA_IO_OK;
     }
     memmove(j->j_rbuf, j->j_rbuf + l, j->j_rl - l);
@@ -51,18 +61,96 @@ int io_readmessage(STATE_SET * s, JOB * j, IDSA_EVENT * e)
   return result;
 }
 
+/****************************************************************************/
+/* Does       : finds the end of the last complete message in read buffer,  */
+/*              without decoding anything                                   */
+/* Returns    : length of complete messages, zero if there are none, -1 if  */
+/*              the first will never fit into the buffer                    */
+/* Notes      : text events are terminated by a newline, escaping removes   */
+/*              any newlines from values. Packed ones carry their length,   */
+/*              so the buffer has to be walked from the front               */
+
+int io_frame(JOB * j)
+{
+  int i, l;
+
+  for (i = 0; i < j->j_rl; i += l) {
+    l = idsa_wire_frame(j->j_rbuf + i, j->j_rl - i);
+    if (l <= 0) {
+      if ((l < 0) && (i == 0)) {
+	return -1;
+      }
+      break;
+    }
+  }
+
+  return i;
+}
+
+/****************************************************************************/
+/* Does       : decodes the request at offset o of the work handed to a     */
+/*              worker, like io_readmessage                                 */
+/* Returns    : length of request, -1 on failure                            */
+/* Notes      : may run in any thread, only reads the constant parts of s   */
+
+int io_decode(STATE_SET * s, WORK * w, int o, IDSA_EVENT * e)
+{
+  int l;
+
+  l = idsa_event_lazybuffer(e, w->w_buffer + o, w->w_length - o);
+  if (l <= 0) {
+    return -1;
+  }
+
+  if (idsa_request_check(e)) {	/* corrupted */
+#ifdef TRACE
+    fprintf(stderr, "io_decode(): message check failed\n");
+#endif
+    return -1;
+  }
+
+  io_trust(s, e, w->w_pid, w->w_uid, w->w_gid, w->w_time);
+
+  return l;
+}
+
+/****************************************************************************/
+/* Does       : tells clients which rules made each reply, so that they can */
+/*              discard their cached verdicts once rules change             */
+/* Notes      : may run in any thread, s_generation only changes while the  */
+/*              workers are idle                                            */
+
+void io_stamp(STATE_SET * s, IDSA_EVENT * e)
+{
+  idsa_event_setappend(e, idsa_resolve_name(IDSA_O_GENERATION), IDSA_T_INT, &(s->s_generation));
+}
+
 int io_writereply(STATE_SET * s, JOB * j, IDSA_EVENT * e)
 {
   int l;
 
+  io_stamp(s, e);
+
 #ifdef TRACE
   fprintf(stderr, "io_writereply(): writing result, size %d\n", e->e_size);
 #endif
 
-  l = idsa_event_tobuffer(e, j->j_wbuf, IDSA_M_MESSAGE);
+  /* appended, caller drains once all replies are in */
+  if (j->j_wbuf == NULL) {
+    j->j_wbuf = buffer_get(&(s->s_wbufs));
+    if (j->j_wbuf == NULL) {
+      return IDSA_IO_FAIL;
+    }
+  }
+
+  if (j->j_wire == IDSA_WIRE_PACKED) {
+    l = idsa_event_topacked(e, j->j_wbuf + j->j_wl, JOB_WRITEBUF - j->j_wl);
+  } else {
+    l = idsa_event_tobuffer(e, j->j_wbuf + j->j_wl, JOB_WRITEBUF - j->j_wl);
+  }
   if (l > 0) {
-    j->j_wl = l;
-    return io_drain(j);
+    j->j_wl += l;
+    return IDSA_IO_OK;
   } else {
     return IDSA_IO_FAIL;
   }
@@ -73,6 +161,10 @@ int io_drain(JOB * j)
   int result;
   int wr;
 
+  if (j->j_ring) {
+    return ring_drain(j);
+  }
+
   if (j->j_wl > 0) {
     wr = write(j->j_fd, j->j_wbuf, j->j_wl);
     if (wr == j->j_wl) {
@@ -101,3 +193,112 @@ int io_drain(JOB * j)
 
   return result;
 }
+
+/****************************************************************************/
+/* Returns    : the rest of the word of hello h which starts with w, NULL   */
+/*              if there is none                                            */
+
+static char *io_word(char *h, char *w)
+{
+  char *ptr;
+  int l;
+
+  l = strlen(w);
+  for (ptr = h + strlen(IDSA_HELLO); *ptr != '\0'; ptr++) {
+    if ((ptr[-1] == ' ') && !strncmp(ptr, w, l)) {
+      if ((w[l - 1] == '=') || (ptr[l] == ' ') || (ptr[l] == '\0')) {
+	return ptr + l;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/****************************************************************************/
+/* Returns    : nonzero if the read buffer holds an IDSA_HELLO, which sets  */
+/*              j_wire to the most recent format up to the one wanted       */
+/* Notes      : the hello fills the entire buffer, so that older servers    */
+/*              hang up on it as too large instead of waiting for the rest. */
+/*              Only the first one counts, later ones are plain junk        */
+
+int io_hello(JOB * j)
+{
+  char *ptr, *end;
+  int wire;
+
+  if ((j->j_ring != NULL) || (j->j_wire != IDSA_WIRE_TEXT)) {
+    return 0;
+  }
+  if ((j->j_rl != IDSA_HELLO_SIZE) || (j->j_rbuf[IDSA_HELLO_SIZE - 1] != '\n')) {
+    return 0;
+  }
+  if (memcmp(j->j_rbuf, IDSA_HELLO, strlen(IDSA_HELLO))) {
+    return 0;
+  }
+
+  j->j_rbuf[IDSA_HELLO_SIZE - 1] = '\0';
+
+  ptr = io_word(j->j_rbuf, IDSA_HELLO_WIRE);
+  if (ptr) {
+    wire = strtol(ptr, &end, 10);
+    if ((end > ptr) && (wire > IDSA_WIRE_TEXT)) {
+      j->j_wire = (wire < IDSA_WIRE_PACKED) ? wire : IDSA_WIRE_PACKED;
+    }
+  }
+
+  return 1;
+}
+
+/****************************************************************************/
+/* Does       : answers the hello in the read buffer with the format agreed */
+/*              and, if asked for, a ring of its own (see ring.c)           */
+/* Returns    : zero on success, nonzero if the job should be ended         */
+
+int io_greet(JOB * j, STATE_SET * s)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char control[CMSG_SPACE(sizeof(int))];
+  char answer;
+  int fd, l;
+
+  fd = (-1);
+  if (io_word(j->j_rbuf, IDSA_HELLO_RING)) {
+    fd = ring_offer(j, s);
+  }
+
+  j->j_rl = 0;
+
+  answer = '0' + j->j_wire;
+  iov.iov_base = &answer;
+  iov.iov_len = 1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (fd >= 0) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  l = sendmsg(j->j_fd, &msg, 0);
+
+  if (fd >= 0) {		/* mapping stays valid */
+    close(fd);
+  }
+
+  if (l != 1) {
+    ring_end(j, s);
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -15,19 +16,37 @@
 
 #include "ucred.h"
 
+#include "idsad.h"
 #include "structures.h"
 #include "functions.h"
 
-int job_end(JOB * j)
+int job_end(JOB * j, STATE_SET * s)
 {
   int result;
 
+  ring_end(j, s);
   result = close(j->j_fd);
 
   return result;
 }
 
-int job_read(JOB * j)
+/****************************************************************************/
+/* Does       : hands buffers which have been emptied back to the pool      */
+/* Notes      : keeps idle clients down to the size of their JOB            */
+
+void job_trim(JOB * j, STATE_SET * s)
+{
+  if ((j->j_rl == 0) && j->j_rbuf) {
+    buffer_put(&(s->s_rbufs), j->j_rbuf);
+    j->j_rbuf = NULL;
+  }
+  if ((j->j_wl == 0) && j->j_wbuf) {
+    buffer_put(&(s->s_wbufs), j->j_wbuf);
+    j->j_wbuf = NULL;
+  }
+}
+
+int job_read(JOB * j, STATE_SET * s)
 {
   int result = 0;
   int rr;
@@ -35,6 +54,23 @@ int job_read(JOB * j)
   int i;
 #endif
 
+  if (j->j_rbuf == NULL) {
+    j->j_rbuf = buffer_get(&(s->s_rbufs));
+    if (j->j_rbuf == NULL) {
+#ifdef TRACE
+      fprintf(stderr, "job_read(): unable to get read buffer\n");
+#endif
+      j->j_state = JOB_STATEFIN;
+      return 1;
+    }
+  }
+
+  if (j->j_ring) {
+    return ring_read(j, s);
+  }
+
+  j->j_more = 0;
+
   if (j->j_rl < IDSA_M_MESSAGE) {
     rr = read(j->j_fd, j->j_rbuf + j->j_rl, IDSA_M_MESSAGE - (j->j_rl));
     switch (rr) {
@@ -73,7 +109,15 @@ int job_read(JOB * j)
       fprintf(stderr, ":%d>\n", rr);
 #endif
 
+      if (rr == IDSA_M_MESSAGE - j->j_rl) {	/* there may well be more */
+	j->j_more = 1;
+      }
       j->j_rl = j->j_rl + rr;
+
+      if (io_hello(j) && io_greet(j, s)) {	/* options agreed, maybe a ring */
+	j->j_state = JOB_STATEFIN;
+	result++;
+      }
       break;
     }
 
@@ -106,83 +150,281 @@ int job_write(JOB * j)
   return result;
 }
 
-void job_copy(JOB * t, JOB * s)
+/****************************************************************************/
+/* Does       : sends whatever replies have accumulated in one write        */
+/* Notes      : a dropped job stays dropped, but still gets its reply       */
+
+static void job_flush(JOB * j)
 {
-  t->j_fd = s->j_fd;
+  switch (io_drain(j)) {
+  case IDSA_IO_OK:
+    break;
+  case IDSA_IO_WAIT:
+    if (j->j_state != JOB_STATEFIN) {
+      j->j_state = JOB_STATEWRITE;
+    }
+    break;
+  case IDSA_IO_FAIL:
+    j->j_state = JOB_STATEFIN;
+    break;
+  }
+}
 
-  t->j_pid = s->j_pid;
-  t->j_uid = s->j_uid;
-  t->j_gid = s->j_gid;
+/****************************************************************************/
+/* Does       : puts the evaluation a module suspended in s_local aside,    */
+/*              giving the set an unused local, request and reply instead   */
+/* Returns    : zero on success, nonzero if out of memory                   */
 
-  t->j_state = s->j_state;
+static int job_park(JOB * j, STATE_SET * s)
+{
+  PARK *k;
+  IDSA_RULE_LOCAL *l;
+  IDSA_EVENT *e;
 
-  if (s->j_rl > 0) {
-    memcpy(t->j_rbuf, s->j_rbuf, s->j_rl);
-    t->j_rl = s->j_rl;
-  } else {
-    t->j_rl = 0;
+  k = park_get(s);
+  if (k == NULL) {
+    return 1;
   }
 
-  if (s->j_wl > 0) {
-    memcpy(t->j_wbuf, s->j_wbuf, s->j_wl);
-    t->j_wl = s->j_wl;
-  } else {
-    t->j_wl = 0;
-  }
+  l = k->k_local;
+  k->k_local = s->s_local;
+  s->s_local = l;
+
+  e = k->k_request;
+  k->k_request = s->s_request;
+  s->s_request = e;
+
+  e = k->k_reply;
+  k->k_reply = s->s_reply;
+  s->s_reply = e;
+
+  k->k_job = j;
+  k->k_chain = set_hold(s);
+  j->j_park = k;
+
+  park_add(s, k);
+
+  return 0;
 }
 
+/****************************************************************************/
+/* Does       : evaluates up to IDSAD_BATCH complete requests in the read   */
+/*              buffer, then writes all replies at once                     */
+/* Notes      : stops early if the next reply can not be made room for, or  */
+/*              if a module suspends an evaluation. The job is then parked  */
+/*              until job_resume, other requests of the client wait their   */
+/*              turn. A batch larger than the read buffer is read on the    */
+/*              spot instead of waiting for the loop to report it           */
+
 int job_do(JOB * j, STATE_SET * s)
 {
   int result = 0;
+  int i, status;
 
 #ifdef TRACE
   fprintf(stderr, "job_do(): state <0x%04x>\n", j->j_state);
 #endif
 
-  switch (io_readmessage(s, j, s->s_request)) {
-  case IDSA_IO_OK:
+  for (i = 0; (i < IDSAD_BATCH) && (j->j_state == JOB_STATEWAIT); i++) {
+    if ((j->j_wl > JOB_WRITEBUF - IDSA_M_MESSAGE) && (io_drain(j) != IDSA_IO_OK)) {
+      break;			/* job_flush below sorts out the state */
+    }
+
+    status = io_readmessage(s, j, s->s_request);
+    if ((status == IDSA_IO_WAIT) && j->j_more) {
+      job_read(j, s);
+      if (j->j_state == JOB_STATEWAIT) {
+	status = io_readmessage(s, j, s->s_request);
+      }
+    }
+
+    switch (status) {
+    case IDSA_IO_OK:
 #ifdef TRACE
-    fprintf(stderr, "job_do(): read event, checking rules\n");
+      fprintf(stderr, "job_do(): read event, checking rules\n");
 #endif
 
-    idsa_reply_init(s->s_reply);
-    idsa_local_init(s->s_chain, s->s_local, s->s_request, s->s_reply);
-    result = idsa_chain_run(s->s_chain, s->s_local);
-    idsa_local_quit(s->s_chain, s->s_local);
+      idsa_reply_init(s->s_reply);
+      idsa_local_init(s->s_chain, s->s_local, s->s_request, s->s_reply);
+      idsa_local_settime(s->s_local, s->s_time, s->s_clock);
+      idsa_local_suspend(s->s_local);
+      result = idsa_chain_run(s->s_chain, s->s_local);
+
+      while ((result == IDSA_CHAIN_AGAIN) && job_park(j, s)) {	/* nowhere to park, insist on an answer */
+	idsa_local_expire(s->s_local);
+	result = idsa_chain_run(s->s_chain, s->s_local);
+      }
+      if (result == IDSA_CHAIN_AGAIN) {
+	i = IDSAD_BATCH;
+	break;
+      }
+
+      idsa_local_quit(s->s_chain, s->s_local);
+
+      if (s->s_request->e_fault) {	/* a value did not scan, as if unreadable */
+	j->j_state = JOB_STATEFIN;
+	break;
+      }
+
+      if (io_writereply(s, j, s->s_reply) != IDSA_IO_OK) {
+	j->j_state = JOB_STATEFIN;
+      }
+
+      if (result == IDSA_CHAIN_DROP) {
+	j->j_state = JOB_STATEFIN;
+      }
 
-    switch (io_writereply(s, j, s->s_reply)) {
-    case IDSA_IO_OK:
-      /* j->j_state=JOB_STATEWAIT; */
       break;
     case IDSA_IO_WAIT:
-      j->j_state = JOB_STATEWRITE;
+#ifdef TRACE
+      fprintf(stderr, "job_do(): will restart readevent\n");
+#endif
+      i = IDSAD_BATCH;
       break;
     case IDSA_IO_FAIL:
+    default:
+#ifdef TRACE
+      fprintf(stderr, "job_do(): reading event failed, giving up\n");
+#endif
       j->j_state = JOB_STATEFIN;
       break;
     }
+  }
 
-    if (result == IDSA_CHAIN_DROP) {
-      j->j_state = JOB_STATEFIN;
-    }
+  job_flush(j);
 
-    break;
-  case IDSA_IO_WAIT:
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : continues the parked evaluation of job j once it is due     */
+/* Returns    : as idsa_chain_run, IDSA_CHAIN_AGAIN if parked once more     */
+
+int job_resume(JOB * j, STATE_SET * s)
+{
+  PARK *k;
+  int result;
+
+  k = j->j_park;
+
+  /* under the rules it started with, even if reloaded since */
+  result = idsa_chain_run(k->k_chain, k->k_local);
+  if (result == IDSA_CHAIN_AGAIN) {
+    park_add(s, k);
+    return result;
+  }
+  idsa_local_quit(k->k_chain, k->k_local);
+
+  set_release(s, k->k_chain);
+  j->j_park = NULL;
+  s->s_parkdone = 1;
+
+  if (k->k_request->e_fault) {
+    j->j_state = JOB_STATEFIN;
+  } else if (io_writereply(s, j, k->k_reply) != IDSA_IO_OK) {
+    j->j_state = JOB_STATEFIN;
+  }
+  if (result == IDSA_CHAIN_DROP) {
+    j->j_state = JOB_STATEFIN;
+  }
+
+  park_put(s, k);
+  job_flush(j);
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : hands all complete requests of job j to the workers         */
+/* Notes      : job keeps state wait, j_work marks it busy until finished.  */
+/*              Requests stay in the read buffer until job_finish, so that  */
+/*              reads in the meantime simply append                         */
+
+int job_submit(JOB * j, STATE_SET * s)
+{
+  WORK *w;
+  int l;
+
+  l = io_frame(j);
+  if (l == 0) {			/* incomplete, wait for more */
+    return 0;
+  }
+  if (l < 0) {
 #ifdef TRACE
-    fprintf(stderr, "job_do(): will restart readevent\n");
+    fprintf(stderr, "job_submit(): message %d, too large\n", j->j_rl);
 #endif
-    j->j_state = JOB_STATEWAIT;
-    break;
-  case IDSA_IO_FAIL:
-  default:
+    j->j_state = JOB_STATEFIN;
+    return 1;
+  }
+
+  w = worker_get(s);
+  if (w == NULL) {		/* out of memory, better to lose this client than stall */
+    j->j_state = JOB_STATEFIN;
+    return 1;
+  }
+
+  w->w_job = j;
+  w->w_chain = set_hold(s);
+  w->w_pid = j->j_pid;
+  w->w_uid = j->j_uid;
+  w->w_gid = j->j_gid;
+  w->w_time = s->s_time;
+  w->w_clock = s->s_clock;
+
+  memcpy(w->w_buffer, j->j_rbuf, l);
+  w->w_length = l;
+  w->w_used = 0;
+  w->w_wire = j->j_wire;
+  w->w_replied = 0;
+
+  j->j_work = w;
+  worker_queue(s, w);
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : picks up the replies of a worker, equivalent of the second  */
+/*              half of job_do                                              */
+
+int job_finish(JOB * j, STATE_SET * s, WORK * w)
+{
+  j->j_work = NULL;
+  set_release(s, w->w_chain);
+
+  if (job_isend(j)) {		/* client went away in the meantime */
+    return 0;
+  }
+
+  memmove(j->j_rbuf, j->j_rbuf + w->w_used, j->j_rl - w->w_used);
+  j->j_rl = j->j_rl - w->w_used;
+
+  if (w->w_status != IDSA_IO_OK) {
 #ifdef TRACE
-    fprintf(stderr, "job_do(): reading event failed, giving up\n");
+    fprintf(stderr, "job_finish(): evaluation failed, giving up\n");
 #endif
     j->j_state = JOB_STATEFIN;
-    break;
+    return 1;
   }
 
-  return result;
+  if ((w->w_replied > 0) && (j->j_wbuf == NULL)) {
+    j->j_wbuf = buffer_get(&(s->s_wbufs));
+    if (j->j_wbuf == NULL) {
+      j->j_state = JOB_STATEFIN;
+      return 1;
+    }
+  }
+
+  memcpy(j->j_wbuf, w->w_reply, w->w_replied);
+  j->j_wl = w->w_replied;
+
+  if (w->w_result == IDSA_CHAIN_DROP) {
+    j->j_state = JOB_STATEFIN;
+  }
+
+  job_flush(j);
+
+  return 0;
 }
 
 int job_accept(JOB * j, int fd)
@@ -203,9 +445,16 @@ int job_accept(JOB * j, int fd)
     fcntl(j->j_fd, F_SETFD, FD_CLOEXEC);
 
     j->j_rl = 0;
+    j->j_more = 0;
     j->j_wl = 0;
+    j->j_ring = NULL;
+    j->j_wire = IDSA_WIRE_TEXT;
 
     j->j_state = JOB_STATEWAIT;
+    j->j_events = LOOP_READ;
+    j->j_work = NULL;
+    j->j_park = NULL;
+    j->j_backlog = 0;
 
 #ifdef SO_PEERCRED
     cl = sizeof(IDSA_UCRED);
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : readiness notification for the main loop. Only descriptors  */
+/*              with something to do are reported, so the cost of a wakeup  */
+/*              does not grow with the number of idle clients. Neither      */
+/*              backend is limited by FD_SETSIZE. Timeout in milliseconds,  */
+/*              -1 waits indefinitely                                       */
+
+#ifdef IDSAD_EPOLL
+
+static unsigned int loop_mask(int m)
+{
+  unsigned int result = 0;
+
+  if (m & LOOP_READ) {
+    result |= EPOLLIN;
+  }
+  if (m & LOOP_WRITE) {
+    result |= EPOLLOUT;
+  }
+
+  return result;
+}
+
+LOOP *loop_new(int max)
+{
+  LOOP *l;
+
+  l = malloc(sizeof(LOOP));
+  if (l == NULL) {
+    return NULL;
+  }
+
+  l->l_max = max;
+  l->l_ready = malloc(sizeof(struct epoll_event) * IDSAD_EVENTS);
+  if (l->l_ready == NULL) {
+    free(l);
+    return NULL;
+  }
+
+  l->l_fd = epoll_create(max);
+  if (l->l_fd == (-1)) {
+    free(l->l_ready);
+    free(l);
+    return NULL;
+  }
+
+  fcntl(l->l_fd, F_SETFD, FD_CLOEXEC);
+
+  return l;
+}
+
+void loop_free(LOOP * l)
+{
+  if (l) {
+    if (l->l_fd != (-1)) {
+      close(l->l_fd);
+      l->l_fd = (-1);
+    }
+    if (l->l_ready) {
+      free(l->l_ready);
+      l->l_ready = NULL;
+    }
+    free(l);
+  }
+}
+
+static int loop_ctl(LOOP * l, int op, int fd, unsigned int key, int mask)
+{
+  struct epoll_event ev;
+
+  ev.events = loop_mask(mask);
+  ev.data.u64 = 0;
+  ev.data.u32 = key;
+
+  return epoll_ctl(l->l_fd, op, fd, &ev);
+}
+
+int loop_add(LOOP * l, int fd, unsigned int key, int mask)
+{
+  return loop_ctl(l, EPOLL_CTL_ADD, fd, key, mask);
+}
+
+int loop_change(LOOP * l, int fd, unsigned int key, int mask)
+{
+  return loop_ctl(l, EPOLL_CTL_MOD, fd, key, mask);
+}
+
+int loop_remove(LOOP * l, int fd)
+{
+  struct epoll_event ev;
+
+  /* ev unused, but old kernels insist on a valid pointer */
+  return epoll_ctl(l->l_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int loop_wait(LOOP * l, LOOP_READY * r, int n, int timeout)
+{
+  int i, result;
+  unsigned int e;
+
+  if (n > IDSAD_EVENTS) {
+    n = IDSAD_EVENTS;
+  }
+
+  result = epoll_wait(l->l_fd, l->l_ready, n, timeout);
+
+  for (i = 0; i < result; i++) {
+    e = l->l_ready[i].events;
+    r[i].r_key = l->l_ready[i].data.u32;
+    r[i].r_mask = 0;
+    if (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) {	/* read will discover eof or error */
+      r[i].r_mask |= LOOP_READ;
+    }
+    if (e & EPOLLOUT) {
+      r[i].r_mask |= LOOP_WRITE;
+    }
+  }
+
+  return result;
+}
+
+#else
+
+static short loop_mask(int m)
+{
+  short result = 0;
+
+  if (m & LOOP_READ) {
+    result |= POLLIN;
+  }
+  if (m & LOOP_WRITE) {
+    result |= POLLOUT;
+  }
+
+  return result;
+}
+
+LOOP *loop_new(int max)
+{
+  LOOP *l;
+  int i;
+
+  l = malloc(sizeof(LOOP));
+  if (l == NULL) {
+    return NULL;
+  }
+
+  l->l_max = max;
+  l->l_used = 0;
+  l->l_next = 0;
+  l->l_fds = getdtablesize();
+
+  l->l_poll = malloc(sizeof(struct pollfd) * max);
+  l->l_keys = malloc(sizeof(unsigned int) * max);
+  l->l_slot = malloc(sizeof(int) * l->l_fds);
+
+  if ((l->l_poll == NULL) || (l->l_keys == NULL) || (l->l_slot == NULL)) {
+    loop_free(l);
+    return NULL;
+  }
+
+  for (i = 0; i < l->l_fds; i++) {
+    l->l_slot[i] = (-1);
+  }
+
+  return l;
+}
+
+void loop_free(LOOP * l)
+{
+  if (l) {
+    if (l->l_poll) {
+      free(l->l_poll);
+      l->l_poll = NULL;
+    }
+    if (l->l_keys) {
+      free(l->l_keys);
+      l->l_keys = NULL;
+    }
+    if (l->l_slot) {
+      free(l->l_slot);
+      l->l_slot = NULL;
+    }
+    free(l);
+  }
+}
+
+int loop_add(LOOP * l, int fd, unsigned int key, int mask)
+{
+  if ((fd < 0) || (fd >= l->l_fds) || (l->l_used >= l->l_max)) {
+    errno = ENOSPC;
+    return -1;
+  }
+  if (l->l_slot[fd] >= 0) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  l->l_poll[l->l_used].fd = fd;
+  l->l_poll[l->l_used].events = loop_mask(mask);
+  l->l_poll[l->l_used].revents = 0;
+  l->l_keys[l->l_used] = key;
+  l->l_slot[fd] = l->l_used;
+  l->l_used++;
+
+  return 0;
+}
+
+int loop_change(LOOP * l, int fd, unsigned int key, int mask)
+{
+  int s;
+
+  if ((fd < 0) || (fd >= l->l_fds) || (l->l_slot[fd] < 0)) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  s = l->l_slot[fd];
+  l->l_poll[s].events = loop_mask(mask);
+  l->l_keys[s] = key;
+
+  return 0;
+}
+
+int loop_remove(LOOP * l, int fd)
+{
+  int s;
+
+  if ((fd < 0) || (fd >= l->l_fds) || (l->l_slot[fd] < 0)) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  s = l->l_slot[fd];
+  l->l_slot[fd] = (-1);
+  l->l_used--;
+
+  if (s < l->l_used) {		/* move last entry into hole */
+    l->l_poll[s] = l->l_poll[l->l_used];
+    l->l_keys[s] = l->l_keys[l->l_used];
+    l->l_slot[l->l_poll[s].fd] = s;
+  }
+
+  return 0;
+}
+
+int loop_wait(LOOP * l, LOOP_READY * r, int n, int timeout)
+{
+  int i, k, s, result;
+  short e;
+
+  result = poll(l->l_poll, l->l_used, timeout);
+  if (result <= 0) {
+    return result;
+  }
+
+  /* rotate start position so that everybody gets a turn if n is small */
+  if (l->l_next >= l->l_used) {
+    l->l_next = 0;
+  }
+
+  k = 0;
+  for (i = 0; (i < l->l_used) && (k < n); i++) {
+    s = (l->l_next + i) % l->l_used;
+    e = l->l_poll[s].revents;
+    if (e) {
+      r[k].r_key = l->l_keys[s];
+      r[k].r_mask = 0;
+      if (e & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) {
+	r[k].r_mask |= LOOP_READ;
+      }
+      if (e & POLLOUT) {
+	r[k].r_mask |= LOOP_WRITE;
+      }
+      k++;
+    }
+  }
+  l->l_next = (l->l_next + i) % ((l->l_used > 0) ? l->l_used : 1);
+
+  return k;
+}
+
+#endif
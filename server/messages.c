@@ -1,4 +1,5 @@
 #include <time.h>
+#include <limits.h>
 #include <stdarg.h>
 
 #include <idsa_internal.h>
@@ -15,22 +16,44 @@
 int message_chain(STATE_SET * s)
 {
   int result = IDSA_CHAIN_OK;
+  RETIRED *r;
+  int notice;
 
-  if (idsa_chain_notice(s->s_chain)) {
+  /* chains replaced by a reload report there too while finishing up */
+  notice = idsa_chain_notice(s->s_chain);
+  for (r = s->s_retired; r != NULL; r = r->r_next) {
+    notice |= idsa_chain_notice(r->r_chain);
+  }
+
+  if (notice) {
+
+    /* s->s_libidsa has already been filled in, workers may still write */
+    /* to it, so evaluate a copy. Further reports remain suppressed */
+    /* until the reset */
+    worker_lock(s);
+    idsa_event_copy(s->s_notice, s->s_libidsa);
+    worker_unlock(s);
 
-    /* s->s_libidsa has already been filled in, only update time */
-    idsa_time(s->s_libidsa, s->s_time);
+    idsa_time(s->s_notice, s->s_time);
 
     idsa_reply_init(s->s_reply);
-    idsa_local_init(s->s_chain, s->s_local, s->s_libidsa, s->s_reply);
+    idsa_local_init(s->s_chain, s->s_local, s->s_notice, s->s_reply);
+    idsa_local_settime(s->s_local, s->s_time, s->s_clock);
     result = idsa_chain_run(s->s_chain, s->s_local);
     idsa_local_quit(s->s_chain, s->s_local);
 
+    worker_lock(s);
+
     /* restore event for next message */
     idsa_event_copy(s->s_libidsa, s->s_template);
 
     /* mark s_libidsa available for modification within libidsa again */
     idsa_chain_reset(s->s_chain);
+    for (r = s->s_retired; r != NULL; r = r->r_next) {
+      idsa_chain_reset(r->r_chain);
+    }
+
+    worker_unlock(s);
   }
 
   return result;
@@ -72,6 +95,7 @@ static int message_half(STATE_SET * s)
 
   idsa_reply_init(s->s_reply);
   idsa_local_init(s->s_chain, s->s_local, s->s_idsad, s->s_reply);
+  idsa_local_settime(s->s_local, s->s_time, s->s_clock);
   result = idsa_chain_run(s->s_chain, s->s_local);
   idsa_local_quit(s->s_chain, s->s_local);
 
@@ -80,6 +104,22 @@ static int message_half(STATE_SET * s)
   return result;
 }
 
+/****************************************************************************/
+/* Does       : appends the size of the rule graph, as parsed and as used   */
+/*              after idsa_chain_optimize                                   */
+
+static void message_graph(STATE_SET * s)
+{
+  IDSA_RULE_CHAIN *c;
+
+  c = s->s_chain;
+
+  idsa_event_setappend(s->s_idsad, "parsed_nodes", IDSA_T_INT, &(c->c_parsednodes));
+  idsa_event_setappend(s->s_idsad, "parsed_tests", IDSA_T_INT, &(c->c_parsedtests));
+  idsa_event_setappend(s->s_idsad, "nodes", IDSA_T_INT, &(c->c_optimalnodes));
+  idsa_event_setappend(s->s_idsad, "tests", IDSA_T_INT, &(c->c_optimaltests));
+}
+
 int message_start(STATE_SET * s, char *v)
 {
 
@@ -88,6 +128,8 @@ int message_start(STATE_SET * s, char *v)
 
   idsa_request_scan(s->s_idsad, "start", "idsa", 0, IDSA_R_SUCCESS, IDSA_R_UNKNOWN, IDSA_R_UNKNOWN, "version", IDSA_T_STRING, v, NULL);
 
+  message_graph(s);
+
   return message_half(s);
 }
 
@@ -101,6 +143,81 @@ int message_stop(STATE_SET * s, char *v)
   return message_half(s);
 }
 
+/****************************************************************************/
+/* Notes      : reports what the connection table costs. job_bytes is the   */
+/*              price of an idle client, buffers are only held by clients   */
+/*              with data in flight. With -D also how many actions were     */
+/*              deferred, dropped and run. memory stops at INT_MAX, the     */
+/*              largest an IDSA_T_INT holds                                 */
+
+int message_status(STATE_SET * s)
+{
+  int connections, buffers, job;
+  long bytes;
+  int memory;
+  int queued, dropped, done;
+
+  connections = s->s_jobcount;
+  buffers = s->s_rbufs.b_used + s->s_wbufs.b_used;
+  job = sizeof(JOB);
+  bytes = set_bytes(s);
+  memory = (bytes > INT_MAX) ? INT_MAX : bytes;
+
+  idsa_event_copy(s->s_idsad, s->s_template);
+  idsa_time(s->s_idsad, s->s_time);
+
+  idsa_request_scan(s->s_idsad, "status", "idsa", 0, IDSA_R_UNKNOWN, IDSA_R_UNKNOWN, IDSA_R_UNKNOWN, NULL);
+
+  idsa_event_setappend(s->s_idsad, "connections", IDSA_T_INT, &connections);
+  idsa_event_setappend(s->s_idsad, "buffers", IDSA_T_INT, &buffers);
+  idsa_event_setappend(s->s_idsad, "job_bytes", IDSA_T_INT, &job);
+  idsa_event_setappend(s->s_idsad, "memory", IDSA_T_INT, &memory);
+
+  if (s->s_defer) {
+    defer_counts(s, &queued, &dropped, &done);
+    idsa_event_setappend(s->s_idsad, "queued", IDSA_T_INT, &queued);
+    idsa_event_setappend(s->s_idsad, "dropped", IDSA_T_INT, &dropped);
+    idsa_event_setappend(s->s_idsad, "completed", IDSA_T_INT, &done);
+  }
+
+  return message_half(s);
+}
+
+/****************************************************************************/
+/* Does       : reports outcome of a SIGHUP. Complaints of the parser were  */
+/*              collected in s_reload and are passed on first               */
+/* Parameters : carried - modules which kept their state, negative if the   */
+/*              old rules remain in force                                   */
+
+int message_reload(STATE_SET * s, int carried)
+{
+  int complaint;
+
+  complaint = (carried < 0) ? (idsa_event_unitcount(s->s_reload) > idsa_event_unitcount(s->s_template)) : idsa_chain_notice(s->s_chain);
+  if (complaint) {
+    if (carried >= 0) {		/* warnings went to s_reload, not s_libidsa */
+      idsa_chain_reset(s->s_chain);
+    }
+    idsa_event_copy(s->s_idsad, s->s_reload);
+    idsa_time(s->s_idsad, s->s_time);
+    message_half(s);
+  }
+
+  if (carried < 0) {
+    return message_error_internal(s, "unable to reload rules from %s, keeping previous ones", s->s_config);
+  }
+
+  idsa_event_copy(s->s_idsad, s->s_template);
+  idsa_time(s->s_idsad, s->s_time);
+
+  idsa_request_scan(s->s_idsad, "reload", "idsa", 0, IDSA_R_SUCCESS, IDSA_R_UNKNOWN, IDSA_R_UNKNOWN, "file", IDSA_T_FILE, s->s_config, NULL);
+
+  idsa_event_setappend(s->s_idsad, "carried", IDSA_T_INT, &carried);
+  message_graph(s);
+
+  return message_half(s);
+}
+
 int message_connect(STATE_SET * s, pid_t p, uid_t u, gid_t g)
 {
   idsa_event_copy(s->s_idsad, s->s_template);
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <sys/time.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : evaluations suspended by a module (see idsa_local_wait) are */
+/*              kept here together with their local, request and reply, so  */
+/*              that other clients can be served meanwhile. Each is due     */
+/*              once its descriptor is ready, its deadline has passed or,   */
+/*              if it has no descriptor, some other parked evaluation has   */
+/*              completed                                                   */
+
+/****************************************************************************/
+/* Returns    : milliseconds on a clock unaffected by date changes          */
+
+long park_now()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+#endif
+  struct timeval tv;
+
+#ifdef CLOCK_MONOTONIC
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+    return (ts.tv_sec * 1000L) + (ts.tv_nsec / 1000000L);
+  }
+#endif
+
+  gettimeofday(&tv, NULL);
+
+  return (tv.tv_sec * 1000L) + (tv.tv_usec / 1000L);
+}
+
+/****************************************************************************/
+
+static void park_release(STATE_SET * s, PARK * k)
+{
+  if (k->k_local) {
+    idsa_local_free(s->s_chain, k->k_local);
+  }
+  if (k->k_request) {
+    idsa_event_free(k->k_request);
+  }
+  if (k->k_reply) {
+    idsa_event_free(k->k_reply);
+  }
+  free(k);
+}
+
+/****************************************************************************/
+/* Does       : allocate and recycle parking places, spares keep their      */
+/*              local, request and reply so that these can be swapped       */
+
+PARK *park_get(STATE_SET * s)
+{
+  PARK *k;
+
+  k = s->s_parkfree;
+  if (k) {
+    s->s_parkfree = k->k_next;
+    s->s_parkspare--;
+    return k;
+  }
+
+  k = malloc(sizeof(PARK));
+  if (k == NULL) {
+    return NULL;
+  }
+
+  k->k_local = idsa_local_new(s->s_chain);
+  k->k_request = idsa_event_new(0);
+  k->k_reply = idsa_event_new(0);
+
+  if ((k->k_local == NULL) || (k->k_request == NULL) || (k->k_reply == NULL)) {
+    park_release(s, k);
+    return NULL;
+  }
+
+  return k;
+}
+
+void park_put(STATE_SET * s, PARK * k)
+{
+  k->k_job = NULL;
+
+  if (s->s_parkspare >= IDSAD_SPARE) {
+    park_release(s, k);
+    return;
+  }
+
+  k->k_next = s->s_parkfree;
+  s->s_parkfree = k;
+  s->s_parkspare++;
+}
+
+/****************************************************************************/
+/* Does       : releases spares and anything still parked                   */
+
+void park_flush(STATE_SET * s)
+{
+  PARK *k;
+
+  while (s->s_parkfree) {
+    k = s->s_parkfree;
+    s->s_parkfree = k->k_next;
+    park_release(s, k);
+  }
+  s->s_parkspare = 0;
+
+  while (s->s_parked) {
+    k = s->s_parked;
+    s->s_parked = k->k_next;
+    if (k->k_job) {
+      k->k_job->j_park = NULL;
+    }
+    park_release(s, k);
+  }
+  s->s_parkcount = 0;
+}
+
+/****************************************************************************/
+/* Does       : parks k until whatever its local is waiting for happens     */
+/* Notes      : if the descriptor can not be watched, k is only resumed by  */
+/*              its deadline or the completion of others                    */
+
+void park_add(STATE_SET * s, PARK * k)
+{
+  IDSA_RULE_LOCAL *l;
+  int mask;
+
+  l = k->k_local;
+
+  k->k_ready = 0;
+  k->k_fd = (-1);
+  k->k_until = (l->l_waitms >= 0) ? (park_now() + l->l_waitms) : (-1);
+
+  if (l->l_waitfd >= 0) {
+    mask = 0;
+    if (l->l_waitmask & IDSA_WAIT_READ) {
+      mask |= LOOP_READ;
+    }
+    if (l->l_waitmask & IDSA_WAIT_WRITE) {
+      mask |= LOOP_WRITE;
+    }
+    if (mask && (loop_add(s->s_loop, l->l_waitfd, LOOP_PARK | k->k_job->j_id, mask) == 0)) {
+      k->k_fd = l->l_waitfd;
+    }
+  }
+
+  k->k_next = s->s_parked;
+  s->s_parked = k;
+  s->s_parkcount++;
+}
+
+/****************************************************************************/
+/* Does       : takes all parked evaluations which are due off the list,    */
+/*              flagging those which ran out of time                        */
+/* Returns    : linked list of them, to be handed to job_resume             */
+
+PARK *park_due(STATE_SET * s)
+{
+  PARK *k, **p, *result;
+  long now;
+  int done, expired;
+
+  if (s->s_parked == NULL) {
+    return NULL;
+  }
+
+  now = park_now();
+  done = s->s_parkdone;
+  s->s_parkdone = 0;
+  result = NULL;
+
+  p = &(s->s_parked);
+  while (*p) {
+    k = *p;
+    expired = (k->k_until >= 0) && (now >= k->k_until);
+    if (k->k_ready || expired || (done && (k->k_fd < 0))) {
+      *p = k->k_next;
+      s->s_parkcount--;
+      if (k->k_fd >= 0) {
+	loop_remove(s->s_loop, k->k_fd);
+      }
+      if (expired && !(k->k_ready)) {
+	idsa_local_expire(k->k_local);
+      }
+      k->k_next = result;
+      result = k;
+    } else {
+      p = &(k->k_next);
+    }
+  }
+
+  return result;
+}
+
+/****************************************************************************/
+/* Returns    : milliseconds until the next parked evaluation is due, -1 if */
+/*              there is nothing to wait for                                */
+
+int park_timeout(STATE_SET * s)
+{
+  PARK *k;
+  long now, left;
+  int result;
+
+  if (s->s_parked == NULL) {
+    return -1;
+  }
+
+  now = park_now();
+  result = (-1);
+
+  for (k = s->s_parked; k != NULL; k = k->k_next) {
+    if (k->k_ready || (s->s_parkdone && (k->k_fd < 0))) {
+      return 0;
+    }
+    if (k->k_until >= 0) {
+      left = k->k_until - now;
+      if (left < 0) {
+	left = 0;
+      }
+      if ((result < 0) || (left < result)) {
+	result = left;
+      }
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : live connections per uid, kept up to date at accept and     */
+/*              close so that quotas can be checked without visiting every  */
+/*              job. Root and unknown uids are not counted. Entries which   */
+/*              drop to zero go onto a free list for reuse                  */
+
+#define quota_hash(u) (((unsigned int)(u)) & (IDSAD_QUOTAHASH - 1))
+
+static int quota_exempt(uid_t u)
+{
+  return (u == 0) || (u == (uid_t) (-1));
+}
+
+QUOTA *quota_new()
+{
+  QUOTA *q;
+  int i;
+
+  q = malloc(sizeof(QUOTA));
+  if (q == NULL) {
+    return NULL;
+  }
+
+  for (i = 0; i < IDSAD_QUOTAHASH; i++) {
+    q->q_table[i] = NULL;
+  }
+  q->q_free = NULL;
+
+  return q;
+}
+
+static void quota_list_free(QUOTA_ENTRY * e)
+{
+  QUOTA_ENTRY *next;
+
+  while (e) {
+    next = e->q_next;
+    free(e);
+    e = next;
+  }
+}
+
+void quota_free(QUOTA * q)
+{
+  int i;
+
+  if (q == NULL) {
+    return;
+  }
+
+  for (i = 0; i < IDSAD_QUOTAHASH; i++) {
+    quota_list_free(q->q_table[i]);
+  }
+  quota_list_free(q->q_free);
+
+  free(q);
+}
+
+/****************************************************************************/
+/* Returns    : number of connections held by uid u                         */
+
+int quota_count(QUOTA * q, uid_t u)
+{
+  QUOTA_ENTRY *e;
+
+  for (e = q->q_table[quota_hash(u)]; e != NULL; e = e->q_next) {
+    if (e->q_uid == u) {
+      return e->q_count;
+    }
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : records one more connection for uid u                       */
+/* Returns    : zero on success, nonzero if out of memory                   */
+
+int quota_add(QUOTA * q, uid_t u)
+{
+  QUOTA_ENTRY *e;
+  unsigned int h;
+
+  if (quota_exempt(u)) {
+    return 0;
+  }
+
+  h = quota_hash(u);
+  for (e = q->q_table[h]; e != NULL; e = e->q_next) {
+    if (e->q_uid == u) {
+      e->q_count++;
+      return 0;
+    }
+  }
+
+  if (q->q_free) {
+    e = q->q_free;
+    q->q_free = e->q_next;
+  } else {
+    e = malloc(sizeof(QUOTA_ENTRY));
+    if (e == NULL) {
+      return 1;
+    }
+  }
+
+  e->q_uid = u;
+  e->q_count = 1;
+  e->q_next = q->q_table[h];
+  q->q_table[h] = e;
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : forgets a connection of uid u, which has to have been added */
+
+void quota_remove(QUOTA * q, uid_t u)
+{
+  QUOTA_ENTRY *e, **p;
+
+  if (quota_exempt(u)) {
+    return;
+  }
+
+  for (p = &(q->q_table[quota_hash(u)]); *p != NULL; p = &((*p)->q_next)) {
+    e = *p;
+    if (e->q_uid == u) {
+      e->q_count--;
+      if (e->q_count <= 0) {
+	*p = e->q_next;
+	e->q_next = q->q_free;
+	q->q_free = e;
+      }
+      return;
+    }
+  }
+
+#ifdef TRACE
+  fprintf(stderr, "quota_remove(): uid %d was never added\n", (int) u);
+#endif
+}
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE		/* memfd_create */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <idsa_internal.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : a client which asks for IDSA_HELLO_RING in its hello gets a */
+/*              ring of its own (see lib/ring.c), passed back over its      */
+/*              socket by io_greet. From then on requests are copied out of */
+/*              the ring into j_rbuf and replies from j_wbuf into it,       */
+/*              everything else stays as it is. The socket only carries     */
+/*              wakeups, so the job waits for it to become readable, also   */
+/*              when its replies do not fit. The client can write to the    */
+/*              ring at any time, so nothing in it is used in place. The    */
+/*              memory is sealed, so that the client can not shrink it from */
+/*              under us                                                    */
+
+#if defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define RING_SHARED
+#endif
+
+#ifdef RING_SHARED
+static IDSA_RING *ring_new(int *fd)
+{
+  IDSA_RING *r;
+  int seals;
+
+  *fd = memfd_create("idsad", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (*fd < 0) {
+    return NULL;
+  }
+
+  seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+  if (ftruncate(*fd, sizeof(IDSA_RING)) || fcntl(*fd, F_ADD_SEALS, seals)) {
+    close(*fd);
+    return NULL;
+  }
+
+  r = mmap(NULL, sizeof(IDSA_RING), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (r == MAP_FAILED) {
+    close(*fd);
+    return NULL;
+  }
+
+  idsa_ring_init(r);
+  r->r_request.h_waiting = 1;	/* nothing read yet, so the first request rings */
+
+  return r;
+}
+#endif
+
+/****************************************************************************/
+/* Does       : sets up a ring for j                                        */
+/* Returns    : descriptor to be passed to the client and closed, -1 if no  */
+/*              ring can be had, in which case the client uses the socket   */
+
+int ring_offer(JOB * j, STATE_SET * s)
+{
+  int fd;
+
+  fd = (-1);
+#ifdef RING_SHARED
+  j->j_ring = ring_new(&fd);
+#endif
+
+  if (j->j_ring == NULL) {
+    return -1;
+  }
+
+  j->j_ring->r_generation = s->s_generation;
+  s->s_ringcount++;
+
+  return fd;
+}
+
+/****************************************************************************/
+/* Does       : tells every client with a ring that the rules have changed, */
+/*              so that it stops reusing cached verdicts without waiting    */
+/*              for its next reply                                          */
+
+void ring_generation(STATE_SET * s)
+{
+  JOB *j;
+  int i;
+
+  for (i = 0; i < set_jobsize(s); i++) {
+    j = set_job(s, i);
+    if (j->j_ring) {
+      j->j_ring->r_generation = s->s_generation;
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : releases the ring of j, if any                              */
+
+void ring_end(JOB * j, STATE_SET * s)
+{
+  if (j->j_ring) {
+    munmap(j->j_ring, sizeof(IDSA_RING));
+    j->j_ring = NULL;
+    if (s->s_ringcount > 0) {
+      s->s_ringcount--;
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : wakes the client, which has gone to sleep on its socket     */
+
+static void ring_notify(JOB * j)
+{
+  write(j->j_fd, "", 1);
+}
+
+/****************************************************************************/
+/* Does       : job_read for jobs with a ring: swallows wakeups, then takes */
+/*              as much as fits from the ring. Sets j_more if the ring has  */
+/*              anything left, otherwise asks the client for a wakeup       */
+/* Returns    : zero on success, nonzero on failure                         */
+/* Notes      : the socket is only looked at if the ring was empty last     */
+/*              time, so a busy client costs no system calls at all         */
+
+int ring_read(JOB * j, STATE_SET * s)
+{
+  char buffer[IDSAD_EVENTS];
+  int rr, got;
+
+  if (j->j_more == 0) {		/* woken by the loop */
+    do {
+      rr = read(j->j_fd, buffer, IDSAD_EVENTS);
+    } while (rr == IDSAD_EVENTS);
+
+    if (rr == 0) {
+      j->j_state = JOB_STATEFIN;
+      return 0;
+    }
+    if ((rr < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+      j->j_state = JOB_STATEFIN;
+      return 1;
+    }
+  }
+
+  j->j_more = 0;
+
+  if (j->j_rl < IDSA_M_MESSAGE) {
+    got = idsa_ring_get(&(j->j_ring->r_request), j->j_rbuf + j->j_rl, IDSA_M_MESSAGE - j->j_rl);
+    if (got < 0) {		/* client has messed up the counters */
+      j->j_state = JOB_STATEFIN;
+      return 1;
+    }
+    j->j_rl += got;
+
+    if ((got > 0) && idsa_ring_wake(&(j->j_ring->r_request), 0)) {	/* client waits for room */
+      ring_notify(j);
+    }
+  }
+
+  if (idsa_ring_used(&(j->j_ring->r_request)) != 0) {
+    j->j_more = 1;
+  } else if (idsa_ring_sleep(&(j->j_ring->r_request), 0)) {	/* arrived meanwhile */
+    j->j_more = 1;
+  }
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : io_drain for jobs with a ring                               */
+/* Returns    : IDSA_IO_OK if all replies went out, IDSA_IO_WAIT if some    */
+/*              have to wait for the client to make room, else IDSA_IO_FAIL */
+
+int ring_drain(JOB * j)
+{
+  IDSA_RING_HALF *h;
+  int put;
+
+  if (j->j_wl <= 0) {
+    return IDSA_IO_OK;
+  }
+
+  h = &(j->j_ring->r_reply);
+
+  put = idsa_ring_put(h, j->j_wbuf, j->j_wl);
+  if (put < 0) {
+    return IDSA_IO_FAIL;
+  }
+
+  if ((put > 0) && idsa_ring_wake(h, 1)) {	/* client waits for replies */
+    ring_notify(j);
+  }
+
+  j->j_wl -= put;
+  if (j->j_wl == 0) {
+    return IDSA_IO_OK;
+  }
+
+  memmove(j->j_wbuf, j->j_wbuf + put, j->j_wl);
+
+  if (idsa_ring_sleep(h, 1)) {	/* client made room meanwhile */
+    return ring_drain(j);
+  }
+
+  return IDSA_IO_WAIT;
+}
@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/utsname.h>
@@ -12,6 +16,47 @@
 #include "functions.h"
 
 /****************************************************************************/
+/* Does       : adds another chunk of IDSAD_SLAB unused slots               */
+/* Returns    : zero on success, nonzero otherwise                          */
+
+static int set_slab(STATE_SET * s)
+{
+  JOB *slab, *j;
+  JOB **btmp;
+  int i;
+
+  if (s->s_slabcount >= s->s_slabmax) {
+    return 1;
+  }
+
+  btmp = realloc(s->s_backlog, sizeof(JOB *) * (set_jobsize(s) + IDSAD_SLAB));
+  if (btmp == NULL) {
+    return 1;
+  }
+  s->s_backlog = btmp;
+
+  slab = malloc(sizeof(JOB) * IDSAD_SLAB);
+  if (slab == NULL) {
+    return 1;
+  }
+
+  /* push in reverse, so that lower slots get used first */
+  for (i = IDSAD_SLAB - 1; i >= 0; i--) {
+    j = &(slab[i]);
+    j->j_fd = (-1);
+    j->j_id = set_jobsize(s) + i;
+    j->j_rl = 0;
+    j->j_rbuf = NULL;
+    j->j_wl = 0;
+    j->j_wbuf = NULL;
+    j->j_next = s->s_jobfree;
+    s->s_jobfree = j;
+  }
+
+  s->s_slab[s->s_slabcount++] = slab;
+
+  return 0;
+}
 
 STATE_SET *set_new(int max, int start, int quota)
 {
@@ -26,18 +71,46 @@ STATE_SET *set_new(int max, int start, int quota)
   /* filled in later */
   s->s_chain = NULL;
   s->s_local = NULL;
+  s->s_holders = 0;
+  s->s_retired = NULL;
+  s->s_config = NULL;
+  s->s_fresh = NULL;
+  s->s_parsing = 0;
+  s->s_rehup = 0;
+  s->s_parsed[0] = (-1);
+  s->s_parsed[1] = (-1);
+  s->s_generation = 1;
   s->s_gid = 0;
 
   /* keep set_free from freeing nonexistant stuff */
   s->s_hostname = NULL;
-  s->s_jobs = NULL;
+  s->s_loop = NULL;
+  s->s_slab = NULL;
+  s->s_slabcount = 0;
+  s->s_jobfree = NULL;
+  s->s_backlog = NULL;
   s->s_request = NULL;
   s->s_reply = NULL;
   s->s_template = NULL;
   s->s_libidsa = NULL;
   s->s_idsad = NULL;
+  s->s_notice = NULL;
+  s->s_reload = NULL;
+  s->s_pool = NULL;
+  s->s_defer = NULL;
+  pthread_mutex_init(&(s->s_serial), NULL);
+  s->s_quota = NULL;
+  buffer_init(&(s->s_rbufs), IDSA_M_MESSAGE, IDSAD_SPARE);
+  buffer_init(&(s->s_wbufs), JOB_WRITEBUF, IDSAD_SPARE);
+  s->s_ringcount = 0;
+  s->s_parked = NULL;
+  s->s_parkfree = NULL;
+  s->s_parkspare = 0;
+  s->s_parkcount = 0;
+  s->s_parkdone = 0;
 
   s->s_time = time(NULL);
+  s->s_clock = idsa_monotonic();
   s->s_hostname = strdup(uname(&ut) ? "localhost" : ut.nodename);
   if (s->s_hostname == NULL) {
     set_free(s);
@@ -45,21 +118,47 @@ STATE_SET *set_new(int max, int start, int quota)
   }
 
   s->s_jobmax = max;		/* never have more than this number of clients */
-  s->s_jobsize = start;		/* start with a small table, grow if needed */
   s->s_jobquota = quota;
   s->s_jobcount = 0;
-  s->s_jobs = malloc(sizeof(JOB) * s->s_jobsize);
-  if (s->s_jobs == NULL) {
+  s->s_backlogcount = 0;
+
+  s->s_quota = quota_new();
+  if (s->s_quota == NULL) {
+    set_free(s);
+    return NULL;
+  }
+
+  s->s_slabmax = (max + IDSAD_SLAB - 1) / IDSAD_SLAB;
+  s->s_slab = malloc(sizeof(JOB *) * s->s_slabmax);
+  if (s->s_slab == NULL) {
     set_free(s);
     return NULL;
   }
 
+  /* start with a few slots, grow if needed */
+  while (set_jobsize(s) < start) {
+    if (set_slab(s)) {
+      set_free(s);
+      return NULL;
+    }
+  }
+
+  /* a full preallocation (-M) should not have to allocate buffers later */
+  if (start >= max) {
+    if (buffer_fill(&(s->s_rbufs), max) || buffer_fill(&(s->s_wbufs), max)) {
+      set_free(s);
+      return NULL;
+    }
+  }
+
   s->s_request = idsa_event_new(0);
   s->s_reply = idsa_event_new(0);
   s->s_template = idsa_event_new(0);
   s->s_libidsa = idsa_event_new(0);
   s->s_idsad = idsa_event_new(0);
-  if (!(s->s_request && s->s_reply && s->s_libidsa && s->s_idsad && s->s_template)) {
+  s->s_notice = idsa_event_new(0);
+  s->s_reload = idsa_event_new(0);
+  if (!(s->s_request && s->s_reply && s->s_libidsa && s->s_idsad && s->s_template && s->s_notice && s->s_reload)) {
     set_free(s);
     return NULL;
   }
@@ -71,10 +170,67 @@ STATE_SET *set_new(int max, int start, int quota)
   return s;
 }
 
+/****************************************************************************/
+/* Does       : allocate and recycle job slots                              */
+/* Returns    : set_jobnew gives NULL if at s_jobmax or out of memory       */
+/* Notes      : slots are only ever added in chunks and never moved, so     */
+/*              a job keeps its address and j_id for its whole lifetime.    */
+/*              Buffers go back to the pool when a slot is freed            */
+
+JOB *set_jobnew(STATE_SET * s)
+{
+  JOB *j;
+
+  if (s->s_jobcount >= s->s_jobmax) {
+    return NULL;
+  }
+
+  if ((s->s_jobfree == NULL) && set_slab(s)) {
+    return NULL;
+  }
+
+  j = s->s_jobfree;
+  s->s_jobfree = j->j_next;
+  j->j_next = NULL;
+
+  s->s_jobcount++;
+
+  return j;
+}
+
+void set_jobfree(STATE_SET * s, JOB * j)
+{
+  if (j->j_rbuf) {
+    buffer_put(&(s->s_rbufs), j->j_rbuf);
+    j->j_rbuf = NULL;
+  }
+  if (j->j_wbuf) {
+    buffer_put(&(s->s_wbufs), j->j_wbuf);
+    j->j_wbuf = NULL;
+  }
+  j->j_rl = 0;
+  j->j_wl = 0;
+  j->j_fd = (-1);
+
+  j->j_next = s->s_jobfree;
+  s->s_jobfree = j;
+
+  s->s_jobcount--;
+}
+
+/****************************************************************************/
+/* Returns    : bytes allocated for clients, slots and buffers              */
+
+long set_bytes(STATE_SET * s)
+{
+  return ((long) set_jobsize(s)) * sizeof(JOB) + buffer_bytes(&(s->s_rbufs)) + buffer_bytes(&(s->s_wbufs)) + ((long) s->s_ringcount) * sizeof(IDSA_RING);
+}
+
 static char *idsad_chain_name = IDSAD_CHAINNAME;
 
 int set_parse(STATE_SET * s, char *file)
 {
+  s->s_config = file;
   s->s_chain = idsa_parse_file(s->s_libidsa, file, 0);
   if (s->s_chain == NULL) {
     return 1;
@@ -87,11 +243,233 @@ int set_parse(STATE_SET * s, char *file)
   return idsa_chain_failure(s->s_chain);
 }
 
+/****************************************************************************/
+/* Does       : body of s_parser, parses s_config into s_fresh              */
+/* Notes      : workers may be reporting to s_libidsa, so parse errors go   */
+/*              to s_reload. Nothing else touches either until the byte on  */
+/*              s_parsed has been read                                      */
+
+static void *set_parser(void *arg)
+{
+  STATE_SET *s;
+
+  s = arg;
+
+  s->s_fresh = idsa_parse_file(s->s_reload, s->s_config, 0);
+  if (s->s_fresh && idsa_chain_failure(s->s_fresh)) {
+    idsa_chain_stop(s->s_fresh);
+    s->s_fresh = NULL;
+  }
+
+  write(s->s_parsed[1], "", 1);
+
+  return NULL;
+}
+
+/****************************************************************************/
+/* Does       : starts rereading the configuration in the background, so    */
+/*              that the main loop keeps serving clients under s_chain.     */
+/*              If a reread is already under way, a further one follows     */
+/* Returns    : zero if under way, nonzero otherwise, errors in s_reload    */
+/* Notes      : LOOP_RELOAD fires once done, then call set_reparsed         */
+
+int set_reparse(STATE_SET * s)
+{
+  sigset_t all, old;
+  int i;
+
+  if (s->s_parsing) {
+    s->s_rehup = 1;
+    return 0;
+  }
+  s->s_rehup = 0;
+
+  idsa_event_copy(s->s_reload, s->s_template);
+
+  if (s->s_parsed[0] == (-1)) {
+    if (pipe(s->s_parsed)) {
+      return 1;
+    }
+    for (i = 0; i < 2; i++) {
+      fcntl(s->s_parsed[i], F_SETFD, FD_CLOEXEC);
+      fcntl(s->s_parsed[i], F_SETFL, O_NONBLOCK | fcntl(s->s_parsed[i], F_GETFL, 0));
+    }
+    if (loop_add(s->s_loop, s->s_parsed[0], LOOP_RELOAD, LOOP_READ)) {
+      close(s->s_parsed[0]);
+      close(s->s_parsed[1]);
+      s->s_parsed[0] = (-1);
+      s->s_parsed[1] = (-1);
+      return 1;
+    }
+  }
+
+  /* signals keep going to the main thread, as with workers */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  i = pthread_create(&(s->s_parser), NULL, &set_parser, s);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (i) {
+    return 1;
+  }
+  s->s_parsing = 1;
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : collects s_parser once LOOP_RELOAD has fired                */
+/* Returns    : zero if s_fresh holds the new rules, 1 if parsing failed,   */
+/*              -1 if s_parser is not done                                  */
+
+int set_reparsed(STATE_SET * s)
+{
+  char buffer[1];
+
+  if (!(s->s_parsing) || (read(s->s_parsed[0], buffer, 1) != 1)) {
+    return -1;
+  }
+
+  pthread_join(s->s_parser, NULL);
+  s->s_parsing = 0;
+
+  return (s->s_fresh == NULL) ? 1 : 0;
+}
+
+/****************************************************************************/
+/* Does       : puts s_fresh in place of s_chain, taking along module state */
+/* Returns    : number of modules given the old state, -1 on failure        */
+/* Notes      : new work gets the new rules at once. Work and evaluations   */
+/*              parked under the old ones finish there, it is only stopped  */
+/*              once set_release and set_sweep find nothing holding it      */
+
+int set_swap(STATE_SET * s)
+{
+  IDSA_RULE_CHAIN *fresh;
+  IDSA_RULE_LOCAL *local;
+  RETIRED *r;
+  int result;
+
+  fresh = s->s_fresh;
+  s->s_fresh = NULL;
+
+  local = idsa_local_new(fresh);
+  r = malloc(sizeof(RETIRED));
+  if ((local == NULL) || (r == NULL)) {
+    if (r) {
+      free(r);
+    }
+    idsa_local_free(fresh, local);
+    idsa_chain_stop(fresh);
+    return -1;
+  }
+
+  if (worker_attach(s, fresh)) {
+    free(r);
+    idsa_local_free(fresh, local);
+    idsa_chain_stop(fresh);
+    return -1;
+  }
+  defer_attach(s, fresh);
+
+  result = worker_carry(s, fresh, s->s_chain);
+
+  idsa_chain_setname(fresh, idsad_chain_name);
+  idsa_chain_setevent(fresh, s->s_libidsa);
+
+  idsa_local_free(s->s_chain, s->s_local);
+
+  r->r_chain = s->s_chain;
+  r->r_holders = s->s_holders;
+  r->r_mark = defer_mark(s);
+  r->r_next = s->s_retired;
+  s->s_retired = r;
+
+  s->s_chain = fresh;
+  s->s_local = local;
+  s->s_holders = 0;
+
+  /* verdicts cached by clients no longer hold */
+  s->s_generation++;
+  ring_generation(s);
+
+  set_sweep(s);
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : counts work or a parked evaluation as using s_chain, which  */
+/*              set_release undoes                                          */
+/* Returns    : s_chain                                                     */
+
+IDSA_RULE_CHAIN *set_hold(STATE_SET * s)
+{
+  s->s_holders++;
+
+  return s->s_chain;
+}
+
+void set_release(STATE_SET * s, IDSA_RULE_CHAIN * c)
+{
+  RETIRED *r;
+
+  if (c == s->s_chain) {
+    s->s_holders--;
+    return;
+  }
+
+  for (r = s->s_retired; r != NULL; r = r->r_next) {
+    if (r->r_chain == c) {
+      r->r_holders--;
+      if (r->r_holders == 0) {	/* last of it may still be queued */
+	r->r_mark = defer_mark(s);
+	set_sweep(s);
+      }
+      return;
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : stops retired chains which are no longer held and have no   */
+/*              actions waiting for the executor                            */
+
+void set_sweep(STATE_SET * s)
+{
+  RETIRED *r, **p;
+
+  p = &(s->s_retired);
+  while (*p) {
+    r = *p;
+    if ((r->r_holders == 0) && defer_past(s, r->r_mark)) {
+      *p = r->r_next;
+      idsa_chain_defer(r->r_chain, NULL, NULL);
+      worker_detach(s, r->r_chain);
+      idsa_chain_stop(r->r_chain);
+      free(r);
+    } else {
+      p = &(r->r_next);
+    }
+  }
+}
+
 void set_free(STATE_SET * s)
 {
+  RETIRED *r;
   JOB *j;
   int i;
 
+  /* a chain may still be under construction */
+  if (s->s_parsing) {
+    pthread_join(s->s_parser, NULL);
+    s->s_parsing = 0;
+  }
+
+  /* workers use the chain, so stop them first, they may still queue */
+  worker_stop(s);
+  defer_stop(s);
+
   if (s->s_local) {
     /* idsa_local_quit(s->s_chain, s->s_local); */
     idsa_local_free(s->s_chain, s->s_local);
@@ -103,24 +481,70 @@ void set_free(STATE_SET * s)
     s->s_chain = NULL;
   }
 
+  if (s->s_fresh) {
+    idsa_chain_stop(s->s_fresh);
+    s->s_fresh = NULL;
+  }
+
+  /* nothing holds them any longer, the executor is gone too */
+  while (s->s_retired) {
+    r = s->s_retired;
+    s->s_retired = r->r_next;
+    worker_detach(s, r->r_chain);
+    idsa_chain_stop(r->r_chain);
+    free(r);
+  }
+
+  if (s->s_parsed[0] != (-1)) {
+    close(s->s_parsed[0]);
+    close(s->s_parsed[1]);
+  }
+
   /* delete hostname */
   if (s->s_hostname) {
     free(s->s_hostname);
     s->s_hostname = NULL;
   }
 
+  if (s->s_loop) {
+    loop_free(s->s_loop);
+    s->s_loop = NULL;
+  }
+
+  if (s->s_backlog) {
+    free(s->s_backlog);
+    s->s_backlog = NULL;
+    s->s_backlogcount = 0;
+  }
+
+  park_flush(s);
+
   /* close jobs */
-  if (s->s_jobs) {
-    for (i = 0; i < s->s_jobcount; i++) {
-      j = &(s->s_jobs[i]);
-      job_end(j);
+  if (s->s_slab) {
+    for (i = 0; i < set_jobsize(s); i++) {
+      j = set_job(s, i);
+      if (j->j_fd >= 0) {
+	job_end(j, s);
+	set_jobfree(s, j);
+      }
     }
-    free(s->s_jobs);
-    s->s_jobs = NULL;
-    s->s_jobsize = 0;
-    s->s_jobcount = 0;
+    for (i = 0; i < s->s_slabcount; i++) {
+      free(s->s_slab[i]);
+    }
+    free(s->s_slab);
+    s->s_slab = NULL;
+    s->s_slabcount = 0;
+    s->s_jobfree = NULL;
+  }
+
+  if (s->s_quota) {
+    quota_free(s->s_quota);
+    s->s_quota = NULL;
   }
 
+  buffer_flush(&(s->s_rbufs));
+  buffer_flush(&(s->s_wbufs));
+
   if (s->s_request) {
     idsa_event_free(s->s_request);
     s->s_request = NULL;
@@ -144,5 +568,17 @@ void set_free(STATE_SET * s)
     s->s_template = NULL;
   }
 
+  if (s->s_notice) {
+    idsa_event_free(s->s_notice);
+    s->s_notice = NULL;
+  }
+
+  if (s->s_reload) {
+    idsa_event_free(s->s_reload);
+    s->s_reload = NULL;
+  }
+
+  pthread_mutex_destroy(&(s->s_serial));
+
   free(s);
 }
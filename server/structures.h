@@ -1,34 +1,232 @@
 #ifndef _IDSAD_STRUCTURES_H_
 #define _IDSAD_STRUCTURES_H_
 
+#include <pthread.h>
+
 #include <sys/time.h>
 #include <sys/utsname.h>
 #include <sys/types.h>
 
 #include <idsa_internal.h>
 
+#include "idsad.h"
+
+#ifdef __linux__
+#define IDSAD_EPOLL
+#endif
+
+#ifdef IDSAD_EPOLL
+#include <sys/epoll.h>
+#else
+#include <sys/poll.h>
+#endif
+
+struct loop{
+  int l_max;                /* most descriptors watched */
+#ifdef IDSAD_EPOLL
+  int l_fd;                 /* epoll instance */
+  struct epoll_event *l_ready;
+#else
+  struct pollfd *l_poll;    /* compact table of watched descriptors */
+  unsigned int *l_keys;     /* key for each entry in l_poll */
+  int *l_slot;              /* index into l_poll by descriptor */
+  int l_used;               /* entries in l_poll */
+  int l_next;               /* where to start reporting next time */
+  int l_fds;                /* size of l_slot */
+#endif
+};
+typedef struct loop LOOP;
+
+struct loop_ready{
+  unsigned int r_key;       /* key given to loop_add */
+  int r_mask;               /* LOOP_READ, LOOP_WRITE */
+};
+typedef struct loop_ready LOOP_READY;
+
+/* room for several replies, see IDSAD_BATCH */
+#define JOB_WRITEBUF (2 * IDSA_M_MESSAGE)
+
+struct work{
+  struct work *w_next;
+
+  struct job *w_job; /* job which submitted this, jobs never move */
+  IDSA_RULE_CHAIN *w_chain; /* rules in force when it was submitted, held */
+
+  pid_t w_pid;  /* credentials of client */
+  gid_t w_gid;
+  uid_t w_uid;
+  time_t w_time;
+  time_t w_clock;
+
+  int w_status; /* IDSA_IO_OK or IDSA_IO_FAIL */
+  int w_result; /* return value of idsa_chain_run */
+
+  int w_length; /* complete requests copied from read buffer */
+  int w_used;   /* how much of them have been evaluated */
+  char w_buffer[IDSA_M_MESSAGE];
+
+  int w_wire;    /* j_wire of w_job */
+  int w_replied; /* replies to the evaluated requests */
+  char w_reply[JOB_WRITEBUF];
+};
+typedef struct work WORK;
+
+struct worker{
+  pthread_t w_thread;
+  struct pool *w_pool;
+
+  IDSA_RULE_LOCAL *w_local; /* evaluation state private to this thread */
+  IDSA_EVENT *w_request;
+  IDSA_EVENT *w_reply;
+};
+typedef struct worker WORKER;
+
+struct pool{
+  pthread_mutex_t p_lock;   /* protects queues and p_stop */
+  pthread_cond_t p_wait;    /* signalled when work is queued */
+
+  WORK *p_todo;             /* waiting for a worker, oldest first */
+  WORK *p_last;
+  WORK *p_done;             /* evaluated, to be collected by main thread */
+  WORK *p_free;             /* only used by main thread, needs no lock */
+
+  int p_wake[2];            /* pipe to tell main thread about p_done */
+  int p_stop;
+
+  WORKER *p_workers;
+  int p_count;
+
+  struct state_set *p_set;
+};
+typedef struct pool POOL;
+
+struct deferred{
+  IDSA_RULE_CHAIN *d_chain; /* chain the action belongs to */
+  IDSA_RULE_ACTION *d_action;
+  time_t d_time;            /* clocks of the evaluation which queued it */
+  time_t d_clock;
+  IDSA_EVENT *d_request;    /* copies taken when the action was reached */
+  IDSA_EVENT *d_reply;
+};
+typedef struct deferred DEFERRED;
+
+#define DEFER_BLOCK  0      /* overflow: wait for the executor */
+#define DEFER_OLDEST 1      /* overflow: discard oldest queued action */
+#define DEFER_NEWEST 2      /* overflow: discard action being queued */
+
+struct defer{
+  pthread_mutex_t d_lock;   /* protects all below except d_local */
+  pthread_cond_t d_wait;    /* signalled when an action is queued */
+  pthread_cond_t d_room;    /* signalled when an action is taken or done */
+  pthread_t d_thread;
+
+  DEFERRED *d_ring;         /* d_size entries, d_count of them from d_head */
+  int d_size;
+  int d_head;
+  int d_count;
+  int d_busy;               /* executor is running an action */
+  int d_policy;             /* DEFER_* */
+  int d_stop;
+
+  DEFERRED d_run;           /* action being run, swapped out of d_ring */
+  IDSA_RULE_LOCAL *d_local; /* only used by executor */
+
+  unsigned int d_queued;    /* counters for status, queued is dropped plus done */
+  unsigned int d_dropped;
+  unsigned int d_done;
+
+  unsigned int d_entered;   /* actions put on d_ring, see defer_mark */
+  unsigned int d_passed;    /* of these, run or discarded as oldest */
+};
+typedef struct defer DEFER;
+
+struct buffers{
+  int b_size;               /* bytes in each buffer */
+  int b_keep;               /* most spare buffers to hold on to */
+  char *b_free;             /* spare buffers, chained through first bytes */
+  int b_spare;              /* buffers on b_free */
+  int b_used;               /* buffers handed out to jobs */
+};
+typedef struct buffers BUFFERS;
+
+struct quota_entry{
+  uid_t q_uid;
+  int q_count;              /* live connections of q_uid */
+  struct quota_entry *q_next;
+};
+typedef struct quota_entry QUOTA_ENTRY;
+
+struct quota{
+  QUOTA_ENTRY *q_table[IDSAD_QUOTAHASH];
+  QUOTA_ENTRY *q_free;      /* entries whose count dropped to zero */
+};
+typedef struct quota QUOTA;
+
+struct park{
+  IDSA_RULE_CHAIN *k_chain; /* rules it is evaluated under, held */
+  IDSA_RULE_LOCAL *k_local; /* evaluation suspended by a module */
+  IDSA_EVENT *k_request;
+  IDSA_EVENT *k_reply;
+
+  struct job *k_job;        /* job the evaluation belongs to */
+  int k_fd;                 /* descriptor registered with loop, -1 if none */
+  int k_ready;              /* k_fd has been reported ready */
+  long k_until;             /* deadline, see park_now */
+
+  struct park *k_next;
+};
+typedef struct park PARK;
+
 struct job{
-  int j_fd;
+  int j_fd;     /* -1 while slot is unused */
+  unsigned int j_id; /* slot number, key for loop */
+  struct job *j_next; /* next unused slot */
 
   pid_t j_pid;
   gid_t j_gid;
   uid_t j_uid;
 
   int j_state; /* should only be touched in job.c */
+  int j_events; /* readiness currently requested from loop */
+
+  WORK *j_work; /* request being evaluated by worker, if any */
+  PARK *j_park; /* request whose evaluation a module suspended, if any */
+  int j_backlog; /* complete requests left over after IDSAD_BATCH */
 
   int j_rl; /* read buffer length */
-  char j_rbuf[IDSA_M_MESSAGE];
+  int j_more; /* last read filled the buffer, client probably sent a batch */
+  char *j_rbuf; /* IDSA_M_MESSAGE bytes from s_rbufs, NULL if j_rl is zero */
 
   int j_wl; /* write buffer length */
-  char j_wbuf[IDSA_M_MESSAGE];
+  char *j_wbuf; /* JOB_WRITEBUF bytes from s_wbufs, NULL if j_wl is zero */
 
-  /* if interleaved would need separate local, request and reply */
+  IDSA_RING *j_ring; /* memory shared with client, NULL if using the socket */
+  int j_wire; /* IDSA_WIRE_* of replies, as agreed in the hello */
 };
 typedef struct job JOB;
 
+struct retired{
+  IDSA_RULE_CHAIN *r_chain; /* rules replaced by a reload */
+  int r_holders;            /* work and parked evaluations still under it */
+  unsigned int r_mark;      /* defer_mark once r_holders reached zero */
+  struct retired *r_next;
+};
+typedef struct retired RETIRED;
+
 struct state_set{
   IDSA_RULE_CHAIN *s_chain; /* the rule system */
   IDSA_RULE_LOCAL *s_local; /* local rule part */
+  int s_holders;            /* work and parked evaluations under s_chain */
+  RETIRED *s_retired;       /* earlier chains, stopped once nothing holds them */
+
+  char *s_config;           /* where s_chain came from */
+  IDSA_RULE_CHAIN *s_fresh; /* reread rules, only touched by s_parser until done */
+  IDSA_EVENT *s_reload;     /* errors while rereading, workers use s_libidsa */
+  int s_generation;         /* counts rule changes, for verdicts cached by clients */
+  pthread_t s_parser;       /* thread rereading s_config */
+  int s_parsing;            /* s_parser is running */
+  int s_rehup;              /* another reload asked for meanwhile */
+  int s_parsed[2];          /* pipe, s_parser tells main thread it is done */
 
   IDSA_EVENT *s_request;    /* event received from client */
   IDSA_EVENT *s_reply;      /* event sent to client */
@@ -36,17 +234,42 @@ struct state_set{
   IDSA_EVENT *s_libidsa;    /* messages generated inside libidsa */
   IDSA_EVENT *s_idsad;      /* messages generated in idsad */
   IDSA_EVENT *s_template;   /* template for internal messages */
+  IDSA_EVENT *s_notice;     /* s_libidsa taken out of reach of workers */
+
+  POOL *s_pool;             /* worker threads, NULL if evaluating inline */
+  DEFER *s_defer;           /* executor of side effects, NULL if inline */
+  pthread_mutex_t s_serial; /* error reports on chain, once threaded */
+
+  LOOP *s_loop;             /* readiness notification */
+
+  JOB **s_slab;             /* client connections, IDSAD_SLAB per chunk */
+  int s_slabcount;          /* chunks allocated, they never move */
+  int s_slabmax;            /* room in s_slab */
+  JOB *s_jobfree;           /* unused slots, most recently freed first */
+  int s_jobmax;             /* maximum number of clients */
 
-  JOB *s_jobs;              /* table of client connections */
-  int s_jobsize;            /* current size of table */
-  int s_jobmax;             /* maximum size of table */
+  int s_jobcount;           /* number of slots used */
 
-  int s_jobcount;           /* number of entries used */
+  JOB **s_backlog;          /* jobs with j_backlog set, one per slot */
+  int s_backlogcount;
   int s_jobquota;           /* number of entries per user */
+  QUOTA *s_quota;           /* entries held by each nonroot user */
+
+  BUFFERS s_rbufs;          /* read buffers, only held by jobs with input */
+  BUFFERS s_wbufs;          /* write buffers, only held while replies wait */
+
+  int s_ringcount;          /* jobs with a ring */
+
+  PARK *s_parked;           /* suspended evaluations */
+  PARK *s_parkfree;         /* spare locals, requests and replies */
+  int s_parkspare;          /* entries on s_parkfree */
+  int s_parkcount;          /* entries on s_parked */
+  int s_parkdone;           /* a suspended evaluation has completed */
 
   char *s_hostname;         /* cached hostname */
   gid_t s_gid;              /* cached gid */
   time_t s_time;            /* cached time */
+  time_t s_clock;           /* cached monotonic time */
 };
 typedef struct state_set STATE_SET;
 
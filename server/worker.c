@@ -0,0 +1,446 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <idsa_internal.h>
+
+#include "idsad.h"
+#include "structures.h"
+#include "functions.h"
+
+/****************************************************************************/
+/* Notes      : the main thread does all io and framing, workers only run   */
+/*              the rule chain. Each worker has its own local, request and  */
+/*              reply, the chain itself is shared. Modules which have not   */
+/*              declared IDSA_MODULE_F_CONCURRENT get a mutex each and are  */
+/*              entered by one worker at a time. The same applies if only   */
+/*              the executor of deferred actions runs alongside             */
+
+static void worker_chain_lock(void *s, void *l)
+{
+  STATE_SET *set;
+
+  set = s;
+  pthread_mutex_lock(l ? (pthread_mutex_t *) l : &(set->s_serial));
+}
+
+static void worker_chain_unlock(void *s, void *l)
+{
+  STATE_SET *set;
+
+  set = s;
+  pthread_mutex_unlock(l ? (pthread_mutex_t *) l : &(set->s_serial));
+}
+
+/****************************************************************************/
+/* Does       : evaluates up to IDSAD_BATCH requests of w, collecting the   */
+/*              replies in w_reply. Same limits as job_do                   */
+
+static void worker_do(STATE_SET * s, WORKER * k, WORK * w)
+{
+  int i, l;
+
+  w->w_status = IDSA_IO_OK;
+  w->w_result = IDSA_CHAIN_OK;
+
+  for (i = 0; (i < IDSAD_BATCH) && (w->w_used < w->w_length) && (w->w_replied <= JOB_WRITEBUF - IDSA_M_MESSAGE); i++) {
+    l = io_decode(s, w, w->w_used, k->w_request);
+    if (l <= 0) {
+      w->w_status = IDSA_IO_FAIL;
+      return;
+    }
+    w->w_used += l;
+
+    idsa_reply_init(k->w_reply);
+    idsa_local_init(w->w_chain, k->w_local, k->w_request, k->w_reply);
+    idsa_local_settime(k->w_local, w->w_time, w->w_clock);
+    w->w_result = idsa_chain_run(w->w_chain, k->w_local);
+    idsa_local_quit(w->w_chain, k->w_local);
+
+    if (k->w_request->e_fault) {	/* no reply, earlier ones still go out */
+      w->w_result = IDSA_CHAIN_DROP;
+      return;
+    }
+
+    io_stamp(s, k->w_reply);
+    if (w->w_wire == IDSA_WIRE_PACKED) {
+      l = idsa_event_topacked(k->w_reply, w->w_reply + w->w_replied, JOB_WRITEBUF - w->w_replied);
+    } else {
+      l = idsa_event_tobuffer(k->w_reply, w->w_reply + w->w_replied, JOB_WRITEBUF - w->w_replied);
+    }
+    if (l <= 0) {
+      w->w_status = IDSA_IO_FAIL;
+      return;
+    }
+    w->w_replied += l;
+
+    if (w->w_result == IDSA_CHAIN_DROP) {	/* nothing more for this client */
+      return;
+    }
+  }
+}
+
+static void *worker_main(void *arg)
+{
+  WORKER *k;
+  POOL *p;
+  WORK *w;
+
+  k = arg;
+  p = k->w_pool;
+
+  pthread_mutex_lock(&(p->p_lock));
+  for (;;) {
+    while ((p->p_todo == NULL) && (p->p_stop == 0)) {
+      pthread_cond_wait(&(p->p_wait), &(p->p_lock));
+    }
+
+    w = p->p_todo;
+    if (w == NULL) {		/* stopping and nothing left to do */
+      break;
+    }
+    p->p_todo = w->w_next;
+    if (p->p_todo == NULL) {
+      p->p_last = NULL;
+    }
+
+    pthread_mutex_unlock(&(p->p_lock));
+    worker_do(p->p_set, k, w);
+    pthread_mutex_lock(&(p->p_lock));
+
+    /* only need to wake main thread on first completion, it takes all */
+    if (p->p_done == NULL) {
+      write(p->p_wake[1], "", 1);
+    }
+    w->w_next = p->p_done;
+    p->p_done = w;
+  }
+  pthread_mutex_unlock(&(p->p_lock));
+
+  return NULL;
+}
+
+static void worker_list_free(WORK * w)
+{
+  WORK *next;
+
+  while (w) {
+    next = w->w_next;
+    free(w);
+    w = next;
+  }
+}
+
+/****************************************************************************/
+/* Does       : gives each module of c which needs it a lock of its own and */
+/*              makes c safe for evaluation by workers                      */
+/* Returns    : zero on success, nonzero otherwise                          */
+
+int worker_attach(STATE_SET * s, IDSA_RULE_CHAIN * c)
+{
+  IDSA_MODULE *m;
+  pthread_mutex_t *lock;
+
+  if (!worker_threaded(s)) {
+    return 0;
+  }
+
+  for (m = c->c_modules; m != NULL; m = m->m_next) {
+    if (!(m->m_flags & IDSA_MODULE_F_CONCURRENT) && (m->m_lock == NULL)) {
+      lock = malloc(sizeof(pthread_mutex_t));
+      if (lock == NULL) {
+	worker_detach(s, c);
+	return 1;
+      }
+      pthread_mutex_init(lock, NULL);
+      m->m_lock = lock;
+    }
+  }
+  idsa_chain_serialize(c, &worker_chain_lock, &worker_chain_unlock, s);
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : undoes worker_attach, no worker may be using c any longer   */
+
+void worker_detach(STATE_SET * s, IDSA_RULE_CHAIN * c)
+{
+  IDSA_MODULE *m;
+
+  idsa_chain_serialize(c, NULL, NULL, NULL);
+  for (m = c->c_modules; m != NULL; m = m->m_next) {
+    if (m->m_lock) {
+      pthread_mutex_destroy(m->m_lock);
+      free(m->m_lock);
+      m->m_lock = NULL;
+    }
+  }
+}
+
+/****************************************************************************/
+/* Does       : lets c take over module state of o, like idsa_chain_carry,  */
+/*              while workers or the executor may still be evaluating o     */
+/* Returns    : number of modules given the old state                       */
+/* Notes      : c may not be in use yet. Modules which keep state are not   */
+/*              concurrent, so holding their locks keeps o out of them      */
+
+int worker_carry(STATE_SET * s, IDSA_RULE_CHAIN * c, IDSA_RULE_CHAIN * o)
+{
+  IDSA_MODULE *m;
+  int result;
+
+  for (m = o->c_modules; m != NULL; m = m->m_next) {
+    if (m->m_lock) {
+      pthread_mutex_lock(m->m_lock);
+    }
+  }
+
+  result = idsa_chain_carry(c, o);
+
+  for (m = o->c_modules; m != NULL; m = m->m_next) {
+    if (m->m_lock) {
+      pthread_mutex_unlock(m->m_lock);
+    }
+  }
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : starts count workers and serializes the chain               */
+/* Returns    : zero on success, nonzero otherwise                          */
+/* Notes      : has to be called after the last fork, workers block all     */
+/*              signals so that they keep going to the main thread          */
+
+int worker_start(STATE_SET * s, int count)
+{
+  POOL *p;
+  WORKER *k;
+  sigset_t all, old;
+  int i;
+
+  p = malloc(sizeof(POOL));
+  if (p == NULL) {
+    return 1;
+  }
+
+  p->p_todo = NULL;
+  p->p_last = NULL;
+  p->p_done = NULL;
+  p->p_free = NULL;
+  p->p_stop = 0;
+  p->p_count = 0;
+  p->p_set = s;
+
+  p->p_workers = malloc(sizeof(WORKER) * count);
+  if (p->p_workers == NULL) {
+    free(p);
+    return 1;
+  }
+
+  if (pipe(p->p_wake)) {
+    free(p->p_workers);
+    free(p);
+    return 1;
+  }
+  for (i = 0; i < 2; i++) {
+    fcntl(p->p_wake[i], F_SETFD, FD_CLOEXEC);
+    fcntl(p->p_wake[i], F_SETFL, O_NONBLOCK | fcntl(p->p_wake[i], F_GETFL, 0));
+  }
+
+  pthread_mutex_init(&(p->p_lock), NULL);
+  pthread_cond_init(&(p->p_wait), NULL);
+
+  s->s_pool = p;
+
+  if (loop_add(s->s_loop, p->p_wake[0], LOOP_WAKE, LOOP_READ)) {
+    worker_stop(s);
+    return 1;
+  }
+
+  if (worker_attach(s, s->s_chain)) {
+    worker_stop(s);
+    return 1;
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+
+  for (i = 0; i < count; i++) {
+    k = &(p->p_workers[i]);
+    k->w_pool = p;
+    k->w_local = idsa_local_new(s->s_chain);
+    k->w_request = idsa_event_new(0);
+    k->w_reply = idsa_event_new(0);
+
+    if ((k->w_local == NULL) || (k->w_request == NULL) || (k->w_reply == NULL) || pthread_create(&(k->w_thread), NULL, &worker_main, k)) {
+      if (k->w_local) {
+	idsa_local_free(s->s_chain, k->w_local);
+      }
+      if (k->w_request) {
+	idsa_event_free(k->w_request);
+      }
+      if (k->w_reply) {
+	idsa_event_free(k->w_reply);
+      }
+      pthread_sigmask(SIG_SETMASK, &old, NULL);
+      worker_stop(s);
+      return 1;
+    }
+
+    p->p_count++;
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  return 0;
+}
+
+/****************************************************************************/
+/* Does       : lets workers finish what has been queued, then removes them */
+/* Notes      : work not yet collected is discarded                         */
+
+void worker_stop(STATE_SET * s)
+{
+  POOL *p;
+  WORKER *k;
+  int i;
+
+  p = s->s_pool;
+  if (p == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&(p->p_lock));
+  p->p_stop = 1;
+  pthread_cond_broadcast(&(p->p_wait));
+  pthread_mutex_unlock(&(p->p_lock));
+
+  for (i = 0; i < p->p_count; i++) {
+    k = &(p->p_workers[i]);
+    pthread_join(k->w_thread, NULL);
+
+    idsa_local_free(s->s_chain, k->w_local);
+    idsa_event_free(k->w_request);
+    idsa_event_free(k->w_reply);
+  }
+
+  s->s_pool = NULL;
+
+  /* back to single threaded, unless deferring */
+  if (!worker_threaded(s)) {
+    worker_detach(s, s->s_chain);
+  }
+
+  if (s->s_loop) {
+    loop_remove(s->s_loop, p->p_wake[0]);
+  }
+  close(p->p_wake[0]);
+  close(p->p_wake[1]);
+
+  pthread_cond_destroy(&(p->p_wait));
+  pthread_mutex_destroy(&(p->p_lock));
+
+  worker_list_free(p->p_todo);
+  worker_list_free(p->p_done);
+  worker_list_free(p->p_free);
+
+  free(p->p_workers);
+  free(p);
+}
+
+/****************************************************************************/
+/* Does       : appends w to the queue of requests to be evaluated          */
+
+void worker_queue(STATE_SET * s, WORK * w)
+{
+  POOL *p;
+
+  p = s->s_pool;
+
+  w->w_next = NULL;
+
+  pthread_mutex_lock(&(p->p_lock));
+  if (p->p_last) {
+    p->p_last->w_next = w;
+  } else {
+    p->p_todo = w;
+  }
+  p->p_last = w;
+  pthread_cond_signal(&(p->p_wait));
+  pthread_mutex_unlock(&(p->p_lock));
+}
+
+/****************************************************************************/
+/* Does       : takes all evaluated requests, called when LOOP_WAKE fires   */
+/* Returns    : linked list of work, to be returned with worker_put         */
+
+WORK *worker_collect(STATE_SET * s)
+{
+  POOL *p;
+  WORK *result;
+  char buffer[IDSAD_EVENTS];
+
+  p = s->s_pool;
+
+  while (read(p->p_wake[0], buffer, IDSAD_EVENTS) > 0);
+
+  pthread_mutex_lock(&(p->p_lock));
+  result = p->p_done;
+  p->p_done = NULL;
+  pthread_mutex_unlock(&(p->p_lock));
+
+  return result;
+}
+
+/****************************************************************************/
+/* Does       : allocate and recycle work, main thread only                 */
+
+WORK *worker_get(STATE_SET * s)
+{
+  POOL *p;
+  WORK *w;
+
+  p = s->s_pool;
+
+  w = p->p_free;
+  if (w) {
+    p->p_free = w->w_next;
+    return w;
+  }
+
+  return malloc(sizeof(WORK));
+}
+
+void worker_put(STATE_SET * s, WORK * w)
+{
+  POOL *p;
+
+  p = s->s_pool;
+
+  w->w_next = p->p_free;
+  p->p_free = w;
+}
+
+/****************************************************************************/
+/* Does       : excludes workers from reporting errors via s_libidsa        */
+
+void worker_lock(STATE_SET * s)
+{
+  if (worker_threaded(s)) {
+    pthread_mutex_lock(&(s->s_serial));
+  }
+}
+
+void worker_unlock(STATE_SET * s)
+{
+  if (worker_threaded(s)) {
+    pthread_mutex_unlock(&(s->s_serial));
+  }
+}
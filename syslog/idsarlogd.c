@@ -296,7 +296,7 @@ int main(int argc, char **argv)
     }
   }
 
-  con = idsa_open(LOG_SERVICE, NULL, IDSA_F_ENV);
+  con = idsa_open(LOG_SERVICE, NULL, IDSA_F_ENV | IDSA_F_NOWAIT);
   if (con == NULL) {
     fprintf(stderr, "%s: unable to connect to idsad\n", argv[0]);
     exit(1);
@@ -45,11 +45,23 @@ struct tentry {			/* table for connections */
 
 static volatile int run = 1;
 
+/* events collected during one pass over the clients */
+static IDSA_EVENT *pending[IDSA_MAX_BATCH];
+static int pendings = 0;
+
 static void handle(int s)
 {
   run = 0;
 }
 
+static void flushlog(IDSA_CONNECTION * con)
+{
+  if (pendings > 0) {
+    idsa_log_batch(con, pending, pendings, NULL);
+    pendings = 0;
+  }
+}
+
 static void writelog(IDSA_CONNECTION * con, IDSA_UCRED * cred, char *str)
 {
   IDSA_EVENT *evt;
@@ -60,7 +72,10 @@ static void writelog(IDSA_CONNECTION * con, IDSA_UCRED * cred, char *str)
     idsa_gid(evt, cred->gid);
     idsa_pid(evt, cred->pid);
     idsa_scheme(evt, LOG_SCHEME);
-    idsa_log(con, evt);
+    pending[pendings++] = evt;
+    if (pendings >= IDSA_MAX_BATCH) {
+      flushlog(con);
+    }
   }
 }
 
@@ -239,7 +254,7 @@ int main(int argc, char **argv)
   }
   umask(mask);
 
-  con = idsa_open(LOG_SERVICE, NULL, IDSA_F_ENV);
+  con = idsa_open(LOG_SERVICE, NULL, IDSA_F_ENV | IDSA_F_NOWAIT);
   if (con == NULL) {
     fprintf(stderr, "%s: unable to connect to idsad\n", argv[0]);
     exit(1);
@@ -519,6 +534,7 @@ int main(int argc, char **argv)
 	  i++;
 	}
       }
+      flushlog(con);
     }
   }
 
@@ -535,6 +551,8 @@ int main(int argc, char **argv)
   }
   free(tab);
 
+  flushlog(con);
+
   idsa_set(con, "status", LOG_SCHEME, 0, IDSA_R_TOTAL, IDSA_R_NONE, IDSA_R_UNKNOWN, IDSA_SSM, IDSA_T_STRING, IDSA_SSM_SSTOP, "version", IDSA_T_STRING, VERSION, NULL);
   idsa_close(con);
 
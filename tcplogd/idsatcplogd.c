@@ -209,7 +209,7 @@ int main(int argc, char **argv)
     exit(1);
   }
 
-  con = idsa_open(TCPLOG_SERVICE, NULL, IDSA_F_ENV | IDSA_F_UPLOAD);
+  con = idsa_open(TCPLOG_SERVICE, NULL, IDSA_F_ENV | IDSA_F_UPLOAD | IDSA_F_NOWAIT);
   if (con == NULL) {
     fprintf(stderr, "%s: unable to connect to idsad\n", argv[0]);
     exit(1);